@@ -0,0 +1,6 @@
+DROP TABLE IF EXISTS `wh_online_rewards_claimed`;
+CREATE TABLE `wh_online_rewards_claimed` (
+  `PlayerGuid` int(20) NOT NULL DEFAULT 0,
+  `Claimed` blob NOT NULL,
+  PRIMARY KEY (`PlayerGuid`) USING BTREE
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 ROW_FORMAT=COMPACT;
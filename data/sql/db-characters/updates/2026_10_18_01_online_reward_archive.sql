@@ -0,0 +1,2 @@
+CREATE TABLE IF NOT EXISTS `wh_online_rewards_history_archive` LIKE `wh_online_rewards_history`;
+CREATE TABLE IF NOT EXISTS `wh_online_rewards_claimed_archive` LIKE `wh_online_rewards_claimed`;
@@ -0,0 +1,8 @@
+DROP TABLE IF EXISTS `wh_online_rewards_history_packed`;
+CREATE TABLE `wh_online_rewards_history_packed` (
+  `PlayerGuid` int(20) NOT NULL DEFAULT 0,
+  `Version` tinyint(3) UNSIGNED NOT NULL DEFAULT 1,
+  `Data` blob NOT NULL,
+  `Claimed` blob NOT NULL,
+  PRIMARY KEY (`PlayerGuid`) USING BTREE
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 ROW_FORMAT=COMPACT;
@@ -0,0 +1,8 @@
+ALTER TABLE `wh_online_rewards`
+  ADD COLUMN `MaxLevel` tinyint(3) UNSIGNED NOT NULL DEFAULT 0 AFTER `MinLevel`,
+  ADD COLUMN `ClassMask` int(10) UNSIGNED NOT NULL DEFAULT 0 AFTER `MaxLevel`,
+  ADD COLUMN `RaceMask` int(10) UNSIGNED NOT NULL DEFAULT 0 AFTER `ClassMask`,
+  ADD COLUMN `Zones` longtext CHARACTER SET utf8mb4 DEFAULT "" AFTER `RaceMask`,
+  ADD COLUMN `Maps` longtext CHARACTER SET utf8mb4 DEFAULT "" AFTER `Zones`,
+  ADD COLUMN `MinSecurity` tinyint(3) UNSIGNED NOT NULL DEFAULT 0 AFTER `Maps`,
+  ADD COLUMN `DayOfWeekMask` tinyint(3) UNSIGNED NOT NULL DEFAULT 0 AFTER `MinSecurity`;
@@ -0,0 +1,6 @@
+DROP TABLE IF EXISTS `wh_online_rewards_snapshot`;
+CREATE TABLE `wh_online_rewards_snapshot` (
+  `ID` tinyint(3) UNSIGNED NOT NULL DEFAULT 1,
+  `Generation` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  PRIMARY KEY (`ID`) USING BTREE
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 ROW_FORMAT=COMPACT;
@@ -0,0 +1,3 @@
+ALTER TABLE `mail_external`
+  ADD COLUMN `PlayerGuid` int(10) UNSIGNED NOT NULL DEFAULT 0 AFTER `ID`,
+  ADD INDEX `idx_player_guid` (`PlayerGuid`);
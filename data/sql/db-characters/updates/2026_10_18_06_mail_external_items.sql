@@ -0,0 +1,2 @@
+ALTER TABLE `mail_external`
+  ADD COLUMN `Items` varchar(1000) CHARACTER SET utf8 COLLATE utf8_general_ci NOT NULL DEFAULT '' AFTER `ItemCount`;
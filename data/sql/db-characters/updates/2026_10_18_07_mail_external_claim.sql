@@ -0,0 +1,5 @@
+ALTER TABLE `mail_external`
+  ADD COLUMN `ClaimToken` bigint(20) UNSIGNED NOT NULL DEFAULT 0 AFTER `CreatureEntry`,
+  ADD COLUMN `ClaimExpire` int(10) UNSIGNED NOT NULL DEFAULT 0 AFTER `ClaimToken`,
+  ADD INDEX `idx_claim_token` (`ClaimToken`),
+  ADD INDEX `idx_claim_expire` (`ClaimExpire`);
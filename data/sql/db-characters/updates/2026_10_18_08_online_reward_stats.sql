@@ -0,0 +1,16 @@
+CREATE TABLE IF NOT EXISTS `wh_online_rewards_stats` (
+  `RealmID` int(10) UNSIGNED NOT NULL DEFAULT 0,
+  `PeriodStart` int(10) UNSIGNED NOT NULL DEFAULT 0,
+  `RewardID` int(10) UNSIGNED NOT NULL DEFAULT 0,
+  `Grants` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  `ItemUnits` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  `ItemUnitsBagged` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  `ItemUnitsMailed` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  `MailedGrants` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  `Reputation` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  `SkippedIp` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  `SkippedAfk` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  `SkippedLevel` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  `SkippedOther` bigint(20) UNSIGNED NOT NULL DEFAULT 0,
+  PRIMARY KEY (`RealmID`, `PeriodStart`, `RewardID`) USING BTREE
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 ROW_FORMAT=COMPACT;
@@ -0,0 +1 @@
+CREATE TABLE IF NOT EXISTS `wh_online_rewards_history_packed_archive` LIKE `wh_online_rewards_history_packed`;
@@ -0,0 +1 @@
+CREATE TABLE IF NOT EXISTS `mail_external_failed` LIKE `mail_external`;
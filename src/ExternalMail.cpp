@@ -17,16 +17,46 @@
 
 #include "ExternalMail.h"
 #include "CharacterCache.h"
+#include "Chat.h"
+#include "Common.h"
+#include "Config.h"
+#include "ContainerHelpers.h"
 #include "DatabaseEnv.h"
 #include "Log.h"
 #include "Mail.h"
 #include "ObjectAccessor.h"
 #include "ObjectMgr.h"
+#include "OnlineRewardMetrics.h"
+#include "OnlineRewardStorage.h"
+#include "OnlineRewardTrace.h"
+#include "OnlineRewardWatchdog.h"
+#include "StringConvert.h"
+#include "StringFormat.h"
 #include "TaskScheduler.h"
+#include "Tokenize.h"
+#include <algorithm>
 
 namespace
 {
-    TaskScheduler scheduler;
+    // Rows in one multi-row insert
+    constexpr std::size_t INSERT_CHUNK_SIZE = 500;
+
+    // Claim check, lease is shorter than the poll interval. ClaimExpire has seconds, so the lease is at least 1s
+    constexpr uint32 MAIL_CHECK_MAX_ROWS        = 100000;
+    constexpr uint32 MAIL_CHECK_MAX_CLAIMERS    = 8;
+    constexpr Seconds MAIL_CHECK_LEASE_TIME     = 1s;
+    constexpr Seconds MAIL_CHECK_POLL_INTERVAL  = 2s;
+    constexpr Seconds MAIL_CHECK_SETTLE_TIME    = 10s; // Duplicate sends of lost leases come after a held poll
+    constexpr Minutes MAIL_CHECK_TIMEOUT        = 10min;
+
+    // Text is passed as a hex literal, it can't end the literal or change the statement, nothing is escaped
+    std::string ToHexLiteral(std::string_view text)
+    {
+        if (text.empty())
+            return "''";
+
+        return Acore::StringFormatFmt("X'{}'", ByteArrayToHexStr(reinterpret_cast<uint8 const*>(text.data()), text.size()));
+    }
 }
 
 bool ExMail::AddItems(uint32 itemID, uint32 itemCount)
@@ -44,36 +74,109 @@ bool ExMail::AddItems(uint32 itemID, uint32 itemCount)
         return false;
     }
 
-    while (itemCount > itemTemplate->GetMaxStackSize())
+    // Split to stacks, full mail is moved to the list of mails
+    while (itemCount)
     {
-        if (Items.size() <= MAX_MAIL_ITEMS)
-        {
-            Items.emplace_back(itemID, itemTemplate->GetMaxStackSize());
-            itemCount -= itemTemplate->GetMaxStackSize();
-        }
-        else
+        if (Items.size() >= MAX_MAIL_ITEMS)
         {
             OverCountItems.emplace_back(Items);
             Items.clear();
         }
+
+        uint32 stackCount{ std::min(itemCount, itemTemplate->GetMaxStackSize()) };
+        Items.emplace_back(itemID, stackCount);
+        itemCount -= stackCount;
     }
 
-    Items.emplace_back(itemID, itemCount);
-    OverCountItems.emplace_back(Items);
+    return true;
+}
+
+bool ExMail::AddItems(std::string_view items)
+{
+    for (auto const& pairItems : Acore::Tokenize(items, ',', false))
+    {
+        auto itemTokens = Acore::Tokenize(pairItems, ':', false);
+        auto itemID = itemTokens.size() == 2 ? Acore::StringTo<uint32>(itemTokens[0]) : std::nullopt;
+        auto itemCount = itemTokens.size() == 2 ? Acore::StringTo<uint32>(itemTokens[1]) : std::nullopt;
+
+        if (!itemID || !itemCount)
+        {
+            LOG_ERROR("mail.external", "> External Mail: Ошибка в списке предметов '{}'. ID ({})", pairItems, ID);
+            return false;
+        }
+
+        if (!AddItems(*itemID, *itemCount))
+            return false;
+    }
 
     return true;
 }
 
+bool ExMail::PackMails()
+{
+    // Money only mail has no items
+    if (!Items.empty() || (OverCountItems.empty() && Money))
+    {
+        OverCountItems.emplace_back(Items);
+        Items.clear();
+    }
+
+    return !OverCountItems.empty();
+}
+
 ExternalMail* ExternalMail::instance()
 {
     static ExternalMail instance;
     return &instance;
 }
 
+void ExternalMail::LoadConfig()
+{
+    _claimBatchSize = std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.ExternalMail.BatchSize", 500));
+    _claimLeaseTime = Seconds(std::max<uint32>(30, sConfigMgr->GetOption<uint32>("OR.ExternalMail.LeaseTime", 300)));
+    _isPrepareAsync = sConfigMgr->GetOption<bool>("OR.ExternalMail.Prepare.Async", true);
+    _arena.SetEnabled(sConfigMgr->GetOption<bool>("OR.TickArena.Enable", true));
+}
+
 void ExternalMail::Update(uint32 diff)
+{
+    OnlineRewardUpdateTimer updateTimer(MetricUpdate::ExternalMail);
+    OnlineRewardWatchdogTick watchdogTick(MetricUpdate::ExternalMail);
+
+    UpdateClaims(diff);
+
+    if (_claimCheck)
+        UpdateClaimCheck(diff);
+}
+
+void ExternalMail::UpdateClaims(uint32 diff)
 {
     scheduler.Update(diff);
-    _queryProcessor.ProcessReadyCallbacks();
+
+    {
+        OnlineRewardWatchdogPhase watchdogPhase("QueryCallbacks");
+        _queryProcessor.ProcessReadyCallbacks();
+        _transactionProcessor.ProcessReadyCallbacks();
+    }
+
+    if (_isPreparing && _preparePool.IsDone())
+    {
+        _isPreparing = false;
+        FinishPrepare();
+    }
+
+    if (_renewTime && std::chrono::steady_clock::now() >= *_renewTime)
+    {
+        _renewTime.reset();
+        RenewClaims();
+    }
+}
+
+void ExternalMail::OnShutdown()
+{
+    // Waits for the mails being prepared, their rows are claimed again after the lease
+    _preparePool.Stop();
+    _claimCheck.reset();
 }
 
 void ExternalMail::LoadSystem()
@@ -91,24 +194,195 @@ void ExternalMail::LoadSystem()
 
 void ExternalMail::AddMail(std::string_view charName, std::string_view thanksSubject, std::string_view thanksText, uint32 itemID, uint32 itemCount, uint32 creatureEntry)
 {
-    // Add mail item
-    CharacterDatabase.Execute("INSERT INTO `mail_external` (PlayerName, Subject, ItemID, ItemCount, Message, CreatureEntry) VALUES ('{}', '{}', {}, {}, '{}', {})",
-        charName, thanksSubject, itemID, itemCount, thanksText, creatureEntry);
+    ExternalMailRequest request;
+    request.PlayerName = charName;
+    request.Subject = thanksSubject;
+    request.Text = thanksText;
+    request.CreatureEntry = creatureEntry;
+    request.Items.emplace_back(itemID, itemCount);
+
+    AddMails({ &request, 1 });
+}
+
+void ExternalMail::AddMail(ObjectGuid playerGuid, std::string_view thanksSubject, std::string_view thanksText, uint32 itemID, uint32 itemCount, uint32 creatureEntry)
+{
+    ExternalMailRequest request;
+    request.PlayerGuid = playerGuid.GetCounter();
+    request.Subject = thanksSubject;
+    request.Text = thanksText;
+    request.CreatureEntry = creatureEntry;
+    request.Items.emplace_back(itemID, itemCount);
+
+    AddMails({ &request, 1 });
+}
+
+std::size_t ExternalMail::AddMails(std::span<ExternalMailRequest const> requests)
+{
+    return AddMails(requests, nullptr);
+}
+
+std::size_t ExternalMail::AddMails(std::span<ExternalMailRequest const> requests, CharacterDatabaseTransaction trans)
+{
+    std::string values;
+    std::size_t rows{};
+    std::size_t mails{};
+
+    auto InsertRows = [&values, &rows, &trans]()
+    {
+        if (!rows)
+            return;
+
+        // Values are numbers and hex literals only, no format args
+        std::string const sql{ "INSERT INTO `mail_external` (PlayerGuid, PlayerName, Subject, Items, Message, Money, CreatureEntry) VALUES " + values };
+
+        if (trans)
+            trans->Append(sql);
+        else
+            CharacterDatabase.Execute(sql);
+
+        sORMetrics->AddStatements(MetricTable::MailExternal);
+
+        values.clear();
+        rows = 0;
+    };
+
+    for (auto const& request : requests)
+    {
+        if ((!request.PlayerGuid && request.PlayerName.empty()) || (request.Items.empty() && !request.Money))
+        {
+            LOG_ERROR("mail.external", "> External Mail: Нет получателя или вложений в письме для ({}/{}). Пропуск", request.PlayerGuid, request.PlayerName);
+            continue;
+        }
+
+        std::string items;
+
+        for (auto const& [itemID, itemCount] : request.Items)
+        {
+            if (!items.empty())
+                items.append(",");
+
+            items.append(Acore::StringFormatFmt("{}:{}", itemID, itemCount));
+        }
+
+        if (items.size() > MAIL_EXTERNAL_ITEMS_MAX_LENGTH)
+        {
+            LOG_ERROR("mail.external", "> External Mail: Список предметов длиннее {} символов для ({}/{}). Пропуск", MAIL_EXTERNAL_ITEMS_MAX_LENGTH, request.PlayerGuid, request.PlayerName);
+            continue;
+        }
+
+        if (rows)
+            values.append(",");
+
+        values.append(Acore::StringFormatFmt("({}, {}, {}, '{}', {}, {}, {})", request.PlayerGuid, ToHexLiteral(request.PlayerName), ToHexLiteral(request.Subject),
+            items, ToHexLiteral(request.Text), request.Money, request.CreatureEntry));
+
+        if (++rows >= INSERT_CHUNK_SIZE)
+            InsertRows();
+
+        ++mails;
+    }
+
+    InsertRows();
+    return mails;
 }
 
 void ExternalMail::SendMails()
 {
+    // Mails of previous poll are not sent yet, they would be read again.
+    // Claim check uses own claimers, mails of this server wait until it's done
+    if (_isPollInProgress || _claimCheck)
+        return;
+
     LOG_TRACE("mail.external", "> External Mail: GetMailsFromDB");
+    _isPollInProgress = true;
+    sORMetrics->SetContainerStats(MetricContainer::MailQueries, 1, 0, 0);
+
+    OnlineRewardTraceSpan traceSpan("ExternalMail::SendMails", "mail");
+    sORMetrics->AddStatements(MetricTable::MailExternal);
+
+    _claimToken = MakeClaimToken();
+
+    // Unclaimed rows have expire 0. Lease of crashed consumer expires and its rows are claimed again.
+    // Concurrent updates lock rows, so every row is claimed by one consumer only
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    trans->Append("UPDATE mail_external SET ClaimToken = {}, ClaimExpire = UNIX_TIMESTAMP() + {} WHERE ClaimExpire < UNIX_TIMESTAMP() ORDER BY ID ASC LIMIT {}",
+        _claimToken, _claimLeaseTime.count(), _claimBatchSize);
+
+    _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([this, queryStart = GetTraceQueryStart()](bool success)
+    {
+        AddTraceQueryWait("ExternalMail::ClaimMails wait", queryStart);
+
+        if (!success)
+        {
+            _isPollInProgress = false;
+            sORMetrics->SetContainerStats(MetricContainer::MailQueries, 0, 0, 0);
+            return;
+        }
+
+        SelectClaimedMails();
+    }));
+}
+
+uint64 ExternalMail::MakeClaimToken()
+{
+    // 0 is not claimed row
+    uint64 token{};
+
+    do
+    {
+        token = _claimTokenGenerator();
+    } while (!token || token == _claimToken);
+
+    return token;
+}
+
+void ExternalMail::SelectClaimedMails()
+{
+    sORMetrics->AddStatements(MetricTable::MailExternal);
 
     _queryProcessor.AddCallback(
-        CharacterDatabase.AsyncQuery("SELECT ID, PlayerName, Subject, Message, Money, ItemID, ItemCount, CreatureEntry FROM mail_external ORDER BY id ASC").
-        WithCallback(std::bind(&ExternalMail::SendMailsAsync, this, std::placeholders::_1)));
+        CharacterDatabase.AsyncQuery(Acore::StringFormatFmt("SELECT ID, PlayerName, Subject, Message, Money, ItemID, ItemCount, CreatureEntry, PlayerGuid, Items "
+            "FROM mail_external WHERE ClaimToken = {} ORDER BY ID ASC", _claimToken)).
+        WithCallback([this, queryStart = GetTraceQueryStart()](QueryResult result)
+        {
+            AddTraceQueryWait("ExternalMail::SendMails wait", queryStart);
+            SendMailsAsync(std::move(result));
+        }));
 }
 
 void ExternalMail::SendMailsAsync(QueryResult result)
 {
     if (!result)
+    {
+        _isPollInProgress = false;
+        sORMetrics->SetContainerStats(MetricContainer::MailQueries, 0, 0, 0);
+        return;
+    }
+
+    sORMetrics->AddMailRows(result->GetRowCount());
+
+    // World thread time per row without the worker, to compare
+    if (!_isPrepareAsync)
+    {
+        PrepareMails(std::move(result));
+        FinishPrepare();
         return;
+    }
+
+    // Worker thread is kept between polls
+    _preparePool.Start(1);
+    _pollResult = std::move(result);
+    _isPreparing = true;
+
+    _preparePool.RunAsync([this](std::size_t /*index*/)
+    {
+        PrepareMails(std::move(_pollResult));
+    });
+}
+
+void ExternalMail::PrepareMails(QueryResult result)
+{
+    OnlineRewardTraceSpan traceSpan("ExternalMail::PrepareMails", "mail");
 
     do
     {
@@ -122,22 +396,14 @@ void ExternalMail::SendMailsAsync(QueryResult result)
         uint32 ItemID = fields[5].Get<uint32>();
         uint32 ItemCount = fields[6].Get<uint32>();
         uint32 CreatureEntry = fields[7].Get<uint32>();
+        auto PlayerGuid = fields[8].Get<ObjectGuid::LowType>();
+        auto Items = fields[9].Get<std::string_view>();
 
-        if (!normalizePlayerName(PlayerName))
+        // Name is not needed for rows with guid, they work for renamed characters too
+        if (!PlayerGuid && !normalizePlayerName(PlayerName))
         {
             LOG_ERROR("mail.external", "> External Mail: Неверное имя персонажа ({})", PlayerName);
-            continue;
-        }
-
-        auto playerGuid = sCharacterCache->GetCharacterGuidByName(PlayerName);
-        if (playerGuid.IsEmpty())
-            continue;
-
-        // Проверка
-        ItemTemplate const* itemTemplate = sObjectMgr->GetItemTemplate(ItemID);
-        if (!itemTemplate)
-        {
-            LOG_ERROR("mail.external", "> External Mail: Предмета под номером {} не существует. Пропуск", ItemID);
+            _failedIds.emplace_back(ID);
             continue;
         }
 
@@ -145,40 +411,180 @@ void ExternalMail::SendMailsAsync(QueryResult result)
         if (!creature)
         {
             LOG_ERROR("mail.external", "> External Mail: НПС под номером {} не существует. Пропуск", CreatureEntry);
+            _failedIds.emplace_back(ID);
             continue;
         }
 
-        ExMail _data;
+        auto& _data = _store.emplace_back();
         _data.ID = ID;
-        _data.PlayerGuid = playerGuid;
+        _data.PlayerName = PlayerName;
+        _data.PlayerGuid = PlayerGuid ? ObjectGuid::Create<HighGuid::Player>(PlayerGuid) : ObjectGuid::Empty;
         _data.Subject = Subject;
         _data.Body = Body;
         _data.Money = Money;
         _data.CreatureEntry = CreatureEntry;
 
-        if (!_data.AddItems(ItemID, ItemCount))
+        // Single item of old rows, then the list. ItemID 0 - money only or items in list
+        if ((ItemID && !_data.AddItems(ItemID, ItemCount)) || !_data.AddItems(Items))
+        {
+            _store.pop_back();
+            _failedIds.emplace_back(ID);
             continue;
+        }
 
-        _store.emplace(_data.ID, _data);
+        if (!_data.PackMails())
+        {
+            LOG_ERROR("mail.external", "> External Mail: Письмо без предметов и денег. ID ({}). Пропуск", ID);
+            _store.pop_back();
+            _failedIds.emplace_back(ID);
+        }
 
     } while (result->NextRow());
+}
+
+void ExternalMail::FinishPrepare()
+{
+    // Held poll of claim check, the lease expires meanwhile and the rows can be claimed by other claimers
+    if (_holdEvery && ++_polls % _holdEvery == 0)
+    {
+        _renewTime = std::chrono::steady_clock::now() + _claimLeaseTime * 2 + 1s;
+        return;
+    }
+
+    RenewClaims();
+}
+
+void ExternalMail::RenewClaims()
+{
+    // Poll can take longer than the lease, expired rows can be claimed by other consumer already.
+    // Rows still held get a new token and a new lease, only they are sent. Old token can't match rows claimed again
+    uint64 const oldToken{ _claimToken };
+    _claimToken = MakeClaimToken();
+
+    sORMetrics->AddStatements(MetricTable::MailExternal, 2);
+
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    trans->Append("UPDATE mail_external SET ClaimToken = {}, ClaimExpire = UNIX_TIMESTAMP() + {} WHERE ClaimToken = {} AND ClaimExpire >= UNIX_TIMESTAMP()",
+        _claimToken, _claimLeaseTime.count(), oldToken);
+
+    _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([this](bool success)
+    {
+        if (!success)
+        {
+            ResetStore();
+            return;
+        }
+
+        _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormatFmt("SELECT ID FROM mail_external WHERE ClaimToken = {} ORDER BY ID ASC", _claimToken)).
+        WithCallback([this](QueryResult result)
+        {
+            std::vector<uint32> heldIds;
+
+            if (result)
+            {
+                heldIds.reserve(result->GetRowCount());
+
+                for (auto const& row : *result)
+                    heldIds.emplace_back(row[0].Get<uint32>());
+            }
+
+            OnlineRewardWatchdogPhase watchdogPhase("SendPreparedMails");
+            SendPreparedMails(heldIds);
+        }));
+    }));
+}
+
+void ExternalMail::SendPreparedMails(std::span<uint32 const> heldIds)
+{
+    OnlineRewardTraceSpan traceSpan("ExternalMail::SendPreparedMails", "mail");
+
+    auto IsHeld = [heldIds](uint32 id) { return std::binary_search(heldIds.begin(), heldIds.end(), id); };
+
+    std::size_t const lostCount{ static_cast<std::size_t>(std::erase_if(_store, [&IsHeld](ExMail const& exMail) { return !IsHeld(exMail.ID); })) };
+    _lostRows += lostCount;
+
+    if (lostCount)
+        LOG_WARN("mail.external", "> External Mail: Lease of {} rows expired before send, they are left to the consumer which claimed them", lostCount);
+
+    std::erase_if(_failedIds, [&IsHeld](uint32 id) { return !IsHeld(id); });
+
+    // Character cache is changed by world thread, names are resolved here
+    for (auto& exMail : _store)
+    {
+        if (IsTestGuid(exMail.PlayerGuid.GetCounter()))
+            continue;
+
+        if (exMail.PlayerGuid.IsEmpty())
+        {
+            exMail.PlayerGuid = sCharacterCache->GetCharacterGuidByName(std::string(exMail.PlayerName));
+            if (exMail.PlayerGuid.IsEmpty())
+                LOG_ERROR("mail.external", "> External Mail: Персонажа с именем {} не существует. ID ({})", exMail.PlayerName, exMail.ID);
+        }
+        else if (!sCharacterCache->GetCharacterCacheByGuid(exMail.PlayerGuid))
+        {
+            LOG_ERROR("mail.external", "> External Mail: Персонажа с guid {} не существует. ID ({})", exMail.PlayerGuid.GetCounter(), exMail.ID);
+            exMail.PlayerGuid = ObjectGuid::Empty;
+        }
+
+        if (exMail.PlayerGuid.IsEmpty())
+            _failedIds.emplace_back(exMail.ID);
+    }
+
+    std::erase_if(_store, [](ExMail const& exMail) { return exMail.PlayerGuid.IsEmpty(); });
 
     // Check mails
-    if (_store.empty())
+    if (_store.empty() && _failedIds.empty())
+    {
+        ResetStore();
         return;
+    }
 
     CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
 
-    for (auto const& [lowGuid, exMail] : _store)
+    // Invalid rows would be claimed again after every lease, they are moved out of the queue
+    if (!_failedIds.empty())
+    {
+        std::string ids;
+
+        for (auto id : _failedIds)
+        {
+            if (!ids.empty())
+                ids.append(",");
+
+            ids.append(Acore::ToString(id));
+        }
+
+        LOG_ERROR("mail.external", "> External Mail: Rows ({}) are moved to `mail_external_failed`", ids);
+
+        trans->Append("INSERT INTO mail_external_failed SELECT * FROM mail_external WHERE ID IN ({}) AND ClaimToken = {}", ids, _claimToken);
+        trans->Append("DELETE FROM mail_external WHERE ID IN ({}) AND ClaimToken = {}", ids, _claimToken);
+        sORMetrics->AddStatements(MetricTable::MailExternal, 2);
+    }
+
+    std::vector<uint32> testIds;
+
+    for (auto const& exMail : _store)
     {
+        if (IsTestGuid(exMail.PlayerGuid.GetCounter()))
+        {
+            trans->Append("DELETE FROM mail_external WHERE ID = {} AND ClaimToken = {}", exMail.ID, _claimToken);
+            testIds.emplace_back(exMail.ID);
+            continue;
+        }
+
+        Player* receiver = ObjectAccessor::FindPlayer(exMail.PlayerGuid);
+        bool isFirstMail{ true };
+
         for (auto const& items : exMail.OverCountItems)
         {
-            Player* receiver = ObjectAccessor::FindPlayer(exMail.PlayerGuid);
-            auto mail = std::make_unique<MailDraft>(exMail.Subject, exMail.Body);
+            auto mail = std::make_unique<MailDraft>(std::string(exMail.Subject), std::string(exMail.Body));
 
-            if (exMail.Money)
+            // Request can be split to several mails, money is sent once
+            if (isFirstMail && exMail.Money)
                 mail->AddMoney(exMail.Money);
 
+            isFirstMail = false;
+
             for (auto const& [itemID, itemCount] : items)
             {
                 if (Item* mailItem = Item::CreateItem(itemID, itemCount))
@@ -191,14 +597,253 @@ void ExternalMail::SendMailsAsync(QueryResult result)
             mail->SendMailTo(trans, receiver ? receiver : MailReceiver(exMail.PlayerGuid.GetCounter()), MailSender(MAIL_CREATURE, exMail.CreatureEntry, MAIL_STATIONERY_DEFAULT), MAIL_CHECK_MASK_RETURNED);
         }
 
-        trans->Append("DELETE FROM mail_external WHERE id = {}", exMail.ID);
+        trans->Append("DELETE FROM mail_external WHERE ID = {} AND ClaimToken = {}", exMail.ID, _claimToken);
     }
 
-    CharacterDatabase.CommitTransaction(trans);
+    sORMetrics->AddStatements(MetricTable::MailExternal, _store.size());
+
+    // Test rows are counted only after they are deleted
+    if (testIds.empty())
+    {
+        CharacterDatabase.CommitTransaction(trans);
+    }
+    else
+    {
+        _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([this, testIds = std::move(testIds)](bool success)
+        {
+            if (success && _testMailsCallback)
+                _testMailsCallback(testIds);
+        }));
+    }
 
     LOG_DEBUG("mail.external", "> External Mail: Отправлено ({}) писем", static_cast<uint32>(_store.size()));
     LOG_DEBUG("mail.external", "");
 
     // Clear for next time
-    _store.clear();
-}
\ No newline at end of file
+    ResetStore();
+}
+
+void ExternalMail::ResetStore()
+{
+    // Size of the last poll, store is empty between polls
+    std::size_t storeMemory{ GetVectorMemory(_store) };
+
+    for (auto const& exMail : _store)
+    {
+        storeMemory += exMail.PlayerName.capacity() + exMail.Subject.capacity() + exMail.Body.capacity() +
+            GetVectorMemory(exMail.Items) + GetVectorMemory(exMail.OverCountItems);
+
+        for (auto const& items : exMail.OverCountItems)
+            storeMemory += GetVectorMemory(items);
+    }
+
+    sORMetrics->SetContainerStats(MetricContainer::MailStore, _store.size(), 0, storeMemory);
+    sORMetrics->SetContainerStats(MetricContainer::MailQueries, 0, 0, 0);
+
+    _isPollInProgress = false;
+    _store = decltype(_store){ _arena.GetResource() };
+    _failedIds = decltype(_failedIds){ _arena.GetResource() };
+    _arena.Reset();
+
+    sORMetrics->SetArenaStats(MetricArena::ExternalMail, _arena.GetLastAllocations(), _arena.GetCapacity());
+}
+
+bool ExternalMail::StartClaimCheck(uint32 rows, uint32 claimers, ChatHandler* handler)
+{
+    auto Fail = [handler](std::string_view message)
+    {
+        LOG_ERROR("mail.external", "> External Mail: Claim check: {}", message);
+        handler->SendSysMessage(Acore::StringFormatFmt("> {}", message));
+        return false;
+    };
+
+    if (_claimCheck)
+        return Fail("Claim check is in progress");
+
+    if (_testMailsCallback)
+        return Fail("Soak run is in progress");
+
+    if (!rows || rows > MAIL_CHECK_MAX_ROWS)
+        return Fail(Acore::StringFormatFmt("Count of rows must be from 1 to {}", MAIL_CHECK_MAX_ROWS));
+
+    if (claimers < 2 || claimers > MAIL_CHECK_MAX_CLAIMERS)
+        return Fail(Acore::StringFormatFmt("Count of claimers must be from 2 to {}", MAIL_CHECK_MAX_CLAIMERS));
+
+    _claimCheck = std::make_unique<ClaimCheck>();
+    _claimCheck->Rows = rows;
+
+    for (uint32 i = 0; i < claimers; ++i)
+        _claimCheck->Claimers.emplace_back(std::make_unique<ExternalMail>())->_isPrepareAsync = _isPrepareAsync;
+
+    // Money only mails, they don't depend on item templates
+    std::vector<ExternalMailRequest> requests(rows);
+
+    for (uint32 i = 0; i < rows; ++i)
+    {
+        requests[i].PlayerGuid = MAIL_CHECK_FIRST_GUID + i % MAIL_CHECK_MAX_GUIDS;
+        requests[i].Subject = "Claim check";
+        requests[i].Money = 1;
+        requests[i].CreatureEntry = 37688;
+    }
+
+    // Rows of a stopped check are removed. New rows are claimed by nobody until all of them are known, consumers skip them meanwhile
+    std::string const range{ Acore::StringFormatFmt("PlayerGuid BETWEEN {} AND {}", MAIL_CHECK_FIRST_GUID, MAIL_CHECK_FIRST_GUID + MAIL_CHECK_MAX_GUIDS - 1) };
+
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    trans->Append("DELETE FROM mail_external WHERE {}", range);
+    AddMails(requests, trans);
+    trans->Append("UPDATE mail_external SET ClaimToken = 0, ClaimExpire = UNIX_TIMESTAMP() + 3600 WHERE {}", range);
+    sORMetrics->AddStatements(MetricTable::MailExternal, 2);
+
+    _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([this, range](bool success)
+    {
+        if (!success)
+        {
+            LOG_ERROR("mail.external", "> External Mail: Claim check: Can't insert rows, check is stopped");
+            _claimCheck.reset();
+            return;
+        }
+
+        sORMetrics->AddStatements(MetricTable::MailExternal);
+
+        _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormatFmt("SELECT ID FROM mail_external WHERE {} ORDER BY ID ASC", range)).
+        WithCallback([this](QueryResult result)
+        {
+            if (result)
+            {
+                _claimCheck->Ids.reserve(result->GetRowCount());
+
+                for (auto const& row : *result)
+                    _claimCheck->Ids.emplace_back(row[0].Get<uint32>());
+            }
+
+            ReleaseClaimCheckRows();
+        }));
+    }));
+
+    LOG_INFO("mail.external", "> External Mail: Claim check of {} rows with {} claimers started", rows, claimers);
+    handler->SendSysMessage(Acore::StringFormatFmt("> Claim check of {} rows with {} claimers started, results are logged to `mail.external`", rows, claimers));
+    return true;
+}
+
+void ExternalMail::ReleaseClaimCheckRows()
+{
+    sORMetrics->AddStatements(MetricTable::MailExternal);
+
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    trans->Append("UPDATE mail_external SET ClaimExpire = 0 WHERE PlayerGuid BETWEEN {} AND {} AND ClaimToken = 0",
+        MAIL_CHECK_FIRST_GUID, MAIL_CHECK_FIRST_GUID + MAIL_CHECK_MAX_GUIDS - 1);
+
+    _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([this](bool success)
+    {
+        if (!success)
+        {
+            FinishClaimCheck(true);
+            return;
+        }
+
+        // Every claimer takes a part of rows per poll, so all of them poll several times. Claimers hold different polls
+        uint32 const batchSize{ std::max<uint32>(1, _claimCheck->Rows / (_claimCheck->Claimers.size() * 4)) };
+        uint32 holdEvery{ 2 };
+
+        for (auto& claimer : _claimCheck->Claimers)
+        {
+            claimer->StartClaimer(batchSize, MAIL_CHECK_LEASE_TIME, MAIL_CHECK_POLL_INTERVAL, holdEvery++, [this](std::span<uint32 const> ids)
+            {
+                if (!_claimCheck)
+                    return;
+
+                for (auto id : ids)
+                {
+                    if (std::binary_search(_claimCheck->Ids.begin(), _claimCheck->Ids.end(), id))
+                        ++_claimCheck->Sent[id];
+                    else
+                        ++_claimCheck->UnknownSends;
+                }
+            });
+        }
+
+        _claimCheck->IsStarted = true;
+        _claimCheck->Start = std::chrono::steady_clock::now();
+    }));
+}
+
+void ExternalMail::StartClaimer(uint32 batchSize, Seconds leaseTime, Seconds pollInterval, uint32 holdEvery, TestMailsCallback&& callback)
+{
+    _claimBatchSize = batchSize;
+    _claimLeaseTime = leaseTime;
+    _holdEvery = holdEvery;
+    _testMailsCallback = std::move(callback);
+
+    scheduler.CancelAll();
+    scheduler.Schedule(pollInterval, [this, pollInterval](TaskContext context)
+    {
+        SendMails();
+        context.Repeat(pollInterval);
+    });
+}
+
+void ExternalMail::UpdateClaimCheck(uint32 diff)
+{
+    if (!_claimCheck->IsStarted)
+        return;
+
+    for (auto& claimer : _claimCheck->Claimers)
+        claimer->UpdateClaims(diff);
+
+    auto const now{ std::chrono::steady_clock::now() };
+
+    if (!_claimCheck->AllSentTime && _claimCheck->Sent.size() == _claimCheck->Ids.size())
+        _claimCheck->AllSentTime = now;
+
+    if (_claimCheck->AllSentTime && now >= *_claimCheck->AllSentTime + MAIL_CHECK_SETTLE_TIME)
+        FinishClaimCheck(false);
+    else if (now >= _claimCheck->Start + MAIL_CHECK_TIMEOUT)
+        FinishClaimCheck(true);
+}
+
+void ExternalMail::FinishClaimCheck(bool isTimeout)
+{
+    // Claimers are stopped with the check, their claims expire after the lease
+    auto check{ std::move(_claimCheck) };
+
+    uint64 lostRows{};
+    uint64 polls{};
+
+    for (auto const& claimer : check->Claimers)
+    {
+        lostRows += claimer->_lostRows;
+        polls += claimer->_polls;
+    }
+
+    uint64 missing{};
+    uint64 duplicates{};
+
+    for (auto id : check->Ids)
+    {
+        auto const sends{ Acore::Containers::MapGetValuePtr(check->Sent, id) };
+
+        if (!sends)
+            ++missing;
+        else if (*sends > 1)
+            duplicates += *sends - 1;
+    }
+
+    // Lost leases show that expired rows were claimed again, without them the check covers nothing of it
+    bool const isFailed{ isTimeout || check->Ids.size() != check->Rows || missing || duplicates || check->UnknownSends || !lostRows };
+
+    LOG_INFO("mail.external", "> External Mail: Claim check: rows {}/{}, claimers {}, polls {}, rows of expired leases {}, missing {}, duplicates {}, unknown {}",
+        check->Ids.size(), check->Rows, check->Claimers.size(), polls, lostRows, missing, duplicates, check->UnknownSends);
+
+    if (isTimeout)
+        LOG_ERROR("mail.external", "> External Mail: Claim check: Not all rows are sent in {} minutes", MAIL_CHECK_TIMEOUT.count());
+
+    if (!lostRows)
+        LOG_ERROR("mail.external", "> External Mail: Claim check: No lease expired before send, claim of expired rows is not covered");
+
+    LOG_INFO("mail.external", "> External Mail: Claim check {}", isFailed ? "FAILED" : "PASSED");
+
+    // Rows which were not sent
+    if (missing)
+        CharacterDatabase.Execute("DELETE FROM mail_external WHERE PlayerGuid BETWEEN {} AND {}", MAIL_CHECK_FIRST_GUID, MAIL_CHECK_FIRST_GUID + MAIL_CHECK_MAX_GUIDS - 1);
+}
@@ -20,21 +20,75 @@
 
 #include "AsyncCallbackProcessor.h"
 #include "DatabaseEnvFwd.h"
+#include "Duration.h"
 #include "ObjectGuid.h"
+#include "OnlineRewardArena.h"
+#include "OnlineRewardWorkerPool.h"
+#include "TaskScheduler.h"
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <random>
+#include <span>
 #include <unordered_map>
 
+class ChatHandler;
+
+// Allocator aware, mails of one poll are allocated from ExternalMail arena
 struct ExMail
 {
-    uint32 ID;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+    using ItemsList = std::pmr::vector<std::pair<uint32, uint32>>;
+
+    explicit ExMail(allocator_type allocator = {}) :
+        PlayerName(allocator), Subject(allocator), Body(allocator), Items(allocator), OverCountItems(allocator) { }
+
+    ExMail(ExMail const& other, allocator_type allocator) :
+        ID(other.ID), PlayerName(other.PlayerName, allocator), PlayerGuid(other.PlayerGuid), Subject(other.Subject, allocator), Body(other.Body, allocator),
+        Money(other.Money), CreatureEntry(other.CreatureEntry), Items(other.Items, allocator), OverCountItems(other.OverCountItems, allocator) { }
+
+    ExMail(ExMail&& other, allocator_type allocator) :
+        ID(other.ID), PlayerName(std::move(other.PlayerName), allocator), PlayerGuid(other.PlayerGuid), Subject(std::move(other.Subject), allocator),
+        Body(std::move(other.Body), allocator), Money(other.Money), CreatureEntry(other.CreatureEntry), Items(std::move(other.Items), allocator),
+        OverCountItems(std::move(other.OverCountItems), allocator) { }
+
+    ExMail(ExMail const&) = default;
+    ExMail(ExMail&&) = default;
+    ExMail& operator= (ExMail const&) = default;
+    ExMail& operator= (ExMail&&) = default;
+
+    uint32 ID{};
+    std::pmr::string PlayerName; // Normalized, resolved to guid in world thread if `PlayerGuid` is not set in row
     ObjectGuid PlayerGuid;
-    std::string Subject;
-    std::string Body;
-    uint32 Money;
-    uint32 CreatureEntry;
-    std::list<std::pair<uint32, uint32>> Items;
-    std::list<std::list<std::pair<uint32, uint32>>> OverCountItems;
+    std::pmr::string Subject;
+    std::pmr::string Body;
+    uint32 Money{};
+    uint32 CreatureEntry{};
+    ItemsList Items;                            // Stacks of mail which is not full yet
+    std::pmr::vector<ItemsList> OverCountItems; // Stacks of every mail to send, up to MAX_MAIL_ITEMS each
 
     bool AddItems(uint32 itemID, uint32 itemCount);
+    bool AddItems(std::string_view items); // itemid1:count1,itemid2:count2 ... itemidN:countN
+
+    // Move last not full mail to the list, call after all items. Returns false if there is nothing to send
+    bool PackMails();
+};
+
+// Length of `mail_external`.`Items`
+constexpr std::size_t MAIL_EXTERNAL_ITEMS_MAX_LENGTH = 1000;
+
+// Mail queued by AddMails, one row of `mail_external` with all items. Can have money only.
+// Receiver is found by `PlayerGuid` if it's set, `PlayerName` is not resolved then
+struct ExternalMailRequest
+{
+    ObjectGuid::LowType PlayerGuid{};
+    std::string PlayerName;
+    std::string Subject;
+    std::string Text;
+    uint32 Money{};
+    uint32 CreatureEntry{};
+    std::vector<std::pair<uint32, uint32>> Items;
 };
 
 class ExternalMail
@@ -42,20 +96,98 @@ class ExternalMail
 public:
     static ExternalMail* instance();
 
+    void LoadConfig();
     void Update(uint32 diff);
     void LoadSystem();
+    void OnShutdown();
 
     void AddMail(std::string_view charName, std::string_view thanksSubject, std::string_view thanksText, uint32 itemID, uint32 itemCount, uint32 creatureEntry);
+    void AddMail(ObjectGuid playerGuid, std::string_view thanksSubject, std::string_view thanksText, uint32 itemID, uint32 itemCount, uint32 creatureEntry);
+
+    // Queue all mails with multi-row inserts, texts are sent as hex literals. Returns count of queued mails, invalid ones are skipped.
+    // Items over `MAIL_EXTERNAL_ITEMS_MAX_LENGTH` are invalid, they would fail the insert of all rows or be cut
+    std::size_t AddMails(std::span<ExternalMailRequest const> requests);
+
+    // Rows to reserved test guids (see `IsTestGuid`) are checked and deleted like sent ones, but no mail is created.
+    // Callback gets their ids after the commit, test runs count deliveries with it
+    using TestMailsCallback = std::function<void(std::span<uint32 const>)>;
+    inline void SetTestMailsCallback(TestMailsCallback&& callback) { _testMailsCallback = std::move(callback); }
+
+    // Claim check: `rows` money mails to reserved guids are sent by `claimers` own consumers of this server, every one with
+    // a lease shorter than its poll interval. Some polls are held longer than the lease, their rows are claimed again by others.
+    // Every row must be sent exactly once. Polls of this server wait until it's done, results are logged
+    bool StartClaimCheck(uint32 rows, uint32 claimers, ChatHandler* handler);
+    [[nodiscard]] inline bool IsClaimCheckRunning() const { return _claimCheck != nullptr; }
 
 private:
+    struct ClaimCheck
+    {
+        uint32 Rows{};
+        std::vector<std::unique_ptr<ExternalMail>> Claimers;
+        std::vector<uint32> Ids; // Sorted, selected after the insert
+        std::unordered_map<uint32/*id*/, uint32/*sends*/> Sent;
+        uint64 UnknownSends{};
+        bool IsStarted{};
+        TimePoint Start;
+        std::optional<TimePoint> AllSentTime; // Later sends are still counted for a while, they would be duplicates
+    };
+
+    // World update of own claims, without metrics of the world thread. Claimers of claim check are updated by it too
+    void UpdateClaims(uint32 diff);
     void SendMails();
+    void ResetStore();
+
+    // `trans` is used if it's set, rows are inserted at its commit
+    std::size_t AddMails(std::span<ExternalMailRequest const> requests, CharacterDatabaseTransaction trans);
+
+    // Claim check
+    void StartClaimer(uint32 batchSize, Seconds leaseTime, Seconds pollInterval, uint32 holdEvery, TestMailsCallback&& callback);
+    void ReleaseClaimCheckRows();
+    void UpdateClaimCheck(uint32 diff);
+    void FinishClaimCheck(bool isTimeout);
 
     // Async
+    uint64 MakeClaimToken();
+    void SelectClaimedMails();
     void SendMailsAsync(QueryResult result);
 
-    std::unordered_map<uint32, ExMail> _store;
+    // Worker thread, or world thread with `OR.ExternalMail.Prepare.Async = 0`. Fills `_store` with checked mails.
+    // Only thread safe data is used: templates and own arena
+    void PrepareMails(QueryResult result);
+
+    // World thread, after PrepareMails is done. Rows still claimed by this server get a new lease, others are not sent.
+    // Claimer of claim check holds every `_holdEvery` poll until its lease expires
+    void FinishPrepare();
+    void RenewClaims();
+    void SendPreparedMails(std::span<uint32 const> heldIds);
+
+    OnlineRewardArena _arena;
+    std::pmr::vector<ExMail> _store{ _arena.GetResource() }; // Owned by worker while `_isPreparing`
+    std::pmr::vector<uint32> _failedIds{ _arena.GetResource() }; // Invalid rows, moved to `mail_external_failed`. Owned like `_store`
+
+    bool _isPollInProgress{}; // From poll query until prepared mails are sent, next poll is skipped
+    bool _isPrepareAsync{ true };
+    bool _isPreparing{};
+    QueryResult _pollResult; // Owned by worker like `_store`
+    OnlineRewardWorkerPool _preparePool;
+
+    // Rows are claimed with a lease, so several servers can poll one table. Token is new for every poll
+    uint32 _claimBatchSize{ 500 };
+    Seconds _claimLeaseTime{ 5min };
+    uint64 _claimToken{};
+    std::mt19937_64 _claimTokenGenerator{ std::random_device{}() };
+    uint64 _lostRows{}; // Lease expired before send
+
+    TestMailsCallback _testMailsCallback;
+    uint32 _holdEvery{};
+    uint32 _polls{};
+    std::optional<TimePoint> _renewTime; // End of a held poll
+    std::unique_ptr<ClaimCheck> _claimCheck;
+
+    TaskScheduler scheduler;
 
     QueryCallbackProcessor _queryProcessor;
+    AsyncCallbackProcessor<TransactionCallback> _transactionProcessor;
 };
 
 #define sExternalMail ExternalMail::instance()
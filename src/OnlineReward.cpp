@@ -19,14 +19,19 @@
 #include "Common.h"
 #include "Config.h"
 #include "Chat.h"
-#include "DatabaseEnv.h"
 #include "ExternalMail.h"
 #include "Log.h"
+#include "Mail.h"
 #include "ObjectAccessor.h"
+#include "OnlineRewardMaintenance.h"
+#include "OnlineRewardMetrics.h"
+#include "OnlineRewardTrace.h"
+#include "OnlineRewardWatchdog.h"
 #include "Player.h"
 #include "ReputationMgr.h"
 #include "StringConvert.h"
 #include "Tokenize.h"
+#include "Util.h"
 
 namespace
 {
@@ -37,6 +42,11 @@ namespace
     constexpr auto OR_LOCALE_NOT_ENOUGH_BAG     = 5;
     constexpr auto OR_LOCALE_NEXT               = 6;
 
+    constexpr std::size_t ELIGIBILITY_MIN_PARTITION_SIZE = 64;
+
+    // `.or bench` runs on the character DB of the realm
+    constexpr uint32 BENCH_MAX_PLAYERS = 100000;
+
     constexpr std::string_view GetLocaleText(uint32 textId, LocaleConstant localeConstant)
     {
         if (localeConstant != LOCALE_enUS && localeConstant != LOCALE_ruRU)
@@ -98,6 +108,141 @@ namespace
 
         return Acore::StringFormatFmt("|c{:08x}|Hitem:{}:0:0:0:0:0:0:0:0|h[{}]|h|r", color, itemID, name);
     }
+
+    // Count of item which fits in bags, over `MaxCount` is counted as no space too
+    uint32 GetBagCount(Player* player, uint32 itemID, uint32 itemCount, ItemPosCountVec& dest)
+    {
+        uint32 noSpaceCount{ 0 };
+
+        InventoryResult msg = player->CanStoreNewItem(NULL_BAG, NULL_SLOT, dest, itemID, itemCount, &noSpaceCount);
+        return msg == EQUIP_ERR_OK ? itemCount : itemCount - std::min(noSpaceCount, itemCount);
+    }
+
+    // Stores up to the given count of item in bags, returns the stored count
+    using BagStoreFunction = std::function<uint32(uint32/*item id*/, uint32/*count*/)>;
+
+    // Bags get what `storeInBags` stores of every item, returns the counts which must be sent via mail
+    std::map<uint32, uint32> GetMailItems(std::map<uint32, uint32> const& items, BagStoreFunction const& storeInBags)
+    {
+        std::map<uint32, uint32> mailItems;
+
+        for (auto const& [itemID, itemCount] : items)
+        {
+            uint32 const bagCount{ std::min(storeInBags(itemID, itemCount), itemCount) };
+
+            if (bagCount < itemCount)
+                mailItems.emplace(itemID, itemCount - bagCount);
+        }
+
+        return mailItems;
+    }
+
+    // Store in bags as much as fits, returns the counts which must be sent via mail
+    std::map<uint32, uint32> StoreItemsInBags(Player* player, std::map<uint32, uint32> const& items)
+    {
+        return GetMailItems(items, [player](uint32 itemID, uint32 itemCount) -> uint32
+        {
+            ItemPosCountVec dest;
+            uint32 const bagCount{ GetBagCount(player, itemID, itemCount, dest) };
+
+            Item* item = bagCount && !dest.empty() ? player->StoreNewItem(dest, itemID, true, Item::GenerateItemRandomPropertyId(itemID)) : nullptr;
+            if (!item)
+                return 0;
+
+            player->SendNewItem(item, bagCount, true, false);
+            return bagCount;
+        });
+    }
+
+    // Bags of synthetic player with `freeSlots` empty slots, items take whole slots while they are left
+    BagStoreFunction MakeSyntheticBags(uint32 freeSlots)
+    {
+        return [freeSlots](uint32 itemID, uint32 itemCount) mutable -> uint32
+        {
+            ItemTemplate const* itemTemplate = sObjectMgr->GetItemTemplate(itemID);
+            uint32 const stackSize{ itemTemplate ? std::max<uint32>(1, itemTemplate->GetMaxStackSize()) : 1 };
+            uint32 const bagCount{ static_cast<uint32>(std::min<uint64>(itemCount, static_cast<uint64>(freeSlots) * stackSize)) };
+
+            freeSlots -= (bagCount + stackSize - 1) / stackSize;
+            return bagCount;
+        };
+    }
+
+    uint32 GetStacksCount(std::map<uint32, uint32> const& items)
+    {
+        uint32 stacks{ 0 };
+
+        for (auto const& [itemID, itemCount] : items)
+        {
+            ItemTemplate const* itemTemplate = sObjectMgr->GetItemTemplate(itemID);
+            uint32 const stackSize{ itemTemplate ? std::max<uint32>(1, itemTemplate->GetMaxStackSize()) : 1 };
+            stacks += (itemCount + stackSize - 1) / stackSize;
+        }
+
+        return stacks;
+    }
+
+    // Items of `mail_external` rows. Counts are merged by grant, so an item with `MaxCount` can be over it,
+    // such row would be rejected at send. Rows are also limited to one mail of stacks and to the length of `Items`.
+    // A new row is started when a limit is reached, the rest of an item goes to the next row
+    std::vector<std::vector<std::pair<uint32, uint32>>> SplitMailItems(std::map<uint32, uint32> const& items)
+    {
+        std::vector<std::vector<std::pair<uint32, uint32>>> rows;
+        std::size_t rowStacks{ 0 };
+        std::size_t rowLength{ 0 };
+
+        for (auto const& [itemID, itemCount] : items)
+        {
+            ItemTemplate const* itemTemplate = sObjectMgr->GetItemTemplate(itemID);
+            uint32 const maxCount{ itemTemplate && itemTemplate->MaxCount > 0 ? static_cast<uint32>(itemTemplate->MaxCount) : itemCount };
+            uint32 const stackSize{ itemTemplate ? std::max<uint32>(1, itemTemplate->GetMaxStackSize()) : itemCount };
+
+            // "id:count" with a comma, count of a part is not bigger
+            std::size_t const entryLength{ Acore::StringFormatFmt("{}:{}", itemID, itemCount).size() + 1 };
+
+            uint32 count{ itemCount };
+
+            while (count)
+            {
+                bool const isItemInRow{ !rows.empty() && !rows.back().empty() && rows.back().back().first == itemID };
+
+                if (rows.empty() || isItemInRow || rowStacks >= MAX_MAIL_ITEMS || rowLength + entryLength > MAIL_EXTERNAL_ITEMS_MAX_LENGTH)
+                {
+                    rows.emplace_back();
+                    rowStacks = 0;
+                    rowLength = 0;
+                }
+
+                uint32 const rowCount{ std::min({ count, maxCount, static_cast<uint32>(MAX_MAIL_ITEMS - rowStacks) * stackSize }) };
+                rows.back().emplace_back(itemID, rowCount);
+                rowStacks += (rowCount + stackSize - 1) / stackSize;
+                rowLength += entryLength;
+                count -= rowCount;
+            }
+        }
+
+        return rows;
+    }
+
+    // Comma separated ids of condition column, wrong tokens are skipped
+    std::vector<uint32> ParseIdList(uint32 rewardID, std::string_view column, std::string_view list)
+    {
+        std::vector<uint32> ids;
+
+        for (auto const& token : Acore::Tokenize(list, ',', false))
+        {
+            auto id = Acore::StringTo<uint32>(token);
+            if (!id)
+            {
+                LOG_ERROR("module.or", "> OnlineRewardMgr::LoadDBData: Error at extract id from '{}' in `{}` of reward {}. Skip", token, column, rewardID);
+                continue;
+            }
+
+            ids.emplace_back(*id);
+        }
+
+        return ids;
+    }
 }
 
 OnlineRewardMgr* OnlineRewardMgr::instance()
@@ -111,6 +256,12 @@ void OnlineRewardMgr::LoadConfig(bool reload)
     if (reload)
         scheduler.CancelAll();
 
+    // Backend is not changed by reload, loaded history and callbacks belong to it
+    if (!_storage)
+        _storage = OnlineRewardStorage::Create(sConfigMgr->GetOption<std::string>("OR.Storage.Backend", "mysql"));
+
+    _storage->LoadConfig();
+
     _isEnable = sConfigMgr->GetOption<bool>("OR.Enable", false);
     if (!_isEnable)
         return;
@@ -120,6 +271,33 @@ void OnlineRewardMgr::LoadConfig(bool reload)
     _isForceMailReward = sConfigMgr->GetOption<bool>("OR.ForceSendMail.Enable", false);
     _maxSameIpCount = sConfigMgr->GetOption<uint32>("OR.MaxSameIpCount", 3);
     _skipAfkPlayers = sConfigMgr->GetOption<bool>("OR.SkipAfkPlayers.Enable", true);
+    _eligibilityThreads = std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Eligibility.Threads", 1));
+    _eligibilityPool.Start(_eligibilityThreads - 1);
+    _isTickArenaEnable = sConfigMgr->GetOption<bool>("OR.TickArena.Enable", true);
+    _tickArena.SetEnabled(_isTickArenaEnable);
+
+    for (auto& arena : _partitionArenas)
+        arena->SetEnabled(_isTickArenaEnable);
+
+    _isSnapshotEnable = sConfigMgr->GetOption<bool>("OR.Snapshot.Enable", false);
+    _snapshotFile = sConfigMgr->GetOption<std::string>("OR.Snapshot.File", "or_snapshot.bin");
+    _snapshotInterval = Minutes(std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Snapshot.Interval", 10)));
+    _isPreloadEnable = sConfigMgr->GetOption<bool>("OR.Preload.Enable", false);
+    _preloadDays = std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Preload.Days", 7));
+    _dormantMaxMemory = static_cast<std::size_t>(sConfigMgr->GetOption<uint32>("OR.HistoryCache.MaxMemory", 64)) * 1024 * 1024;
+    _historyLoadMaxQueries = std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.HistoryLoad.MaxQueries", 50));
+    _rewardInterval = Seconds(std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Reward.Interval", 60)));
+    _isDueCheckEnable = sConfigMgr->GetOption<bool>("OR.DueCheck.Enable", true);
+    _soakPlayers = sConfigMgr->GetOption<uint32>("OR.Soak.Players", 0);
+    _soakDuration = Minutes(std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Soak.Duration", 60)));
+    _soakSessionTime = Minutes(std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Soak.SessionTime", 30)));
+    _soakTimeScale = std::clamp<uint32>(sConfigMgr->GetOption<uint32>("OR.Soak.TimeScale", 1), 1, 3600);
+    _soakAfkChangesPerHour = sConfigMgr->GetOption<uint32>("OR.Soak.AfkChangesPerHour", 6);
+    _soakLevelUpsPerHour = sConfigMgr->GetOption<uint32>("OR.Soak.LevelUpsPerHour", 1);
+    _soakResultFile = sConfigMgr->GetOption<std::string>("OR.Soak.ResultFile", "or_soak_result.txt");
+    _soakBaselineFile = sConfigMgr->GetOption<std::string>("OR.Soak.BaselineFile", "or_soak_baseline.txt");
+    _soakMaxRegression = sConfigMgr->GetOption<uint32>("OR.Soak.MaxRegression", 10);
+    _isSoakShutdown = sConfigMgr->GetOption<bool>("OR.Soak.Shutdown", false);
 
     if (!_isPerOnlineEnable && !_isPerTimeEnable)
     {
@@ -137,13 +315,22 @@ void OnlineRewardMgr::InitSystem()
     if (!_isEnable)
         return;
 
-    LoadDBData();
+    _storage->LoadSystem();
+
+    // Catalog and history of last online players from warm restart snapshot, DB is used if it's missing or outdated
+    if (!LoadSnapshot())
+        LoadDBData();
 
     // If data empty no need reward players
     if (!_isEnable)
         return;
 
+    PreloadHistory();
+
     ScheduleReward();
+
+    if (_soakPlayers)
+        StartSoak(_soakPlayers, _soakDuration);
 }
 
 void OnlineRewardMgr::ScheduleReward()
@@ -153,24 +340,71 @@ void OnlineRewardMgr::ScheduleReward()
 
     scheduler.Schedule(30s, [this](TaskContext context)
     {
+        TimePoint const start{ std::chrono::steady_clock::now() };
         RewardPlayers();
-        context.Repeat(1min);
+
+        if (_soak)
+            AddSoakPass(true, start);
+
+        UpdateMemoryStats();
+        sORTrace->OnTickEnd();
+        context.Repeat(_rewardInterval);
     });
+
+    if (_isDueCheckEnable)
+    {
+        scheduler.Schedule(1s, [this](TaskContext context)
+        {
+            TimePoint const start{ std::chrono::steady_clock::now() };
+            RewardDuePlayers();
+
+            if (_soak)
+                AddSoakPass(false, start);
+
+            context.Repeat();
+        });
+    }
+
+    if (_isSnapshotEnable)
+    {
+        scheduler.Schedule(_snapshotInterval, [this](TaskContext context)
+        {
+            SaveSnapshotAsync();
+            context.Repeat();
+        });
+    }
 }
 
 void OnlineRewardMgr::Update(Milliseconds diff)
 {
+    OnlineRewardUpdateTimer updateTimer(MetricUpdate::OnlineReward);
+    OnlineRewardWatchdogTick watchdogTick(MetricUpdate::OnlineReward);
+
+    // Maintenance job uses the storage even if rewards are disabled
+    if (_storage)
+    {
+        OnlineRewardWatchdogPhase watchdogPhase("StorageCallbacks");
+        _storage->Update();
+    }
+
     if (!_isEnable)
         return;
 
     scheduler.Update(diff);
-    _queryProcessor.ProcessReadyCallbacks();
+
+    if (_soak)
+        UpdateSoak();
+
+    OnlineRewardWatchdogPhase watchdogPhase("ProcessHistoryLoadQueue");
+    ProcessHistoryLoadQueue();
 }
 
 void OnlineRewardMgr::RewardNow()
 {
     scheduler.CancelAll();
     RewardPlayers();
+    UpdateMemoryStats();
+    sORTrace->OnTickEnd();
     ScheduleReward();
 }
 
@@ -181,27 +415,33 @@ void OnlineRewardMgr::LoadDBData()
     if (!_rewards.empty())
         _rewards.clear();
 
-    QueryResult result = CharacterDatabase.Query("SELECT `ID`, `IsPerOnline`, `Seconds`, `MinLevel`, `Items`, `Reputations` FROM `wh_online_rewards`");
-    if (!result)
+    auto const storedRewards{ _storage->LoadRewards() };
+    if (storedRewards.empty())
     {
         LOG_WARN("module.or", "> DB table `wh_online_rewards` is empty! Disable module");
         LOG_WARN("module.or", "");
+        RebuildRewardIndex();
         _isEnable = false;
         return;
     }
 
-    for (auto const& row : *result)
+    for (auto const& reward : storedRewards)
     {
-        auto id             = row[0].Get<uint32>();
-        auto isPerOnline    = row[1].Get<bool>();
-        auto seconds        = row[2].Get<int32>();
-        auto minLevel       = row[3].Get<uint8>();
-        auto items          = row[4].Get<std::string_view>();
-        auto reputations    = row[5].Get<std::string_view>();
-
-        AddReward(id, isPerOnline, Seconds(seconds), minLevel, items, reputations);
+        OnlineRewardConditions conditions;
+        conditions.MinLevel         = reward.MinLevel;
+        conditions.MaxLevel         = reward.MaxLevel;
+        conditions.ClassMask        = reward.ClassMask;
+        conditions.RaceMask         = reward.RaceMask;
+        conditions.Zones            = ParseIdList(reward.ID, "Zones", reward.Zones);
+        conditions.Maps             = ParseIdList(reward.ID, "Maps", reward.Maps);
+        conditions.MinSecurity      = reward.MinSecurity;
+        conditions.DayOfWeekMask    = reward.DayOfWeekMask;
+
+        AddReward(reward.ID, reward.IsPerOnline, Seconds(reward.RewardTime), std::move(conditions), reward.Items, reward.Reputations);
     }
 
+    RebuildRewardIndex();
+
     if (_rewards.empty())
     {
         LOG_INFO("module.or", ">> Loaded 0 online rewards");
@@ -215,7 +455,7 @@ void OnlineRewardMgr::LoadDBData()
     LOG_INFO("module.or", "");
 }
 
-bool OnlineRewardMgr::AddReward(uint32 id, bool isPerOnline, Seconds seconds, uint8 minLevel, std::string_view items, std::string_view reputations, ChatHandler* handler /*= nullptr*/)
+bool OnlineRewardMgr::AddReward(uint32 id, bool isPerOnline, Seconds seconds, OnlineRewardConditions conditions, std::string_view items, std::string_view reputations, ChatHandler* handler /*= nullptr*/)
 {
     auto SendErrorMessage = [handler](std::string_view message)
     {
@@ -238,13 +478,23 @@ bool OnlineRewardMgr::AddReward(uint32 id, bool isPerOnline, Seconds seconds, ui
         return false;
     }
 
-    if (minLevel == 0 || minLevel > 80)
+    if (conditions.MinLevel == 0 || conditions.MinLevel > 80)
+    {
+        SendErrorMessage(Acore::StringFormatFmt("> OnlineRewardMgr::AddReward: Incorrect level: {}", conditions.MinLevel));
+        return false;
+    }
+
+    if (conditions.MaxLevel && conditions.MaxLevel < conditions.MinLevel)
     {
-        SendErrorMessage(Acore::StringFormatFmt("> OnlineRewardMgr::AddReward: Incorrect level: {}", minLevel));
+        SendErrorMessage(Acore::StringFormatFmt("> OnlineRewardMgr::AddReward: Max level {} < min level {}", conditions.MaxLevel, conditions.MinLevel));
         return false;
     }
 
-    OnlineReward data(id, isPerOnline, seconds, minLevel);
+    // Saved before compile, only the min level is set from command
+    uint8 const minLevel{ conditions.MinLevel };
+    conditions.Compile();
+
+    OnlineReward data(id, isPerOnline, seconds, std::move(conditions));
     auto const& itemData = Acore::Tokenize(items, ',', false);
     auto const& reputationsData = Acore::Tokenize(reputations, ',', false);
 
@@ -332,7 +582,7 @@ bool OnlineRewardMgr::AddReward(uint32 id, bool isPerOnline, Seconds seconds, ui
                 continue;
             }
 
-            data.Reputations.emplace_back(*factionID, *reputationCount);
+            data.Reputations.emplace_back(factionEntry, *reputationCount);
         }
     }
 
@@ -348,8 +598,17 @@ bool OnlineRewardMgr::AddReward(uint32 id, bool isPerOnline, Seconds seconds, ui
     // If add from command - save to db
     if (handler)
     {
-        CharacterDatabase.Execute("INSERT INTO `wh_online_rewards` (`ID`, `IsPerOnline`, `Seconds`, `Items`, `Reputations`) VALUES ({}, {:d}, {}, '{}', '{}')",
-            id, isPerOnline, seconds.count(), items, reputations);
+        OnlineRewardStoredReward storedReward;
+        storedReward.ID = id;
+        storedReward.IsPerOnline = isPerOnline;
+        storedReward.RewardTime = static_cast<uint32>(seconds.count());
+        storedReward.MinLevel = minLevel;
+        storedReward.Items = items;
+        storedReward.Reputations = reputations;
+
+        _storage->AddReward(storedReward);
+
+        RebuildRewardIndex();
     }
 
     if (!_isEnable)
@@ -361,283 +620,1274 @@ bool OnlineRewardMgr::AddReward(uint32 id, bool isPerOnline, Seconds seconds, ui
     return true;
 }
 
-void OnlineRewardMgr::AddRewardHistory(ObjectGuid::LowType lowGuid)
+void OnlineRewardMgr::AddRewardHistory(ObjectGuid::LowType lowGuid, Seconds playedTime)
 {
     if (!_isEnable)
         return;
 
-    if (IsExistHistory(lowGuid))
+    _playerAfk.try_emplace(lowGuid, false);
+
+    if (IsExistHistory(lowGuid) || _historyLoads.contains(lowGuid))
         return;
 
-    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormatFmt("SELECT `RewardID`, `RewardedSeconds` FROM `wh_online_rewards_history` WHERE `PlayerGuid` = {}", lowGuid)).
-    WithCallback([this, lowGuid](QueryResult result)
+    // History from snapshot, startup preload or logout with unsaved changes of due check
+    auto node = _dormantHistory.extract(lowGuid);
+    sORMetrics->AddHistoryCacheLookup(!node.empty());
+
+    if (node)
     {
-        AddRewardHistoryAsync(lowGuid, std::move(result));
-    }));
+        _dormantMemory -= node.mapped().Memory;
+        sORMetrics->SetHistoryCacheStats(_dormantHistory.size(), _dormantMemory);
+        AddRewardHistoryAsync(lowGuid, std::move(node.mapped().History));
+        return;
+    }
+
+    auto const now{ std::chrono::steady_clock::now() };
+    auto const loadId{ ++_lastHistoryLoadId };
+
+    _historyLoads.emplace(lowGuid, HistoryLoad{ HistoryLoadState::Queued, loadId, now });
+    _historyLoadQueue.emplace(now + GetSecondsToNextReward(playedTime), lowGuid, loadId);
+    UpdateHistoryLoadStats();
 }
 
-void OnlineRewardMgr::DeleteRewardHistory(ObjectGuid::LowType lowGuid)
+void OnlineRewardMgr::ProcessHistoryLoadQueue()
 {
-    if (!_isEnable)
-        return;
+    while (!_historyLoadQueue.empty() && _historyQueries < _historyLoadMaxQueries)
+    {
+        auto const [nextReward, lowGuid, loadId] = _historyLoadQueue.top();
+        _historyLoadQueue.pop();
 
-    _rewardHistory.erase(lowGuid);
+        // Player logged out before the query
+        auto itr = _historyLoads.find(lowGuid);
+        if (itr == _historyLoads.end() || itr->second.LoadId != loadId)
+            continue;
+
+        itr->second.State = HistoryLoadState::Loading;
+        LoadHistory(lowGuid, loadId);
+    }
 }
 
-void OnlineRewardMgr::RewardPlayers()
+Seconds OnlineRewardMgr::GetSecondsToNextReward(Seconds playedTime) const
 {
-    if (!_isEnable)
-        return;
+    Seconds result{ DAY };
 
-    // Empty world, no need reward
-    if (!sWorld->GetPlayerCount())
-        return;
+    // Per time rewards count from the last rewarded time in history, played time is the best guess without it
+    if (_isPerTimeEnable)
+        for (auto const* onlineReward : _perTimeRewards)
+            result = std::min(result, onlineReward->RewardTime - playedTime % onlineReward->RewardTime);
 
-    ASSERT(_rewardPending.empty());
+    if (_isPerOnlineEnable)
+    {
+        auto itr = std::upper_bound(_onceRewardTimes.begin(), _onceRewardTimes.end(), playedTime);
+        if (itr != _onceRewardTimes.end())
+            result = std::min(result, *itr - playedTime);
+    }
 
-    LOG_DEBUG("module.or", "> OR: Start rewards players...");
+    return result;
+}
 
-    auto const& sessions = sWorld->GetAllSessions();
-    if (sessions.empty())
+bool OnlineRewardMgr::IsActiveHistoryLoad(ObjectGuid::LowType lowGuid, uint32 loadId) const
+{
+    auto itr = _historyLoads.find(lowGuid);
+    return itr != _historyLoads.end() && itr->second.LoadId == loadId;
+}
+
+void OnlineRewardMgr::FinishHistoryLoad(ObjectGuid::LowType lowGuid)
+{
+    auto itr = _historyLoads.find(lowGuid);
+    if (itr == _historyLoads.end())
         return;
 
-    MakeIpCache();
+    sORMetrics->AddHistoryLoadWait(std::chrono::duration_cast<Milliseconds>(std::chrono::steady_clock::now() - itr->second.QueuedTime));
+    _historyLoads.erase(itr);
+    UpdateHistoryLoadStats();
+}
 
-    for (auto const& [accountID, session] : sessions)
+void OnlineRewardMgr::UpdateHistoryLoadStats()
+{
+    sORMetrics->SetHistoryLoadWaiting(_historyLoads.size());
+
+    // Backlog lasts from the first waiting player until nobody waits, e.g. login wave after restart
+    if (!_historyLoads.empty())
     {
-        auto player = session->GetPlayer();
-        if (!player || !player->IsInWorld())
-            continue;
+        if (!_historyBacklogStart)
+            _historyBacklogStart = std::chrono::steady_clock::now();
 
-        Seconds playedTimeSec{ player->GetTotalPlayedTime() };
+        return;
+    }
 
-        for (auto const& [rewardID, reward] : _rewards)
-        {
-            if (reward.IsPerOnline && !_isPerOnlineEnable)
-                continue;
+    if (_historyBacklogStart)
+    {
+        sORMetrics->AddHistoryLoadBacklog(std::chrono::duration_cast<Milliseconds>(std::chrono::steady_clock::now() - *_historyBacklogStart));
+        _historyBacklogStart.reset();
+    }
 
-            if (!reward.IsPerOnline && !_isPerTimeEnable)
-                continue;
+    // Queue can keep entries of logged out players
+    _historyLoadQueue = {};
+}
 
-            CheckPlayerForReward(player, playedTimeSec, &reward);
-        }
-    }
+void OnlineRewardMgr::LoadHistory(ObjectGuid::LowType lowGuid, uint32 loadId)
+{
+    ++_historyQueries;
 
-    _ipCache.clear();
+    _storage->LoadHistory(lowGuid, [this, lowGuid, loadId](OnlineRewardHistoryStatus status, OnlineRewardStoredHistory&& storedHistory)
+    {
+        --_historyQueries;
 
-    // Send reward
-    SendRewards();
+        if (!IsActiveHistoryLoad(lowGuid, loadId))
+            return;
 
-    // Save data to DB
-    SaveRewardHistoryToDB();
+        // Player is not rewarded until next login, empty history would give claimed rewards again
+        if (status == OnlineRewardHistoryStatus::Error)
+        {
+            FinishHistoryLoad(lowGuid);
+            return;
+        }
 
-    LOG_DEBUG("module.or", "> OR: End rewards players");
+        // Not found - new player, history is empty
+        AddRewardHistoryAsync(lowGuid, MakeRewardHistory(std::move(storedHistory)));
+    });
 }
 
-void OnlineRewardMgr::SaveRewardHistoryToDB()
+OnlineRewardMgr::RewardHistory OnlineRewardMgr::MakeRewardHistory(OnlineRewardStoredHistory&& storedHistory) const
 {
-    if (_rewardHistory.empty())
-        return;
-
-    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    RewardHistory history;
+    history.StorageFormat = storedHistory.Format;
+    UnpackClaims(storedHistory.Claimed, history.Claimed);
 
-    // Save data for exist history
-    for (auto const& [lowGuid, history] : _rewardHistory)
+    // Old format, one-shot rewards was saved as rows with rewarded seconds
+    std::erase_if(storedHistory.PerTime, [this, &history](RewardHistoryStruct const& historyStruct)
     {
-        // Delete old data
-        trans->Append("DELETE FROM `wh_online_rewards_history` WHERE `PlayerGuid` = {}", lowGuid);
+        auto onlineReward = Acore::Containers::MapGetValuePtr(_rewards, historyStruct.first);
+        if (!onlineReward || !onlineReward->IsPerOnline)
+            return false;
 
-        for (auto const& [rewardID, seconds] : history)
+        if (historyStruct.second != 0s)
         {
-             // Insert new data
-            trans->Append("INSERT INTO `wh_online_rewards_history` (`PlayerGuid`, `RewardID`, `RewardedSeconds`) VALUES ({}, '{}', {})", lowGuid, rewardID, seconds.count());
+            history.Claimed.Set(onlineReward->ClaimIndex);
+            history.IsClaimedChanged = true;
         }
-    }
 
-    CharacterDatabase.CommitTransaction(trans);
+        return true;
+    });
+
+    history.PerTime = std::move(storedHistory.PerTime);
+    return history;
 }
 
-OnlineRewardMgr::RewardHistory* OnlineRewardMgr::GetHistory(ObjectGuid::LowType lowGuid)
+OnlineRewardStoredHistory OnlineRewardMgr::MakeStoredHistory(ObjectGuid::LowType lowGuid, RewardHistory const& history) const
 {
-    if (_rewardHistory.empty())
-        return nullptr;
-
-    auto const& itr = _rewardHistory.find(lowGuid);
-    if (itr == _rewardHistory.end())
-        return nullptr;
-
-    return &itr->second;
+    OnlineRewardStoredHistory storedHistory;
+    storedHistory.PlayerGuid = lowGuid;
+    storedHistory.PerTime = history.PerTime;
+    storedHistory.Claimed = PackClaims(history.Claimed);
+    storedHistory.Format = history.StorageFormat;
+    storedHistory.IsClaimedChanged = history.IsClaimedChanged;
+    return storedHistory;
 }
 
-Seconds OnlineRewardMgr::GetHistorySecondsForReward(ObjectGuid::LowType lowGuid, uint32 id)
+void OnlineRewardMgr::DeleteRewardHistory(ObjectGuid::LowType lowGuid)
 {
-    if (_rewardHistory.empty())
-        return 0s;
+    if (!_isEnable)
+        return;
 
-    auto const& itr = _rewardHistory.find(lowGuid);
-    if (itr == _rewardHistory.end())
-        return 0s;
+    _playerAfk.erase(lowGuid);
 
-    for (auto const& [rewardID, seconds] : itr->second)
-        if (rewardID == id)
-            return seconds;
+    if (_historyLoads.erase(lowGuid))
+        UpdateHistoryLoadStats();
 
-    return 0s;
-}
+    // Queue can keep entries of logged out players
+    if (_rewardDue.erase(lowGuid) && _rewardDue.empty())
+        _rewardDueQueue = {};
 
-void OnlineRewardMgr::SendRewardForPlayer(Player* player, uint32 rewardID)
-{
-    auto onlineReward = GetOnlineReward(rewardID);
-    if (!onlineReward)
+    auto node = _rewardHistory.extract(lowGuid);
+    if (!node)
         return;
 
-    ChatHandler handler{ player->GetSession() };
-    std::string playedTimeSecStr{ Acore::Time::ToTimeString(onlineReward->RewardTime, TimeOutput::Seconds, TimeFormat::FullText) };
-    auto localeIndex{ player->GetSession()->GetSessionDbLocaleIndex() };
+    // Players can be kicked at shutdown before the snapshot is written.
+    // Changes of due check wait for the next full pass in the cache, it's used if the player logs in before
+    bool const isSavePending{ node.mapped().IsSavePending };
+    if (!isSavePending && !(_isSnapshotEnable && World::IsStopped()))
+        return;
 
-    auto SendItemsViaMail = [player, onlineReward, playedTimeSecStr, &localeIndex]()
+    if (AddDormantHistory(lowGuid, std::move(node.mapped())))
     {
-        auto const mailSubject = Acore::StringFormatFmt(GetLocaleText(OR_LOCALE_SUBJECT, localeIndex), playedTimeSecStr);
-        auto const MailText = Acore::StringFormatFmt(GetLocaleText(OR_LOCALE_TEXT, localeIndex), player->GetName(), playedTimeSecStr);
-
-        // Send External mail
-        for (auto const& [itemID, itemCount] : onlineReward->Items)
-            sExternalMail->AddMail(player->GetName(), mailSubject, MailText, itemID, itemCount, 37688);
-    };
+        if (isSavePending)
+            _unsavedDormant.emplace_back(lowGuid);
 
-    if (!onlineReward->Reputations.empty())
-    {
-        for (auto const& [faction, reputation] : onlineReward->Reputations)
-        {
-            ReputationMgr& repMgr = player->GetReputationMgr();
-            auto const& factionEntry = sFactionStore.LookupEntry(faction);
-            if (factionEntry)
-            {
-                repMgr.SetOneFactionReputation(factionEntry, static_cast<float>(reputation), true);
-                repMgr.SendState(repMgr.GetState(factionEntry));
-            }
-        }
+        return;
     }
 
-    if (_isForceMailReward && !onlineReward->Items.empty())
-    {
-        SendItemsViaMail();
+    if (!isSavePending)
+        return;
 
-        // Send chat text
-        SendLocalizePlayerMessage(player, GetLocaleText(OR_LOCALE_MESSAGE_MAIL, localeIndex), playedTimeSecStr);
+    // Cache is full, the pass is saved now
+    _rewardHistory.insert(std::move(node));
+    SaveRewardHistoryToDB();
+    _rewardHistory.erase(lowGuid);
+}
+
+void OnlineRewardMgr::PreloadHistory()
+{
+    if (!_isPreloadEnable)
         return;
-    }
 
-    if (!onlineReward->Items.empty())
+    LOG_INFO("module.or", "Preloading history of players active in last {} days...", _preloadDays);
+
+    std::size_t const oldCount{ _dormantHistory.size() };
+    bool isFull{};
+
+    // Recent players go first, so they are kept if the cache is full
+    _storage->PreloadHistory(_preloadDays, [this, &isFull](OnlineRewardStoredHistory&& storedHistory)
     {
-        for (auto const& [itemID, itemCount] : onlineReward->Items)
-        {
-            if (!player->AddItem(itemID, itemCount))
-            {
-                SendItemsViaMail();
+        auto const lowGuid{ storedHistory.PlayerGuid };
+        isFull = !AddDormantHistory(lowGuid, MakeRewardHistory(std::move(storedHistory)));
+        return !isFull;
+    });
 
-                // Send chat text
-                SendLocalizePlayerMessage(player, GetLocaleText(OR_LOCALE_NOT_ENOUGH_BAG, localeIndex));
-            }
-        }
-    }
+    if (isFull)
+        LOG_WARN("module.or", "> OR: History cache is full ({} MB), increase `OR.HistoryCache.MaxMemory` to preload all active players", _dormantMaxMemory / 1024 / 1024);
 
-    // Send chat text
-    SendLocalizePlayerMessage(player, GetLocaleText(OR_LOCALE_MESSAGE_IN_GAME, localeIndex), playedTimeSecStr);
+    LOG_INFO("module.or", ">> Preloaded history of {} players ({} KB)", _dormantHistory.size() - oldCount, _dormantMemory / 1024);
+    LOG_INFO("module.or", "");
 }
 
-void OnlineRewardMgr::AddHistory(ObjectGuid::LowType lowGuid, uint32 rewardId, Seconds playerOnlineTime)
+bool OnlineRewardMgr::AddDormantHistory(ObjectGuid::LowType lowGuid, RewardHistory&& rewardHistory)
 {
-    auto history = GetHistory(lowGuid);
-    if (!history)
-    {
-        _rewardHistory.emplace(lowGuid, RewardHistory{ { rewardId, playerOnlineTime } });
-        return;
-    }
+    // Already loaded history is newer or the same
+    if (_dormantHistory.contains(lowGuid) || _rewardHistory.contains(lowGuid))
+        return true;
 
-    for (auto& [rewardID, seconds] : *history)
-    {
-        if (rewardID == rewardId)
-        {
-            seconds = playerOnlineTime;
-            return;
-        }
-    }
+    std::size_t const memory{ sizeof(decltype(_dormantHistory)::value_type) + sizeof(void*) * 2 +
+        rewardHistory.PerTime.capacity() * sizeof(RewardHistoryStruct) + rewardHistory.Claimed.GetMemoryUsage() };
 
-    history->emplace_back(rewardId, playerOnlineTime);
+    if (_dormantMemory + memory > _dormantMaxMemory)
+        return false;
+
+    _dormantMemory += memory;
+    _dormantHistory.emplace(lowGuid, DormantHistory{ std::move(rewardHistory), memory });
+    sORMetrics->SetHistoryCacheStats(_dormantHistory.size(), _dormantMemory);
+    return true;
 }
 
-bool OnlineRewardMgr::IsExistHistory(ObjectGuid::LowType lowGuid)
+void OnlineRewardMgr::ClearDormantHistory()
 {
-    return _rewardHistory.contains(lowGuid);
+    _dormantHistory.clear();
+    _dormantMemory = 0;
+    _unsavedDormant.clear();
+    sORMetrics->SetHistoryCacheStats(0, 0);
 }
 
-void OnlineRewardMgr::AddRewardHistoryAsync(ObjectGuid::LowType lowGuid, QueryResult result)
+void OnlineRewardMgr::RewardPlayers()
 {
-    if (!result)
+    if (!_isEnable)
         return;
 
-    std::lock_guard<std::mutex> guard(_playerLoadingLock);
-
-    if (_rewardHistory.contains(lowGuid))
+    // Empty world, no need reward. Due check changes of players logged out since the last pass are still saved
+    if (!sWorld->GetPlayerCount() && !_soak)
     {
-        LOG_FATAL("module.or", "> OR: Time to ping @Winfidonarleyan. Code 2");
-        _rewardHistory.erase(lowGuid);
+        SaveRewardHistoryToDB();
+        return;
     }
 
-    RewardHistory rewardHistory;
+    ASSERT(_rewardPending.empty());
 
-    for (auto const& row : *result)
-        rewardHistory.emplace_back(row[0].Get<uint32>(), row[1].Get<Seconds>());
+    OnlineRewardTraceSpan traceSpan("RewardPlayers");
+    LOG_DEBUG("module.or", "> OR: Start rewards players...");
 
-    _rewardHistory.emplace(lowGuid, rewardHistory);
-    LOG_DEBUG("module.or", "> OR: Added history for player with guid {}", lowGuid);
+    MakePlayerSnapshots();
+    RewardSnapshots();
+
+    // Save data to DB, one transaction per pass with changes of due checks since the last one
+    SaveRewardHistoryToDB();
+
+    LOG_DEBUG("module.or", "> OR: End rewards players");
 }
 
-void OnlineRewardMgr::CheckPlayerForReward(Player* player, Seconds playedTime, OnlineReward const* onlineReward)
+void OnlineRewardMgr::RewardDuePlayers()
 {
-    if (!onlineReward || !player || playedTime == 0s)
+    if (!_isEnable)
         return;
 
-    auto lowGuid{ player->GetGUID().GetCounter() };
+    std::vector<RewardDueEvent> events;
 
-    auto AddToStore = [this, onlineReward, player](ObjectGuid::LowType playerGuid)
     {
-        if (!onlineReward->IsPerOnline && !IsNormalIpPlayer(player))
-            return;
+        std::lock_guard<std::mutex> guard(_rewardDueEventsLock);
+        events.swap(_rewardDueEvents);
+    }
 
-        if (_skipAfkPlayers && player->isAFK() && !onlineReward->IsPerOnline)
-            return;
+    if (events.empty() && (_rewardDueQueue.empty() || _rewardDueQueue.top().first > std::chrono::steady_clock::now()))
+        return;
 
-        if (onlineReward->MinLevel > player->GetLevel())
-            return;
+    ASSERT(_rewardPending.empty());
 
-        auto const& itr = _rewardPending.find(playerGuid);
-        if (itr == _rewardPending.end())
-        {
-            _rewardPending.emplace(playerGuid, RewardPending{ onlineReward->ID });
-            return;
-        }
+    OnlineRewardTraceSpan traceSpan("RewardDuePlayers");
+    auto const now{ std::chrono::steady_clock::now() };
 
-        itr->second.emplace_back(onlineReward->ID);
-    };
+    _duePlayers.clear();
 
-    auto rewardedSeconds = GetHistorySecondsForReward(lowGuid, onlineReward->ID);
+    for (auto const& event : events)
+        _duePlayers.emplace_back(event.LowGuid);
 
-    if (onlineReward->IsPerOnline)
-    {
-        if (playedTime >= onlineReward->RewardTime && rewardedSeconds == 0s)
-            AddToStore(lowGuid);
-    }
-    else
+    while (!_rewardDueQueue.empty() && _rewardDueQueue.top().first <= now)
     {
-        for (Seconds diffTime{ onlineReward->RewardTime }; diffTime < playedTime; diffTime += onlineReward->RewardTime)
-            if (rewardedSeconds < diffTime)
-                AddToStore(lowGuid);
+        auto const [due, lowGuid] = _rewardDueQueue.top();
+        _rewardDueQueue.pop();
+
+        auto itr = _rewardDue.find(lowGuid);
+        if (itr == _rewardDue.end() || itr->second != due)
+            continue;
+
+        _rewardDue.erase(itr);
+        _duePlayers.emplace_back(lowGuid);
     }
 
-    AddHistory(lowGuid, onlineReward->ID, playedTime);
-}
+    std::sort(_duePlayers.begin(), _duePlayers.end());
+    _duePlayers.erase(std::unique(_duePlayers.begin(), _duePlayers.end()), _duePlayers.end());
+
+    MakeDuePlayerSnapshots();
+
+    // Reverse order, so the state before the first afk change of the player is used
+    for (auto itr = events.rbegin(); itr != events.rend(); ++itr)
+    {
+        if (!itr->WasAfk)
+            continue;
+
+        for (auto& snapshot : _playerSnapshots)
+            if (snapshot.IsDue && snapshot.LowGuid == itr->LowGuid)
+                snapshot.IsAfk = *itr->WasAfk;
+    }
+
+    RewardSnapshots();
+
+    // Saved by the next full pass or at logout, a save per check would be a transaction per second
+    for (auto lowGuid : _duePlayers)
+        if (auto itr = _rewardHistory.find(lowGuid); itr != _rewardHistory.end())
+            itr->second.IsSavePending = true;
+}
+
+void OnlineRewardMgr::RewardSnapshots()
+{
+    if (_playerSnapshots.empty())
+    {
+        ResetTickContainers();
+        return;
+    }
+
+    MakeIpCache();
+    CheckPlayersForReward();
+    UpdateRewardDue();
+
+    // Send reward
+    SendRewards();
+
+    ResetTickContainers();
+}
+
+void OnlineRewardMgr::MakePlayerSnapshots()
+{
+    OnlineRewardTraceSpan traceSpan("MakePlayerSnapshots");
+    OnlineRewardWatchdogPhase watchdogPhase("MakePlayerSnapshots");
+    _playerSnapshots.clear();
+    _dayOfWeekMask = 1 << Acore::Time::TimeBreakdown().tm_wday;
+
+    auto const& sessions = sWorld->GetAllSessions();
+    _playerSnapshots.reserve(sessions.size() + (_soak ? _soak->Online.size() : 0));
+
+    for (auto const& [accountID, session] : sessions)
+        AddPlayerSnapshot(session, session->GetPlayer(), true);
+
+    if (_soak)
+        for (auto const& [lowGuid, soakPlayer] : _soak->Online)
+            AddSoakSnapshot(lowGuid, true);
+
+    sORWatchdog->AddPlayersScanned(_playerSnapshots.size());
+}
+
+void OnlineRewardMgr::MakeDuePlayerSnapshots()
+{
+    OnlineRewardTraceSpan traceSpan("MakeDuePlayerSnapshots");
+    OnlineRewardWatchdogPhase watchdogPhase("MakeDuePlayerSnapshots");
+    _playerSnapshots.clear();
+    _dayOfWeekMask = 1 << Acore::Time::TimeBreakdown().tm_wday;
+
+    // Players of one address are added once, even if several of them are due
+    std::pmr::vector<std::string_view> addresses{ _tickArena.GetResource() };
+
+    for (auto lowGuid : _duePlayers)
+    {
+        auto player = ObjectAccessor::FindPlayerByLowGUID(lowGuid);
+        if (!player)
+        {
+            if (_soak)
+                AddSoakSnapshot(lowGuid, true);
+
+            continue;
+        }
+
+        std::string const& address{ player->GetSession()->GetRemoteAddress() };
+        if (std::find(addresses.begin(), addresses.end(), address) != addresses.end())
+            continue;
+
+        addresses.emplace_back(address);
+
+        auto itr = _addressPlayers.find(address);
+        if (itr == _addressPlayers.end())
+        {
+            AddPlayerSnapshot(player->GetSession(), player, true);
+            continue;
+        }
+
+        for (auto addressGuid : itr->second)
+            if (auto addressPlayer = ObjectAccessor::FindPlayerByLowGUID(addressGuid))
+                AddPlayerSnapshot(addressPlayer->GetSession(), addressPlayer, std::binary_search(_duePlayers.begin(), _duePlayers.end(), addressGuid));
+    }
+
+    sORWatchdog->AddPlayersScanned(_playerSnapshots.size());
+}
+
+void OnlineRewardMgr::AddPlayerSnapshot(WorldSession* session, Player* player, bool isDue)
+{
+    if (!player || !player->IsInWorld())
+        return;
+
+    Seconds playedTimeSec{ player->GetTotalPlayedTime() };
+    if (playedTimeSec == 0s)
+        return;
+
+    // History is not loaded yet, without it claimed rewards would be given again
+    auto history = _rewardHistory.find(player->GetGUID().GetCounter());
+    if (history == _rewardHistory.end())
+        return;
+
+    auto& snapshot = _playerSnapshots.emplace_back();
+    snapshot.LowGuid = history->first;
+    snapshot.Level = player->GetLevel();
+    snapshot.Security = static_cast<uint8>(session->GetSecurity());
+    snapshot.ClassMask = player->getClassMask();
+    snapshot.RaceMask = player->getRaceMask();
+    snapshot.ZoneId = player->GetZoneId();
+    snapshot.MapId = player->GetMapId();
+    snapshot.PlayedTime = playedTimeSec;
+    snapshot.IsAfk = player->isAFK();
+    snapshot.IsDue = isDue;
+    snapshot.RemoteAddress = session->GetRemoteAddress();
+    snapshot.History = &history->second;
+}
+
+void OnlineRewardMgr::SetRewardDue(ObjectGuid::LowType lowGuid, TimePoint due)
+{
+    // Earlier due is kept, the check after it sets the next one
+    auto [itr, isNew] = _rewardDue.try_emplace(lowGuid, due);
+    if (!isNew)
+    {
+        if (itr->second <= due)
+            return;
+
+        itr->second = due;
+    }
+
+    _rewardDueQueue.emplace(due, lowGuid);
+}
+
+void OnlineRewardMgr::UpdateRewardDue()
+{
+    if (!_isDueCheckEnable)
+        return;
+
+    auto const now{ std::chrono::steady_clock::now() };
+
+    // History has the played time of this check now, so the time to next reward is exact.
+    // Reached rewards which failed conditions wait for an event or the full pass.
+    // One more second, per time reward is given only after its time is passed
+    for (auto const& snapshot : _playerSnapshots)
+    {
+        if (!snapshot.IsDue)
+            continue;
+
+        // Played time of synthetic players runs faster
+        if (IsSoakPlayer(snapshot.LowGuid))
+            SetRewardDue(snapshot.LowGuid, now + GetSoakRealTime(GetSecondsToNextReward(snapshot.PlayedTime) + 1s));
+        else
+            SetRewardDue(snapshot.LowGuid, now + GetSecondsToNextReward(snapshot.PlayedTime) + 1s);
+    }
+}
+
+void OnlineRewardMgr::AddRewardDueEvent(ObjectGuid::LowType lowGuid, std::optional<bool> wasAfk /*= {}*/)
+{
+    if (!_isEnable || !_isDueCheckEnable)
+        return;
+
+    std::lock_guard<std::mutex> guard(_rewardDueEventsLock);
+    _rewardDueEvents.emplace_back(RewardDueEvent{ lowGuid, wasAfk });
+}
+
+void OnlineRewardMgr::CheckAfkChange(Player* player)
+{
+    // Afk players lose only per time rewards
+    if (!_isEnable || !_isDueCheckEnable || !_skipAfkPlayers || !_isPerTimeEnable)
+        return;
+
+    // Value is changed only by the map thread updating the player
+    auto wasAfk = Acore::Containers::MapGetValuePtr(_playerAfk, player->GetGUID().GetCounter());
+    bool const isAfk{ player->isAFK() };
+
+    if (!wasAfk || *wasAfk == isAfk)
+        return;
+
+    *wasAfk = isAfk;
+    AddRewardDueEvent(player->GetGUID().GetCounter(), !isAfk);
+}
+
+void OnlineRewardMgr::AddPlayerAddress(ObjectGuid::LowType lowGuid, std::string const& address)
+{
+    _addressPlayers[address].emplace_back(lowGuid);
+}
+
+void OnlineRewardMgr::DeletePlayerAddress(ObjectGuid::LowType lowGuid, std::string const& address)
+{
+    auto itr = _addressPlayers.find(address);
+    if (itr == _addressPlayers.end())
+        return;
+
+    std::erase(itr->second, lowGuid);
+
+    if (itr->second.empty())
+        _addressPlayers.erase(itr);
+}
+
+void OnlineRewardMgr::CheckPlayersForReward()
+{
+    OnlineRewardTraceSpan traceSpan("CheckPlayersForReward");
+    OnlineRewardWatchdogPhase watchdogPhase("CheckPlayersForReward");
+
+    // Workers only touch their own snapshots and the history vectors behind them,
+    // `_rewardHistory` itself is not modified until all partitions are done
+    // Due checks have a few players, they are not worth a thread
+    std::size_t const partitionsCount = std::clamp<std::size_t>(_playerSnapshots.size() / ELIGIBILITY_MIN_PARTITION_SIZE, 1, _eligibilityThreads);
+    std::size_t const partitionSize = (_playerSnapshots.size() + partitionsCount - 1) / partitionsCount;
+
+    // Every partition allocates from own arena, arenas are not thread safe
+    while (_partitionArenas.size() < partitionsCount)
+        _partitionArenas.emplace_back(std::make_unique<OnlineRewardArena>())->SetEnabled(_isTickArenaEnable);
+
+    _rewardPending.clear();
+    _rewardSkips.clear();
+
+    bool const isTelemetryEnable{ sORTelemetry->IsEnabled() };
+
+    for (std::size_t i = 0; i < partitionsCount; ++i)
+    {
+        _rewardPending.emplace_back(_partitionArenas[i]->GetResource());
+
+        if (isTelemetryEnable)
+            _rewardSkips.emplace_back(_partitionArenas[i]->GetResource());
+    }
+
+    // Every partition keeps own slowest players, merged after all partitions are done
+    std::size_t const slowPlayersCount{ sORWatchdog->IsEnabled() ? sORWatchdog->GetTopCount() : 0 };
+    std::vector<std::vector<OnlineRewardSlowPlayer>> slowPlayers(slowPlayersCount ? partitionsCount : 0);
+
+    auto CheckPartition = [this, partitionSize, slowPlayersCount, &slowPlayers](std::size_t index, RewardPendingStore& store)
+    {
+        auto begin = _playerSnapshots.begin() + std::min(index * partitionSize, _playerSnapshots.size());
+        auto end = _playerSnapshots.begin() + std::min((index + 1) * partitionSize, _playerSnapshots.size());
+
+        OnlineRewardTraceSpan partitionSpan("CheckPartition");
+
+        for (auto itr = begin; itr != end; ++itr)
+        {
+            if (!itr->IsDue)
+                continue;
+
+            OnlineRewardTraceSpan playerSpan("CheckPlayerForReward", "player");
+            TimePoint const playerStart{ slowPlayersCount ? std::chrono::steady_clock::now() : TimePoint{} };
+
+            RewardPending pending{ store.get_allocator() };
+            CheckPlayerForReward(*itr, pending, _rewardSkips.empty() ? nullptr : &_rewardSkips[index]);
+
+            if (slowPlayersCount)
+                OnlineRewardWatchdog::AddSlowPlayer(slowPlayers[index], { itr->LowGuid,
+                    std::chrono::duration_cast<Microseconds>(std::chrono::steady_clock::now() - playerStart) }, slowPlayersCount);
+
+            if (!pending.empty())
+                store.emplace_back(itr->LowGuid, std::move(pending));
+        }
+    };
+
+    // World thread takes the first partition itself
+    _eligibilityPool.Run(partitionsCount, [this, &CheckPartition](std::size_t index)
+    {
+        CheckPartition(index, _rewardPending[index]);
+    });
+
+    for (auto const& partitionSlowPlayers : slowPlayers)
+        sORWatchdog->AddSlowPlayers(partitionSlowPlayers);
+
+    for (auto const& skips : _rewardSkips)
+        for (auto const& [rewardId, reason] : skips)
+            sORTelemetry->AddSkip(rewardId, reason);
+}
+
+void OnlineRewardMgr::ResetTickContainers()
+{
+    // Sizes of the last tick, containers are empty between ticks
+    std::size_t ipCacheMemory{ GetHashMapMemory(_ipCache) };
+    for (auto const& [ip, snapshots] : _ipCache)
+        ipCacheMemory += GetVectorMemory(snapshots);
+
+    std::size_t pendingCount{};
+    std::size_t pendingMemory{ GetVectorMemory(_rewardPending) };
+    for (auto const& store : _rewardPending)
+    {
+        pendingMemory += GetVectorMemory(store);
+        for (auto const& [lowGuid, pending] : store)
+        {
+            pendingCount += pending.size();
+            pendingMemory += GetVectorMemory(pending);
+        }
+    }
+
+    sORMetrics->SetContainerStats(MetricContainer::PlayerSnapshots, _playerSnapshots.size(), 0, GetVectorMemory(_playerSnapshots));
+    sORMetrics->SetContainerStats(MetricContainer::IpCache, _ipCache.size(), _ipCache.bucket_count(), ipCacheMemory);
+    sORMetrics->SetContainerStats(MetricContainer::RewardPending, pendingCount, 0, pendingMemory);
+
+    // Containers must not keep memory of arenas after reset
+    _ipCache = decltype(_ipCache){ _tickArena.GetResource() };
+    _playerSnapshots = decltype(_playerSnapshots){ _tickArena.GetResource() };
+    _rewardPending.clear();
+    _rewardSkips.clear();
+
+    _tickArena.Reset();
+
+    uint64 allocations{ _tickArena.GetLastAllocations() };
+    std::size_t capacity{ _tickArena.GetCapacity() };
+
+    for (auto& arena : _partitionArenas)
+    {
+        arena->Reset();
+        allocations += arena->GetLastAllocations();
+        capacity += arena->GetCapacity();
+    }
+
+    sORMetrics->SetArenaStats(MetricArena::RewardTick, allocations, capacity);
+}
+
+void OnlineRewardMgr::UpdateMemoryStats()
+{
+    std::size_t rewardsMemory{ GetHashMapMemory(_rewards) + GetVectorMemory(_onceRewards) + GetVectorMemory(_onceRewardIds) +
+        GetVectorMemory(_onceRewardTimes) + GetVectorMemory(_perTimeRewards) + GetVectorMemory(_rewardsByTime) };
+
+    for (auto const& [id, onlineReward] : _rewards)
+        rewardsMemory += GetVectorMemory(onlineReward.Items) + GetVectorMemory(onlineReward.Reputations) +
+            GetVectorMemory(onlineReward.Conditions.Zones) + GetVectorMemory(onlineReward.Conditions.Maps);
+
+    for (auto index : { &_rewardsByItem, &_rewardsByFaction })
+    {
+        rewardsMemory += GetHashMapMemory(*index);
+        for (auto const& [id, rewards] : *index)
+            rewardsMemory += GetVectorMemory(rewards);
+    }
+
+    sORMetrics->SetContainerStats(MetricContainer::Rewards, _rewards.size(), _rewards.bucket_count(), rewardsMemory);
+
+    // History left after logout is a leak, `OnLogout` was not called or loading finished after it
+    std::size_t historyMemory{ GetHashMapMemory(_rewardHistory) };
+    std::size_t historyWithoutPlayer{};
+
+    for (auto const& [lowGuid, history] : _rewardHistory)
+    {
+        historyMemory += GetVectorMemory(history.PerTime) + history.Claimed.GetMemoryUsage();
+
+        if (!ObjectAccessor::FindPlayerByLowGUID(lowGuid) && !IsSoakPlayer(lowGuid))
+            ++historyWithoutPlayer;
+    }
+
+    if (historyWithoutPlayer > _historyWithoutPlayer)
+        LOG_WARN("module.or", "> OR: Found {} history entries without online player, logout of player was missed", historyWithoutPlayer);
+
+    _historyWithoutPlayer = historyWithoutPlayer;
+
+    sORMetrics->SetContainerStats(MetricContainer::RewardHistory, _rewardHistory.size(), _rewardHistory.bucket_count(), historyMemory);
+    sORMetrics->SetContainerStats(MetricContainer::DormantHistory, _dormantHistory.size(), _dormantHistory.bucket_count(),
+        _dormantHistory.bucket_count() * sizeof(void*) + _dormantMemory);
+    sORMetrics->SetContainerStats(MetricContainer::HistoryQueries, _historyQueries, 0, 0);
+    sORMetrics->SetHistoryWithoutPlayer(historyWithoutPlayer);
+}
+
+void OnlineRewardMgr::SaveRewardHistoryToDB()
+{
+    if (_rewardHistory.empty() && _unsavedDormant.empty())
+        return;
+
+    OnlineRewardTraceSpan traceSpan("SaveRewardHistoryToDB");
+    OnlineRewardWatchdogPhase watchdogPhase("SaveRewardHistoryToDB");
+
+    std::vector<OnlineRewardStoredHistory> histories;
+    std::vector<RewardHistory*> savedHistories;
+
+    histories.reserve(_rewardHistory.size() + _unsavedDormant.size());
+    savedHistories.reserve(_rewardHistory.size() + _unsavedDormant.size());
+
+    auto AddSavedHistory = [this, &histories, &savedHistories](ObjectGuid::LowType lowGuid, RewardHistory& history)
+    {
+        histories.emplace_back(MakeStoredHistory(lowGuid, history));
+        savedHistories.emplace_back(&history);
+    };
+
+    for (auto& [lowGuid, history] : _rewardHistory)
+        AddSavedHistory(lowGuid, history);
+
+    // Player could log in again, then the history is saved above
+    for (auto lowGuid : _unsavedDormant)
+        if (auto itr = _dormantHistory.find(lowGuid); itr != _dormantHistory.end() && itr->second.History.IsSavePending)
+            AddSavedHistory(lowGuid, itr->second.History);
+
+    _unsavedDormant.clear();
+
+    if (histories.empty())
+        return;
+
+    // Snapshot written before this save is outdated after it
+    _storage->SaveHistory(histories, ++_historyGeneration);
+
+    for (auto history : savedHistories)
+    {
+        history->StorageFormat = _storage->GetFormat();
+        history->IsClaimedChanged = false;
+        history->IsSavePending = false;
+    }
+}
+
+Seconds OnlineRewardMgr::GetHistorySecondsForReward(ObjectGuid::LowType lowGuid, uint32 id)
+{
+    if (_rewardHistory.empty())
+        return 0s;
+
+    auto const& itr = _rewardHistory.find(lowGuid);
+    if (itr == _rewardHistory.end())
+        return 0s;
+
+    for (auto const& [rewardID, seconds] : itr->second.PerTime)
+        if (rewardID == id)
+            return seconds;
+
+    return 0s;
+}
+
+bool OnlineRewardMgr::IsClaimedReward(ObjectGuid::LowType lowGuid, OnlineReward const* onlineReward)
+{
+    auto const& itr = _rewardHistory.find(lowGuid);
+    if (itr == _rewardHistory.end())
+        return false;
+
+    return itr->second.Claimed.Test(onlineReward->ClaimIndex);
+}
+
+void OnlineRewardMgr::SendRewardForPlayer(Player* player, RewardGrant const& grant)
+{
+    // All due rewards in one line, same times are counted: "1 hour, 30 minutes x2"
+    std::map<Seconds, uint32> rewardTimes;
+
+    for (auto const& onlineReward : grant.Rewards)
+        ++rewardTimes[onlineReward->RewardTime];
+
+    std::string playedTimeSecStr;
+
+    for (auto const& [rewardTime, count] : rewardTimes)
+    {
+        if (!playedTimeSecStr.empty())
+            playedTimeSecStr.append(", ");
+
+        playedTimeSecStr.append(Acore::Time::ToTimeString(rewardTime, TimeOutput::Seconds, TimeFormat::FullText));
+
+        if (count > 1)
+            playedTimeSecStr.append(Acore::StringFormatFmt(" x{}", count));
+    }
+
+    auto localeIndex{ player->GetSession()->GetSessionDbLocaleIndex() };
+
+    auto SendItemsViaMail = [player, &playedTimeSecStr, &localeIndex](std::map<uint32, uint32> const& items)
+    {
+        std::vector<ExternalMailRequest> requests;
+
+        for (auto& rowItems : SplitMailItems(items))
+        {
+            auto& request = requests.emplace_back();
+            request.PlayerGuid = player->GetGUID().GetCounter();
+            request.PlayerName = player->GetName();
+            request.Subject = Acore::StringFormatFmt(GetLocaleText(OR_LOCALE_SUBJECT, localeIndex), playedTimeSecStr);
+            request.Text = Acore::StringFormatFmt(GetLocaleText(OR_LOCALE_TEXT, localeIndex), player->GetName(), playedTimeSecStr);
+            request.CreatureEntry = 37688;
+            request.Items = std::move(rowItems);
+        }
+
+        // Send External mail, all rows with one insert
+        sExternalMail->AddMails(requests);
+    };
+
+    // Grant is merged, counters are split back per reward. Bags are filled by rewards in grant order
+    auto AddTelemetry = [&grant](std::map<uint32, uint32> const& mailItems, bool isAllMailed)
+    {
+        if (!sORTelemetry->IsEnabled())
+            return;
+
+        std::map<uint32, uint32> baggedItems;
+
+        if (!isAllMailed)
+        {
+            for (auto const& [itemID, itemCount] : grant.Items)
+            {
+                auto itr = mailItems.find(itemID);
+                baggedItems.emplace(itemID, itemCount - (itr != mailItems.end() ? std::min(itr->second, itemCount) : 0));
+            }
+        }
+
+        for (auto const& onlineReward : grant.Rewards)
+        {
+            uint64 reputation{ 0 };
+            for (auto const& [factionEntry, count] : onlineReward->Reputations)
+                reputation += count;
+
+            sORTelemetry->AddGrant(onlineReward->ID, reputation);
+
+            uint64 bagged{ 0 };
+            uint64 mailed{ 0 };
+
+            for (auto const& [itemID, itemCount] : onlineReward->Items)
+            {
+                auto& baggedLeft = baggedItems[itemID];
+                uint32 const itemBagged{ std::min(baggedLeft, itemCount) };
+
+                baggedLeft -= itemBagged;
+                bagged += itemBagged;
+                mailed += itemCount - itemBagged;
+            }
+
+            sORTelemetry->AddItems(onlineReward->ID, bagged, mailed);
+        }
+    };
+
+    if (!grant.Reputations.empty())
+    {
+        ReputationMgr& repMgr = player->GetReputationMgr();
+
+        // Reputation is summed per faction in grant, the client gets the final state only
+        for (auto const& [factionEntry, reputation] : grant.Reputations)
+            repMgr.SetOneFactionReputation(factionEntry, static_cast<float>(reputation), true);
+
+        for (auto const& [factionEntry, reputation] : grant.Reputations)
+            repMgr.SendState(repMgr.GetState(factionEntry));
+    }
+
+    if (_isForceMailReward && !grant.Items.empty())
+    {
+        SendItemsViaMail(grant.Items);
+        AddTelemetry({}, true);
+
+        // Send chat text
+        SendLocalizePlayerMessage(player, GetLocaleText(OR_LOCALE_MESSAGE_MAIL, localeIndex), playedTimeSecStr);
+        return;
+    }
+
+    if (!grant.Items.empty())
+    {
+        // Bags get what fits, only the rest is sent via mail
+        auto const mailItems{ StoreItemsInBags(player, grant.Items) };
+        if (!mailItems.empty())
+        {
+            SendItemsViaMail(mailItems);
+
+            // Send chat text
+            SendLocalizePlayerMessage(player, GetLocaleText(OR_LOCALE_NOT_ENOUGH_BAG, localeIndex));
+        }
+
+        AddTelemetry(mailItems, false);
+    }
+    else
+        AddTelemetry({}, false);
+
+    // Send chat text
+    SendLocalizePlayerMessage(player, GetLocaleText(OR_LOCALE_MESSAGE_IN_GAME, localeIndex), playedTimeSecStr);
+}
+
+void OnlineRewardMgr::SendRewardForSoakPlayer(ObjectGuid::LowType lowGuid, SoakPlayer& soakPlayer, RewardGrant const& grant)
+{
+    _soak->RewardsGranted += grant.Rewards.size();
+
+    if (grant.Items.empty())
+        return;
+
+    // Bags fill up during the session, later grants go to mail more often
+    auto const mailItems{ _isForceMailReward ? grant.Items : GetMailItems(grant.Items, MakeSyntheticBags(soakPlayer.FreeSlots)) };
+
+    if (!_isForceMailReward)
+    {
+        std::map<uint32, uint32> baggedItems;
+
+        for (auto const& [itemID, itemCount] : grant.Items)
+        {
+            auto itr = mailItems.find(itemID);
+            if (uint32 const bagCount{ itemCount - (itr != mailItems.end() ? itr->second : 0) })
+                baggedItems.emplace(itemID, bagCount);
+        }
+
+        soakPlayer.FreeSlots -= std::min(soakPlayer.FreeSlots, GetStacksCount(baggedItems));
+    }
+
+    // Rows of reserved guid are deleted by ExternalMail without a mail, see `IsTestGuid`
+    std::vector<ExternalMailRequest> requests;
+
+    for (auto& rowItems : SplitMailItems(mailItems))
+    {
+        auto& request = requests.emplace_back();
+        request.PlayerGuid = lowGuid;
+        request.Subject = "Soak run";
+        request.CreatureEntry = 37688;
+        request.Items = std::move(rowItems);
+    }
+
+    _soak->MailRowsAdded += sExternalMail->AddMails(requests);
+}
+
+std::map<uint32, uint32> OnlineRewardMgr::GetAllRewardItems() const
+{
+    std::map<uint32, uint32> items;
+
+    for (auto const& [id, onlineReward] : _rewards)
+        for (auto const& [itemID, itemCount] : onlineReward.Items)
+            items[itemID] += itemCount;
+
+    return items;
+}
+
+void OnlineRewardMgr::CheckItemDelivery(Player* player, ChatHandler* handler) const
+{
+    auto const items{ GetAllRewardItems() };
+
+    handler->SendSysMessage(Acore::StringFormatFmt("> Item delivery of {} rewards as one grant to {}, nothing is given:", _rewards.size(), player->GetName()));
+
+    std::map<uint32, uint32> mailItems;
+
+    for (auto const& [itemID, itemCount] : items)
+    {
+        ItemPosCountVec dest;
+        uint32 const bagCount{ GetBagCount(player, itemID, itemCount, dest) };
+
+        if (bagCount < itemCount)
+            mailItems.emplace(itemID, itemCount - bagCount);
+
+        handler->SendSysMessage(Acore::StringFormatFmt("-- {}: count {}, bags {}, mail {}", itemID, itemCount, bagCount, itemCount - bagCount));
+    }
+
+    // Same check as at send of `mail_external` row
+    auto const rows{ SplitMailItems(mailItems) };
+    std::size_t rejectedRows{ 0 };
+
+    for (auto const& rowItems : rows)
+    {
+        ExMail mail;
+
+        for (auto const& [itemID, itemCount] : rowItems)
+        {
+            if (!mail.AddItems(itemID, itemCount))
+            {
+                ++rejectedRows;
+                break;
+            }
+        }
+    }
+
+    handler->SendSysMessage(Acore::StringFormatFmt("> Mail rows {}, rejected at send {}", rows.size(), rejectedRows));
+}
+
+std::vector<std::string> OnlineRewardMgr::CheckItemDeliveryPlan(std::map<uint32, uint32> const& items, uint32 freeSlots) const
+{
+    std::vector<std::string> errors;
+
+    // Same steps as `SendRewards`, bags are synthetic
+    auto const mailItems{ GetMailItems(items, MakeSyntheticBags(freeSlots)) };
+    auto const rows{ SplitMailItems(mailItems) };
+
+    std::map<uint32, uint64> mailed;
+    std::size_t rejectedRows{ 0 };
+
+    for (std::size_t row = 0; row < rows.size(); ++row)
+    {
+        ExMail mail;
+        std::string itemsList;
+        bool isRejected{};
+
+        for (auto const& [itemID, itemCount] : rows[row])
+        {
+            if (!itemsList.empty())
+                itemsList.append(",");
+
+            itemsList.append(Acore::StringFormatFmt("{}:{}", itemID, itemCount));
+
+            if (std::count_if(rows[row].begin(), rows[row].end(), [itemID](auto const& entry) { return entry.first == itemID; }) > 1)
+                errors.emplace_back(Acore::StringFormatFmt("item {} is twice in row {}", itemID, row));
+
+            mailed[itemID] += itemCount;
+            isRejected = isRejected || !mail.AddItems(itemID, itemCount);
+        }
+
+        if (isRejected)
+            ++rejectedRows;
+
+        if (itemsList.size() > MAIL_EXTERNAL_ITEMS_MAX_LENGTH)
+            errors.emplace_back(Acore::StringFormatFmt("row {} has {} chars of items", row, itemsList.size()));
+
+        if (mail.PackMails() && mail.OverCountItems.size() > 1)
+            errors.emplace_back(Acore::StringFormatFmt("row {} is {} mails", row, mail.OverCountItems.size()));
+    }
+
+    if (rejectedRows)
+        errors.emplace_back(Acore::StringFormatFmt("{} of {} rows are rejected at send", rejectedRows, rows.size()));
+
+    for (auto const& [itemID, itemCount] : items)
+    {
+        auto const mailCount{ Acore::Containers::MapGetValuePtr(mailItems, itemID) };
+        uint32 const bagCount{ itemCount - (mailCount ? *mailCount : 0) };
+        uint64 const mailedCount{ mailed.contains(itemID) ? mailed.at(itemID) : 0 };
+
+        if (!freeSlots && bagCount)
+            errors.emplace_back(Acore::StringFormatFmt("item {}: {} in full bags", itemID, bagCount));
+
+        // Every unit goes to bags or to one mail row
+        if (mailedCount != itemCount - bagCount)
+            errors.emplace_back(Acore::StringFormatFmt("item {}: count {}, bags {}, mailed {}", itemID, itemCount, bagCount, mailedCount));
+    }
+
+    return errors;
+}
+
+uint32 OnlineRewardMgr::RunItemDeliveryChecks(ChatHandler* handler /*= nullptr*/) const
+{
+    auto const items{ GetAllRewardItems() };
+
+    // Big grant of many ticks, counts go over stack sizes and `MaxCount`
+    std::map<uint32, uint32> bigItems;
+    for (auto const& [itemID, itemCount] : items)
+        bigItems.emplace(itemID, itemCount * 100);
+
+    struct DeliveryCheck
+    {
+        std::string_view Name;
+        std::map<uint32, uint32> const& Items;
+        uint32 FreeSlots{};
+    };
+
+    std::array<DeliveryCheck, 4> const checks
+    {{
+        { "full bags",                  items,      0 },
+        { "partly full bags",           items,      std::max<uint32>(1, GetStacksCount(items) / 2) },
+        { "full bags, big grant",       bigItems,   0 },
+        { "partly full bags, big grant", bigItems,  std::max<uint32>(1, GetStacksCount(bigItems) / 2) },
+    }};
+
+    uint32 failed{ 0 };
+
+    for (auto const& check : checks)
+    {
+        auto const errors{ CheckItemDeliveryPlan(check.Items, check.FreeSlots) };
+        if (!errors.empty())
+            ++failed;
+
+        LOG_INFO("module.or", "> OR: Item delivery check, {} items, {} ({} free slots): {}", check.Items.size(), check.Name, check.FreeSlots, errors.empty() ? "OK" : "FAILED");
+
+        if (handler)
+            handler->SendSysMessage(Acore::StringFormatFmt("> {} items, {} ({} free slots): {}", check.Items.size(), check.Name, check.FreeSlots, errors.empty() ? "OK" : "FAILED"));
+
+        for (auto const& error : errors)
+        {
+            LOG_ERROR("module.or", "> OR: Item delivery check, {}: {}", check.Name, error);
+
+            if (handler)
+                handler->SendSysMessage(Acore::StringFormatFmt("-- {}", error));
+        }
+    }
+
+    return failed;
+}
+
+bool OnlineRewardMgr::BenchmarkHistoryFormats(uint32 players, Seconds maxPlayed, ChatHandler* handler)
+{
+    auto storage = dynamic_cast<OnlineRewardMySQLStorage*>(_storage.get());
+
+    if (!storage)
+    {
+        handler->SendSysMessage("> History benchmark needs `OR.Storage.Backend = \"mysql\"`");
+        return false;
+    }
+
+    // Maintenance would archive benchmark players, they have no characters
+    if (sORMaintenance->IsRunning())
+    {
+        handler->SendSysMessage("> History benchmark can't run with maintenance");
+        return false;
+    }
+
+    // Handler can be gone at the end, results are only logged
+    if (!players || players > BENCH_MAX_PLAYERS)
+    {
+        handler->SendSysMessage(Acore::StringFormatFmt("> Count of players must be 1..{}", BENCH_MAX_PLAYERS));
+        return false;
+    }
+
+    bool const isStarted = storage->BenchmarkFormats(players, maxPlayed, _historyLoadMaxQueries, [players](std::vector<OnlineRewardFormatBench> results)
+    {
+        if (results.empty())
+            return;
+
+        for (auto const& result : results)
+            LOG_INFO("module.or", "> OR: History benchmark of {} players, {} format: build {} us, save {} ms, load {} ms, statements {}, rows {}, bytes {}",
+                players, result.Format ? "packed" : "rows", result.BuildTime.count(), result.SaveTime.count(), result.LoadTime.count(),
+                result.Statements, result.Rows, result.Bytes);
+    });
+
+    if (!isStarted)
+    {
+        handler->SendSysMessage("> History benchmark is running");
+        return false;
+    }
+
+    handler->SendSysMessage(Acore::StringFormatFmt("> History benchmark started with {} players, results are in log `module.or`", players));
+    return true;
+}
+
+void OnlineRewardMgr::AddHistory(RewardHistory& history, uint32 rewardId, Seconds playerOnlineTime)
+{
+    for (auto& [rewardID, seconds] : history.PerTime)
+    {
+        if (rewardID == rewardId)
+        {
+            seconds = playerOnlineTime;
+            return;
+        }
+    }
+
+    history.PerTime.emplace_back(rewardId, playerOnlineTime);
+}
+
+bool OnlineRewardMgr::IsExistHistory(ObjectGuid::LowType lowGuid)
+{
+    return _rewardHistory.contains(lowGuid);
+}
+
+void OnlineRewardMgr::AddRewardHistoryAsync(ObjectGuid::LowType lowGuid, RewardHistory&& rewardHistory)
+{
+    std::lock_guard<std::mutex> guard(_playerLoadingLock);
+    FinishHistoryLoad(lowGuid);
+
+    if (_rewardHistory.contains(lowGuid))
+    {
+        LOG_FATAL("module.or", "> OR: Time to ping @Winfidonarleyan. Code 2");
+        _rewardHistory.erase(lowGuid);
+    }
+
+    _rewardHistory.emplace(lowGuid, std::move(rewardHistory));
+    LOG_DEBUG("module.or", "> OR: Added history for player with guid {}", lowGuid);
+
+    // Rewards reached while history was loading are not delayed until the full pass
+    if (_isDueCheckEnable)
+        SetRewardDue(lowGuid, std::chrono::steady_clock::now());
+}
+
+OnlineRewardSkipReason OnlineRewardMgr::GetSkipReason(PlayerSnapshot const& snapshot, OnlineReward const* onlineReward) const
+{
+    if (!onlineReward->IsPerOnline && !snapshot.IsNormalIp)
+        return OnlineRewardSkipReason::Ip;
+
+    if (_skipAfkPlayers && snapshot.IsAfk && !onlineReward->IsPerOnline)
+        return OnlineRewardSkipReason::Afk;
+
+    auto const& conditions{ onlineReward->Conditions };
+
+    // "Any" values are compiled to full masks and ranges, see OnlineRewardConditions::Compile
+    if (snapshot.Level < conditions.MinLevel || snapshot.Level > conditions.MaxLevel)
+        return OnlineRewardSkipReason::Level;
+
+    if (snapshot.Security < conditions.MinSecurity)
+        return OnlineRewardSkipReason::Other;
+
+    if (!(snapshot.ClassMask & conditions.ClassMask) || !(snapshot.RaceMask & conditions.RaceMask) || !(_dayOfWeekMask & conditions.DayOfWeekMask))
+        return OnlineRewardSkipReason::Other;
+
+    if (!conditions.Zones.empty() && !std::binary_search(conditions.Zones.begin(), conditions.Zones.end(), snapshot.ZoneId))
+        return OnlineRewardSkipReason::Other;
+
+    if (!conditions.Maps.empty() && !std::binary_search(conditions.Maps.begin(), conditions.Maps.end(), snapshot.MapId))
+        return OnlineRewardSkipReason::Other;
+
+    return OnlineRewardSkipReason::None;
+}
+
+bool OnlineRewardMgr::CanReceiveReward(PlayerSnapshot const& snapshot, OnlineReward const* onlineReward) const
+{
+    return GetSkipReason(snapshot, onlineReward) == OnlineRewardSkipReason::None;
+}
+
+void OnlineRewardMgr::CheckPlayerForReward(PlayerSnapshot& snapshot, RewardPending& pending, RewardSkipStore* skips) const
+{
+    if (!snapshot.History || snapshot.PlayedTime == 0s)
+        return;
+
+    auto& history{ *snapshot.History };
+
+    if (_isPerOnlineEnable)
+    {
+        // One-shot rewards are sorted by time, all reached ones are a prefix of claim indexes
+        std::size_t const reachedCount = std::upper_bound(_onceRewardTimes.begin(), _onceRewardTimes.end(), snapshot.PlayedTime) - _onceRewardTimes.begin();
+
+        history.Claimed.ForEachUnclaimed(reachedCount, [this, &snapshot, &history, &pending](std::size_t index)
+        {
+            auto onlineReward = _onceRewards[index];
+            if (!CanReceiveReward(snapshot, onlineReward))
+                return;
+
+            pending.emplace_back(onlineReward->ID);
+            history.Claimed.Set(index);
+            history.IsClaimedChanged = true;
+        });
+    }
+
+    if (!_isPerTimeEnable)
+        return;
+
+    for (auto onlineReward : _perTimeRewards)
+    {
+        Seconds rewardedSeconds{ 0s };
+
+        for (auto const& [rewardID, seconds] : history.PerTime)
+        {
+            if (rewardID == onlineReward->ID)
+            {
+                rewardedSeconds = seconds;
+                break;
+            }
+        }
+
+        // Conditions are the same for all periods of this tick, they are checked once
+        std::optional<OnlineRewardSkipReason> skipReason;
+
+        for (Seconds diffTime{ onlineReward->RewardTime }; diffTime < snapshot.PlayedTime; diffTime += onlineReward->RewardTime)
+        {
+            if (rewardedSeconds >= diffTime)
+                continue;
+
+            if (!skipReason)
+                skipReason = GetSkipReason(snapshot, onlineReward);
+
+            if (*skipReason == OnlineRewardSkipReason::None)
+                pending.emplace_back(onlineReward->ID);
+            else if (skips)
+                skips->emplace_back(onlineReward->ID, *skipReason); // Period is lost, history is moved past it below
+        }
+
+        AddHistory(history, onlineReward->ID, snapshot.PlayedTime);
+    }
+}
 
 void OnlineRewardMgr::GetNextTimeForReward(Player* player, Seconds playedTime, OnlineReward const* onlineReward)
 {
@@ -663,7 +1913,7 @@ void OnlineRewardMgr::GetNextTimeForReward(Player* player, Seconds playedTime, O
 
     if (onlineReward->IsPerOnline && _isPerOnlineEnable)
     {
-        if (rewardedSeconds != 0s)
+        if (IsClaimedReward(lowGuid, onlineReward))
             return;
 
         PrintReward(onlineReward->RewardTime - playedTime);
@@ -687,21 +1937,52 @@ void OnlineRewardMgr::SendRewards()
     if (_rewardPending.empty())
         return;
 
-    for (auto const& [lowGuid, rewards] : _rewardPending)
+    OnlineRewardTraceSpan traceSpan("SendRewards");
+    OnlineRewardWatchdogPhase watchdogPhase("SendRewards");
+
+    for (auto const& store : _rewardPending)
     {
-        auto player = ObjectAccessor::FindPlayerByLowGUID(lowGuid);
-        if (!player)
+        for (auto const& [lowGuid, rewards] : store)
         {
-            LOG_FATAL("module.or", "> OR::RewardPlayers: Try reward non existing player (maybe offline) with guid {}. Skip reward, try next time", lowGuid);
-            DeleteRewardHistory(lowGuid);
-            continue;
-        }
+            auto player = ObjectAccessor::FindPlayerByLowGUID(lowGuid);
+            auto soakPlayer = !player && _soak ? Acore::Containers::MapGetValuePtr(_soak->Online, lowGuid) : nullptr;
 
-        for (auto const& rewardID : rewards)
-            SendRewardForPlayer(player, rewardID);
-    }
+            if (!player && !soakPlayer)
+            {
+                LOG_FATAL("module.or", "> OR::RewardPlayers: Try reward non existing player (maybe offline) with guid {}. Skip reward, try next time", lowGuid);
+                DeleteRewardHistory(lowGuid);
+                continue;
+            }
 
-    _rewardPending.clear();
+            // Merge all due rewards, player get one grant per tick
+            RewardGrant grant;
+
+            for (auto const& rewardID : rewards)
+            {
+                auto onlineReward = GetOnlineReward(rewardID);
+                if (!onlineReward)
+                    continue;
+
+                grant.Rewards.emplace_back(onlineReward);
+
+                for (auto const& [itemID, itemCount] : onlineReward->Items)
+                    grant.Items[itemID] += itemCount;
+
+                for (auto const& [factionEntry, reputation] : onlineReward->Reputations)
+                    grant.Reputations[factionEntry] += reputation;
+            }
+
+            if (grant.Rewards.empty())
+                continue;
+
+            sORWatchdog->AddRewardsGranted(grant.Rewards.size());
+
+            if (soakPlayer)
+                SendRewardForSoakPlayer(lowGuid, *soakPlayer, grant);
+            else
+                SendRewardForPlayer(player, grant);
+        }
+    }
 }
 
 bool OnlineRewardMgr::IsExistReward(uint32 id)
@@ -715,65 +1996,192 @@ bool OnlineRewardMgr::DeleteReward(uint32 id)
     if (!erased)
         return false;
 
-    CharacterDatabase.Execute("DELETE FROM `wh_online_rewards` WHERE `ID` = {}", id);
+    _storage->DeleteReward(id);
+    RebuildRewardIndex();
+
+    // Rows in DB are removed by maintenance job, online players must not write them again
+    ForEachHistory([id](ObjectGuid::LowType /*lowGuid*/, RewardHistory& history)
+    {
+        std::erase_if(history.PerTime, [id](RewardHistoryStruct const& historyStruct) { return historyStruct.first == id; });
+    });
+
     return true;
 }
 
-OnlineReward const* OnlineRewardMgr::GetOnlineReward(uint32 id)
+void OnlineRewardMgr::RebuildRewardIndex()
 {
-    return Acore::Containers::MapGetValuePtr(_rewards, id);
+    auto oldOnceRewardIds{ std::move(_onceRewardIds) };
+
+    _onceRewards.clear();
+    _onceRewardIds.clear();
+    _onceRewardTimes.clear();
+    _perTimeRewards.clear();
+    _rewardsByTime.clear();
+    _rewardsByItem.clear();
+    _rewardsByFaction.clear();
+
+    for (auto const& [id, onlineReward] : _rewards)
+        _rewardsByTime.emplace_back(&onlineReward);
+
+    std::sort(_rewardsByTime.begin(), _rewardsByTime.end(), [](OnlineReward const* reward1, OnlineReward const* reward2)
+    {
+        return std::tie(reward1->RewardTime, reward1->ID) < std::tie(reward2->RewardTime, reward2->ID);
+    });
+
+    // All lists are filled in time order, so they stay sorted
+    for (auto onlineReward : _rewardsByTime)
+    {
+        if (onlineReward->IsPerOnline)
+            _onceRewards.emplace_back(onlineReward);
+        else
+            _perTimeRewards.emplace_back(onlineReward);
+
+        for (auto const& [itemID, itemCount] : onlineReward->Items)
+        {
+            auto& rewards{ _rewardsByItem[itemID] };
+            if (rewards.empty() || rewards.back() != onlineReward)
+                rewards.emplace_back(onlineReward);
+        }
+
+        for (auto const& [factionEntry, reputation] : onlineReward->Reputations)
+        {
+            auto& rewards{ _rewardsByFaction[factionEntry->ID] };
+            if (rewards.empty() || rewards.back() != onlineReward)
+                rewards.emplace_back(onlineReward);
+        }
+    }
+
+    for (std::size_t i = 0; i < _onceRewards.size(); ++i)
+    {
+        _rewards.at(_onceRewards[i]->ID).ClaimIndex = i;
+        _onceRewardIds.emplace_back(_onceRewards[i]->ID);
+        _onceRewardTimes.emplace_back(_onceRewards[i]->RewardTime);
+    }
+
+    if (oldOnceRewardIds == _onceRewardIds)
+        return;
+
+    // Claim indexes are changed, move claims of loaded players to new indexes
+    ForEachHistory([this, &oldOnceRewardIds](ObjectGuid::LowType /*lowGuid*/, RewardHistory& history)
+    {
+        OnlineRewardClaimMask claimed;
+
+        history.Claimed.ForEachClaimed([this, &oldOnceRewardIds, &claimed](std::size_t index)
+        {
+            if (index >= oldOnceRewardIds.size())
+                return;
+
+            auto onlineReward = GetOnlineReward(oldOnceRewardIds[index]);
+            if (onlineReward && onlineReward->IsPerOnline)
+                claimed.Set(onlineReward->ClaimIndex);
+        });
+
+        history.Claimed = std::move(claimed);
+    });
 }
 
-void OnlineRewardMgr::MakeIpCache()
+std::size_t OnlineRewardMgr::GetRewardsPage(OnlineRewardListFilter const& filter, std::size_t page, std::size_t pageSize, std::vector<OnlineReward const*>& result) const
 {
-    if (!_ipCache.empty())
-        _ipCache.clear();
+    static std::vector<OnlineReward const*> const emptyList;
 
-    auto const& sessions = sWorld->GetAllSessions();
-    if (sessions.empty())
-        return;
+    // Start from the smallest index, the rest of filter is checked for its rewards only
+    auto GetIndexList = [](auto const& index, uint32 key) -> std::vector<OnlineReward const*> const&
+    {
+        auto itr = index.find(key);
+        return itr != index.end() ? itr->second : emptyList;
+    };
+
+    auto const& rewards{ filter.ItemID ? GetIndexList(_rewardsByItem, *filter.ItemID) :
+        filter.FactionID ? GetIndexList(_rewardsByFaction, *filter.FactionID) : _rewardsByTime };
 
-    for (auto const& [accId, session] : sessions)
+    std::size_t const first{ page * pageSize };
+    std::size_t count{ 0 };
+
+    for (auto onlineReward : rewards)
     {
-        auto player{ session->GetPlayer() };
-        if (!player || !player->IsInWorld())
+        if (filter.IsPerOnline && onlineReward->IsPerOnline != *filter.IsPerOnline)
             continue;
 
-        auto ip{ session->GetRemoteAddress() };
+        if (onlineReward->Conditions.MinLevel > filter.MaxLevel || onlineReward->Conditions.MaxLevel < filter.MinLevel)
+            continue;
 
-        auto itr = _ipCache.find(ip);
-        if (itr == _ipCache.end())
-        {
-            _ipCache.emplace(ip, std::vector<Player*>{ player });
+        if (filter.ItemID && filter.FactionID && std::none_of(onlineReward->Reputations.begin(), onlineReward->Reputations.end(),
+            [&filter](OnlineReward::ReputationsPair const& reputation) { return reputation.first->ID == *filter.FactionID; }))
             continue;
-        }
 
-        itr->second.emplace_back(player);
+        if (count >= first && count < first + pageSize)
+            result.emplace_back(onlineReward);
+
+        ++count;
     }
 
-    for (auto& [ip, players] : _ipCache)
+    return count;
+}
+
+std::vector<uint8> OnlineRewardMgr::PackClaims(OnlineRewardClaimMask const& claimed) const
+{
+    // Stored by reward id, claim indexes are not stable between catalog changes
+    std::vector<uint8> packed;
+
+    claimed.ForEachClaimed([this, &packed](std::size_t index)
     {
-        if (players.size() == 1)
-            continue;
+        auto id{ _onceRewardIds[index] };
+
+        if (id / 8 >= packed.size())
+            packed.resize(id / 8 + 1);
+
+        packed[id / 8] |= uint8(1) << (id % 8);
+    });
+
+    return packed;
+}
 
-        std::sort(players.begin(), players.end(), [](Player* player1, Player* player2)
+void OnlineRewardMgr::UnpackClaims(std::vector<uint8> const& packed, OnlineRewardClaimMask& claimed) const
+{
+    for (std::size_t byte = 0; byte < packed.size(); ++byte)
+    {
+        for (uint8 bit = 0; bit < 8; ++bit)
         {
-            return player1->GetTotalPlayedTime() > player2->GetTotalPlayedTime();
-        });
+            if (!(packed[byte] & (uint8(1) << bit)))
+                continue;
 
-        players.resize(_maxSameIpCount);
+            auto onlineReward = Acore::Containers::MapGetValuePtr(_rewards, static_cast<uint32>(byte * 8 + bit));
+            if (onlineReward && onlineReward->IsPerOnline)
+                claimed.Set(onlineReward->ClaimIndex);
+        }
     }
 }
 
-bool OnlineRewardMgr::IsNormalIpPlayer(Player* player)
+OnlineReward const* OnlineRewardMgr::GetOnlineReward(uint32 id)
+{
+    return Acore::Containers::MapGetValuePtr(_rewards, id);
+}
+
+void OnlineRewardMgr::MakeIpCache()
 {
-    auto ip{ player->GetSession()->GetRemoteAddress() };
+    OnlineRewardTraceSpan traceSpan("MakeIpCache");
+    OnlineRewardWatchdogPhase watchdogPhase("MakeIpCache");
 
-    auto itr = _ipCache.find(ip);
-    if (itr == _ipCache.end())
-        return false;
+    if (!_ipCache.empty())
+        _ipCache.clear();
+
+    for (auto& snapshot : _playerSnapshots)
+        _ipCache[snapshot.RemoteAddress].emplace_back(&snapshot);
+
+    for (auto& [ip, players] : _ipCache)
+    {
+        if (players.size() > 1)
+        {
+            std::sort(players.begin(), players.end(), [](PlayerSnapshot const* player1, PlayerSnapshot const* player2)
+            {
+                return player1->PlayedTime > player2->PlayedTime;
+            });
+        }
+
+        for (std::size_t i = 0; i < players.size() && i < _maxSameIpCount; ++i)
+            players[i]->IsNormalIp = true;
 
-    auto& players{ itr->second };
-    auto exist = std::find(players.begin(), players.end(), player);
-    return exist != players.end();
-}
\ No newline at end of file
+        if (players.size() > 1)
+            sORWatchdog->AddIpGroup(ip, players.size());
+    }
+}
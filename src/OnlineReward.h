@@ -18,36 +18,150 @@
 #ifndef _WARHEAD_ONLINE_REWARD_H_
 #define _WARHEAD_ONLINE_REWARD_H_
 
-#include "AsyncCallbackProcessor.h"
-#include "DatabaseEnvFwd.h"
 #include "Define.h"
 #include "Duration.h"
 #include "ObjectGuid.h"
+#include "OnlineRewardArena.h"
+#include "OnlineRewardStorage.h"
+#include "OnlineRewardTelemetry.h"
+#include "OnlineRewardWorkerPool.h"
 #include "TaskScheduler.h"
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <map>
+#include <memory_resource>
 #include <mutex>
+#include <optional>
+#include <queue>
+#include <random>
+#include <span>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
 class Player;
+class WorldSession;
 class ChatHandler;
+struct FactionEntry;
+
+// Conditions of reward, checked against the player snapshot every tick
+struct OnlineRewardConditions
+{
+    uint8 MinLevel{ 1 };
+    uint8 MaxLevel{};           // 0 - no limit
+    uint32 ClassMask{};         // 0 - any class
+    uint32 RaceMask{};          // 0 - any race
+    uint8 MinSecurity{};
+    uint8 DayOfWeekMask{};      // Bit 0 - sunday, 0 - any day
+    std::vector<uint32> Zones;  // Empty - any zone
+    std::vector<uint32> Maps;   // Empty - any map
+
+    // Replace "any" values with all bits set and sort lists, so the check is plain masks and ranges
+    void Compile()
+    {
+        if (!MaxLevel)
+            MaxLevel = std::numeric_limits<uint8>::max();
+
+        if (!ClassMask)
+            ClassMask = std::numeric_limits<uint32>::max();
+
+        if (!RaceMask)
+            RaceMask = std::numeric_limits<uint32>::max();
+
+        if (!DayOfWeekMask)
+            DayOfWeekMask = std::numeric_limits<uint8>::max();
+
+        for (auto list : { &Zones, &Maps })
+        {
+            std::sort(list->begin(), list->end());
+            list->erase(std::unique(list->begin(), list->end()), list->end());
+        }
+    }
+};
 
 struct OnlineReward
 {
     using RewardsPair = std::pair<uint32/*id*/, uint32/*count*/>;
     using RewardsVector = std::vector<RewardsPair>;
+    using ReputationsPair = std::pair<FactionEntry const*, uint32/*count*/>;
+    using ReputationsVector = std::vector<ReputationsPair>;
 
     OnlineReward() = delete;
 
-    OnlineReward(uint32 id, bool isPerOnline, Seconds time, uint8 minLevel) :
-        ID(id), IsPerOnline(isPerOnline), RewardTime(time), MinLevel(minLevel) { }
+    OnlineReward(uint32 id, bool isPerOnline, Seconds time, OnlineRewardConditions conditions) :
+        ID(id), IsPerOnline(isPerOnline), RewardTime(time), Conditions(std::move(conditions)) { }
 
     uint32 ID{};
     bool IsPerOnline{ true };
     Seconds RewardTime{};
-    uint8 MinLevel{ 1 };
+    OnlineRewardConditions Conditions;
+
+    // Dense index of one-shot reward, ordered by reward time
+    uint32 ClaimIndex{};
 
     RewardsVector Items;
-    RewardsVector Reputations;
+    ReputationsVector Reputations;
+};
+
+// Filter of `.or list`, empty values match any reward
+struct OnlineRewardListFilter
+{
+    std::optional<uint32> ItemID;
+    std::optional<uint32> FactionID;
+    std::optional<bool> IsPerOnline;
+    uint8 MinLevel{ 1 };    // Rewards which level range overlaps with [MinLevel, MaxLevel]
+    uint8 MaxLevel{ std::numeric_limits<uint8>::max() };
+};
+
+// Claimed one-shot rewards of player, bit number is `OnlineReward::ClaimIndex`
+class OnlineRewardClaimMask
+{
+    using Word = uint64;
+    static constexpr std::size_t WORD_BITS = 64;
+
+public:
+    [[nodiscard]] bool Test(std::size_t index) const
+    {
+        return index / WORD_BITS < _words.size() && (_words[index / WORD_BITS] & (Word(1) << (index % WORD_BITS)));
+    }
+
+    void Set(std::size_t index)
+    {
+        if (index / WORD_BITS >= _words.size())
+            _words.resize(index / WORD_BITS + 1);
+
+        _words[index / WORD_BITS] |= Word(1) << (index % WORD_BITS);
+    }
+
+    // Calls `func` for every index below `count` which is not claimed yet
+    template<typename Func>
+    void ForEachUnclaimed(std::size_t count, Func&& func) const
+    {
+        for (std::size_t word = 0; word * WORD_BITS < count; ++word)
+        {
+            Word mask = ~(word < _words.size() ? _words[word] : Word(0));
+
+            if (std::size_t const bits = count - word * WORD_BITS; bits < WORD_BITS)
+                mask &= (Word(1) << bits) - 1;
+
+            for (; mask; mask &= mask - 1)
+                func(word * WORD_BITS + std::countr_zero(mask));
+        }
+    }
+
+    [[nodiscard]] std::size_t GetMemoryUsage() const { return _words.capacity() * sizeof(Word); }
+
+    template<typename Func>
+    void ForEachClaimed(Func&& func) const
+    {
+        for (std::size_t word = 0; word < _words.size(); ++word)
+            for (Word mask = _words[word]; mask; mask &= mask - 1)
+                func(word * WORD_BITS + std::countr_zero(mask));
+    }
+
+private:
+    std::vector<Word> _words;
 };
 
 class OnlineRewardMgr
@@ -63,8 +177,121 @@ class OnlineRewardMgr
     using RewardHistoryStruct = std::pair<uint32/*reward id*/, Seconds/*rewarded seconds*/>;
     using RewardPendingStruct = uint32/*reward id*/;
 
-    using RewardHistory = std::vector<RewardHistoryStruct>;
-    using RewardPending = std::vector<RewardPendingStruct>;
+    struct RewardHistory
+    {
+        std::vector<RewardHistoryStruct> PerTime;
+        OnlineRewardClaimMask Claimed;
+        bool IsClaimedChanged{};
+        bool IsSavePending{};  // Changed by due check, saved by the next full pass
+        uint8 StorageFormat{}; // See `OnlineRewardStoredHistory::Format`
+    };
+
+    // History of offline player kept in memory, see `_dormantHistory`
+    struct DormantHistory
+    {
+        RewardHistory History;
+        std::size_t Memory{}; // Counted in `_dormantMemory`
+    };
+
+    // History of logged in player which is not ready yet, the reward tick skips the player until it's in `_rewardHistory`
+    enum class HistoryLoadState : uint8
+    {
+        Queued,
+        Loading
+    };
+
+    struct HistoryLoad
+    {
+        HistoryLoadState State{ HistoryLoadState::Queued };
+        uint32 LoadId{};      // Results of older loads of the same player are dropped
+        TimePoint QueuedTime;
+    };
+
+    using HistoryLoadQueueEntry = std::tuple<TimePoint/*next reward*/, ObjectGuid::LowType, uint32/*load id*/>;
+
+    // Player checked before the next full pass, e.g. after level up. See `RewardDuePlayers`
+    struct RewardDueEvent
+    {
+        ObjectGuid::LowType LowGuid{};
+        std::optional<bool> WasAfk; // State before afk change, time until the change is checked with it
+    };
+
+    using RewardDueQueueEntry = std::pair<TimePoint/*due*/, ObjectGuid::LowType>;
+
+    // Per tick containers, allocated from tick arenas
+    using RewardPending = std::pmr::vector<RewardPendingStruct>;
+    using RewardPendingStore = std::pmr::vector<std::pair<ObjectGuid::LowType, RewardPending>>;
+    using RewardSkipStore = std::pmr::vector<std::pair<uint32/*reward id*/, OnlineRewardSkipReason>>;
+
+    // All rewards given to player in one tick
+    struct RewardGrant
+    {
+        std::vector<OnlineReward const*> Rewards;
+        std::map<uint32/*item id*/, uint32/*count*/> Items;
+        std::map<FactionEntry const*, uint32/*reputation*/> Reputations;
+    };
+
+    // Everything the eligibility check needs, copied from the player once per tick
+    struct PlayerSnapshot
+    {
+        ObjectGuid::LowType LowGuid{};
+        uint8 Level{};
+        uint8 Security{};
+        uint32 ClassMask{};
+        uint32 RaceMask{};
+        uint32 ZoneId{};
+        uint32 MapId{};
+        Seconds PlayedTime{};
+        bool IsAfk{};
+        bool IsNormalIp{};
+        bool IsDue{ true };             // Checked in this tick. Other players of due check are only needed for ip limit
+        std::string_view RemoteAddress; // Owned by session, valid until end of tick
+        RewardHistory* History{};
+    };
+
+    // Synthetic session of soak run, checked like a player. Items go to synthetic bags and mail rows. See OnlineRewardSoak.cpp
+    struct SoakPlayer
+    {
+        std::string RemoteAddress;
+        TimePoint LoginTime;
+        TimePoint LogoutTime;
+        uint8 Level{};
+        uint32 ClassMask{};
+        uint32 RaceMask{};
+        uint32 FreeSlots{};
+        bool IsAfk{};
+    };
+
+    struct SoakTiming
+    {
+        uint64 Count{};
+        Microseconds Total{};
+        Microseconds Max{};
+    };
+
+    struct SoakRun
+    {
+        uint32 Players{};
+        Minutes Duration{};
+        bool IsStarted{}; // After history of the guids is reset in storage
+        TimePoint Start;
+        TimePoint NextUpdate;
+        std::mt19937 Random;
+        std::unordered_map<ObjectGuid::LowType, SoakPlayer> Online;
+        std::vector<ObjectGuid::LowType> Offline;
+        std::unordered_map<ObjectGuid::LowType, Seconds> PlayedTime; // At last logout, runs `_soakTimeScale` times faster than real time
+        SoakTiming FullPass;
+        SoakTiming DuePass;
+        uint64 PlayersChecked{};    // Snapshots of full passes
+        uint64 MaxTickAllocations{};
+        std::size_t MaxMemory{};
+        uint64 Logins{};
+        uint64 LevelUps{};
+        uint64 RewardsGranted{};
+        uint64 MailRowsAdded{};
+        uint64 MailRowsSent{}; // Deleted from `mail_external` by ExternalMail
+        uint64 StartGeneration{};
+    };
 
 public:
     static OnlineRewardMgr* instance();
@@ -76,44 +303,142 @@ public:
     void RewardNow();
 
     // Player hooks
-    void AddRewardHistory(ObjectGuid::LowType lowGuid);
+    void AddRewardHistory(ObjectGuid::LowType lowGuid, Seconds playedTime);
     void DeleteRewardHistory(ObjectGuid::LowType lowGuid);
+    void AddPlayerAddress(ObjectGuid::LowType lowGuid, std::string const& address);
+    void DeletePlayerAddress(ObjectGuid::LowType lowGuid, std::string const& address);
+
+    // Thread safe, called from map threads. Player is checked at next due check
+    void AddRewardDueEvent(ObjectGuid::LowType lowGuid, std::optional<bool> wasAfk = {});
+    void CheckAfkChange(Player* player);
 
     // World hooks
     void Update(Milliseconds diff);
+    void OnShutdown();
 
-    bool AddReward(uint32 id, bool isPerOnline, Seconds seconds, uint8 minLevel, std::string_view items, std::string_view reputations, ChatHandler* handler = nullptr);
+    bool AddReward(uint32 id, bool isPerOnline, Seconds seconds, OnlineRewardConditions conditions, std::string_view items, std::string_view reputations, ChatHandler* handler = nullptr);
     bool DeleteReward(uint32 id);
     bool IsExistReward(uint32 id);
 
     auto const& GetOnlineRewards() { return _rewards; }
 
+    // Matching rewards sorted by time, only rewards of `page` (from 0) are added to `result`. Returns count of all matching rewards
+    std::size_t GetRewardsPage(OnlineRewardListFilter const& filter, std::size_t page, std::size_t pageSize, std::vector<OnlineReward const*>& result) const;
+
     void LoadDBData();
     [[nodiscard]] std::size_t GetLastId() const { return _lastId; }
+    [[nodiscard]] OnlineRewardStorage* GetStorage() const { return _storage.get(); }
 
     void GetNextTimeForReward(Player* player, Seconds playedTime, OnlineReward const* onlineReward);
 
+    // Soak run: `players` synthetic sessions with reserved guids for `duration`, results are compared with `OR.Soak.BaselineFile`
+    bool StartSoak(uint32 players, Minutes duration, ChatHandler* handler = nullptr);
+    void StopSoak();
+
+    // Items of all rewards merged as one grant are checked against bags of the player and mail rows as they would be sent, nothing is given
+    void CheckItemDelivery(Player* player, ChatHandler* handler) const;
+
+    // Scripted check of the same delivery without a player: items of all rewards against full and partly full synthetic bags.
+    // Every unit must go to bags or to one mail row, full bags get nothing, no row is rejected at send. Returns count of failed checks
+    uint32 RunItemDeliveryChecks(ChatHandler* handler = nullptr) const;
+
+    // Rows and packed history formats compared on "mysql" storage with `players` generated histories, results are logged
+    bool BenchmarkHistoryFormats(uint32 players, Seconds maxPlayed, ChatHandler* handler);
+
 private:
+    [[nodiscard]] std::map<uint32, uint32> GetAllRewardItems() const;
+    std::vector<std::string> CheckItemDeliveryPlan(std::map<uint32, uint32> const& items, uint32 freeSlots) const;
+
+    void MakePlayerSnapshots();
+    void AddPlayerSnapshot(WorldSession* session, Player* player, bool isDue);
     void MakeIpCache();
-    bool IsNormalIpPlayer(Player* player);
 
+    // Full pass checks all online players every `_rewardInterval`
     void RewardPlayers();
+
+    // Due check runs every second for players with reached reward time and players from `_rewardDueEvents`.
+    // Other players with the same ip are added to snapshots without check, so ip limit is the same as in full pass
+    void RewardDuePlayers();
+    void MakeDuePlayerSnapshots();
+    void SetRewardDue(ObjectGuid::LowType lowGuid, TimePoint due);
+    void UpdateRewardDue();
+
+    // Check and send of players in `_playerSnapshots`
+    void RewardSnapshots();
+
+    void CheckPlayersForReward();
+    void ResetTickContainers();
+    void UpdateMemoryStats();
     bool IsExistHistory(ObjectGuid::LowType lowGuid);
+
+    // All loaded players and logged out players with changes of due check, see `_unsavedDormant`
     void SaveRewardHistoryToDB();
 
-    RewardHistory* GetHistory(ObjectGuid::LowType lowGuid);
     Seconds GetHistorySecondsForReward(ObjectGuid::LowType lowGuid, uint32 id);
+    bool IsClaimedReward(ObjectGuid::LowType lowGuid, OnlineReward const* onlineReward);
     OnlineReward const* GetOnlineReward(uint32 id);
 
-    void SendRewardForPlayer(Player* player, uint32 rewardID);
-    void AddHistory(ObjectGuid::LowType lowGuid, uint32 rewardId, Seconds playerOnlineTime);
-
-    void AddRewardHistoryAsync(ObjectGuid::LowType lowGuid, QueryResult result);
-    void CheckPlayerForReward(Player* player, Seconds playedTime, OnlineReward const* onlineReward);
+    void SendRewardForPlayer(Player* player, RewardGrant const& grant);
+    void SendRewardForSoakPlayer(ObjectGuid::LowType lowGuid, SoakPlayer& soakPlayer, RewardGrant const& grant);
+    static void AddHistory(RewardHistory& history, uint32 rewardId, Seconds playerOnlineTime);
+
+    // Load queue, players closest to the next reward are loaded first
+    void ProcessHistoryLoadQueue();
+    [[nodiscard]] Seconds GetSecondsToNextReward(Seconds playedTime) const;
+    [[nodiscard]] bool IsActiveHistoryLoad(ObjectGuid::LowType lowGuid, uint32 loadId) const;
+    void FinishHistoryLoad(ObjectGuid::LowType lowGuid);
+    void UpdateHistoryLoadStats();
+
+    void LoadHistory(ObjectGuid::LowType lowGuid, uint32 loadId);
+    RewardHistory MakeRewardHistory(OnlineRewardStoredHistory&& storedHistory) const;
+    OnlineRewardStoredHistory MakeStoredHistory(ObjectGuid::LowType lowGuid, RewardHistory const& history) const;
+    void AddRewardHistoryAsync(ObjectGuid::LowType lowGuid, RewardHistory&& rewardHistory);
+
+    // Dormant history cache, filled by snapshot and startup preload
+    void PreloadHistory();
+    bool AddDormantHistory(ObjectGuid::LowType lowGuid, RewardHistory&& rewardHistory);
+    void ClearDormantHistory();
+
+    // Calls `func(lowGuid, history)` for history of online and dormant players
+    template<typename Func>
+    void ForEachHistory(Func&& func)
+    {
+        for (auto& [lowGuid, history] : _rewardHistory)
+            func(lowGuid, history);
+
+        for (auto& [lowGuid, dormant] : _dormantHistory)
+            func(lowGuid, dormant.History);
+    }
+    // `skips` - lost per time rewards for telemetry, nullptr if it's disabled
+    void CheckPlayerForReward(PlayerSnapshot& snapshot, RewardPending& pending, RewardSkipStore* skips) const;
+    [[nodiscard]] OnlineRewardSkipReason GetSkipReason(PlayerSnapshot const& snapshot, OnlineReward const* onlineReward) const;
+    bool CanReceiveReward(PlayerSnapshot const& snapshot, OnlineReward const* onlineReward) const;
+
+    void RebuildRewardIndex();
+    std::vector<uint8> PackClaims(OnlineRewardClaimMask const& claimed) const;
+    void UnpackClaims(std::vector<uint8> const& packed, OnlineRewardClaimMask& claimed) const;
 
     void SendRewards();
     void ScheduleReward();
 
+    // Warm restart snapshot, OnlineRewardSnapshot.cpp
+    bool LoadSnapshot();
+    void SaveSnapshotAsync();
+    void WriteSnapshot(uint32 catalogCount, uint64 catalogChecksum);
+
+    // Soak run, OnlineRewardSoak.cpp
+    void BeginSoak();
+    void UpdateSoak();
+    void LoginSoakPlayer(TimePoint now);
+    void LogoutSoakPlayer(ObjectGuid::LowType lowGuid, TimePoint now);
+    [[nodiscard]] Seconds GetSoakPlayedTime(ObjectGuid::LowType lowGuid, SoakPlayer const& soakPlayer, TimePoint now) const;
+    [[nodiscard]] Milliseconds GetSoakRealTime(Seconds playedTime) const;
+    [[nodiscard]] bool IsSoakPlayer(ObjectGuid::LowType lowGuid) const;
+    bool AddSoakSnapshot(ObjectGuid::LowType lowGuid, bool isDue);
+    void AddSoakPass(bool isFullPass, TimePoint start);
+    void FinishSoak();
+    void ClearSoak();
+
     // Config
     bool _isEnable{};
     bool _isPerOnlineEnable{};
@@ -121,16 +446,70 @@ private:
     bool _isForceMailReward{ true };
     bool _skipAfkPlayers{ true };
     uint32 _maxSameIpCount{ 3 };
+    uint32 _eligibilityThreads{ 1 };
+    bool _isTickArenaEnable{ true };
+    bool _isSnapshotEnable{};
+    std::string _snapshotFile{ "or_snapshot.bin" };
+    Minutes _snapshotInterval{ 10min };
+    bool _isPreloadEnable{};
+    uint32 _preloadDays{ 7 };
+    std::size_t _dormantMaxMemory{ 64 * 1024 * 1024 };
+    Seconds _rewardInterval{ 1min };
+    bool _isDueCheckEnable{ true };
+    uint32 _soakPlayers{};
+    Minutes _soakDuration{ 60min };
+    Minutes _soakSessionTime{ 30min };
+    uint32 _soakTimeScale{ 1 };
+    uint32 _soakAfkChangesPerHour{ 6 };
+    uint32 _soakLevelUpsPerHour{ 1 };
+    std::string _soakResultFile{ "or_soak_result.txt" };
+    std::string _soakBaselineFile{ "or_soak_baseline.txt" };
+    uint32 _soakMaxRegression{ 10 };
+    bool _isSoakShutdown{};
 
     // Containers
     std::unordered_map<uint32, OnlineReward> _rewards;
+    std::vector<OnlineReward const*> _onceRewards;
+    std::vector<uint32> _onceRewardIds;
+    std::vector<Seconds> _onceRewardTimes;
+    std::vector<OnlineReward const*> _perTimeRewards;
+    std::vector<OnlineReward const*> _rewardsByTime;
+    std::unordered_map<uint32/*item id*/, std::vector<OnlineReward const*>> _rewardsByItem;       // Sorted by time
+    std::unordered_map<uint32/*faction id*/, std::vector<OnlineReward const*>> _rewardsByFaction; // Sorted by time
     std::unordered_map<ObjectGuid::LowType, RewardHistory> _rewardHistory;
-    std::unordered_map<ObjectGuid::LowType, RewardPending> _rewardPending;
-    std::unordered_map<std::string, std::vector<Player*>> _ipCache;
+    std::unordered_map<ObjectGuid::LowType, DormantHistory> _dormantHistory; // Moved to `_rewardHistory` at login instead of DB query
+    std::size_t _dormantMemory{};
+    std::vector<ObjectGuid::LowType> _unsavedDormant; // Logged out with `RewardHistory::IsSavePending`, history is in `_dormantHistory`
+    uint64 _historyGeneration{}; // Incremented by save of full pass, snapshot is valid only for the same generation in DB
+    OnlineRewardArena _tickArena;
+    std::vector<std::unique_ptr<OnlineRewardArena>> _partitionArenas;
+    OnlineRewardWorkerPool _eligibilityPool; // `_eligibilityThreads` - 1 workers, world thread checks the first partition
+    std::vector<RewardPendingStore> _rewardPending; // One store per eligibility partition
+    std::vector<RewardSkipStore> _rewardSkips;      // One store per eligibility partition, only with telemetry
+    std::pmr::unordered_map<std::string_view, std::pmr::vector<PlayerSnapshot*>> _ipCache{ _tickArena.GetResource() };
+    std::pmr::vector<PlayerSnapshot> _playerSnapshots{ _tickArena.GetResource() };
+    uint8 _dayOfWeekMask{}; // Day of current tick, for `OnlineRewardConditions::DayOfWeekMask`
     TaskScheduler scheduler;
     std::size_t _lastId{};
-
-    QueryCallbackProcessor _queryProcessor;
+    std::size_t _historyWithoutPlayer{};
+
+    std::unordered_map<ObjectGuid::LowType, HistoryLoad> _historyLoads;
+    std::priority_queue<HistoryLoadQueueEntry, std::vector<HistoryLoadQueueEntry>, std::greater<>> _historyLoadQueue;
+    uint32 _lastHistoryLoadId{};
+    uint32 _historyLoadMaxQueries{ 50 };
+    std::optional<TimePoint> _historyBacklogStart; // Since `_historyLoads` is not empty
+
+    std::unordered_map<ObjectGuid::LowType, TimePoint> _rewardDue; // Queue entries with other time are outdated
+    std::priority_queue<RewardDueQueueEntry, std::vector<RewardDueQueueEntry>, std::greater<>> _rewardDueQueue;
+    std::vector<ObjectGuid::LowType> _duePlayers; // Players of current due check, sorted
+    std::unordered_map<std::string, std::vector<ObjectGuid::LowType>> _addressPlayers; // Online players by remote address
+    std::unordered_map<ObjectGuid::LowType, bool> _playerAfk; // Afk state of last player update. Filled at login and logout in world thread, see `CheckAfkChange`
+    std::vector<RewardDueEvent> _rewardDueEvents;
+    std::mutex _rewardDueEventsLock;
+
+    std::unique_ptr<OnlineRewardStorage> _storage;
+    std::unique_ptr<SoakRun> _soak;
+    std::size_t _historyQueries{}; // History loads in `_storage`
     std::mutex _playerLoadingLock;
 };
 
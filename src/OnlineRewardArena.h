@@ -0,0 +1,109 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WARHEAD_ONLINE_REWARD_ARENA_H_
+#define _WARHEAD_ONLINE_REWARD_ARENA_H_
+
+#include "Define.h"
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+// Monotonic memory for containers which are rebuilt every tick.
+// Reset() keeps the buffer and grows it to the usage of the last tick, so a steady tick does no heap allocations.
+// Not thread safe, one arena is used by one thread at a time.
+// Disabled arena gives the heap to containers, every allocation is counted. It's the cost without arena, to compare
+class OnlineRewardArena
+{
+    // Upstream of the buffer, counts heap allocations made after the buffer is full
+    class CountingResource final : public std::pmr::memory_resource
+    {
+    public:
+        uint64 Allocations{};
+        std::size_t Bytes{};
+
+    private:
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override
+        {
+            ++Allocations;
+            Bytes += bytes;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+        {
+            std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+        }
+
+        [[nodiscard]] bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+public:
+    explicit OnlineRewardArena(std::size_t initialSize = 16 * 1024) :
+        _buffer(initialSize)
+    {
+        _resource.emplace(_buffer.data(), _buffer.size(), &_upstream);
+    }
+
+    OnlineRewardArena(OnlineRewardArena const&) = delete;
+    OnlineRewardArena& operator= (OnlineRewardArena const&) = delete;
+
+    [[nodiscard]] std::pmr::memory_resource* GetResource()
+    {
+        if (!_isEnabled)
+            return &_upstream;
+
+        return &*_resource;
+    }
+
+    // Used by containers made after the call, old ones keep memory they got
+    void SetEnabled(bool isEnabled) { _isEnabled = isEnabled; }
+
+    // All containers allocated from the arena must be destroyed or replaced with new ones before
+    void Reset()
+    {
+        _lastAllocations = _upstream.Allocations;
+
+        if (_upstream.Bytes && _isEnabled)
+        {
+            _resource.reset();
+            _buffer = std::vector<std::byte>(_buffer.size() + _upstream.Bytes);
+            _resource.emplace(_buffer.data(), _buffer.size(), &_upstream);
+        }
+        else
+            _resource->release();
+
+        _upstream.Allocations = 0;
+        _upstream.Bytes = 0;
+    }
+
+    // Heap allocations made by the arena during the last tick
+    [[nodiscard]] uint64 GetLastAllocations() const { return _lastAllocations; }
+    [[nodiscard]] std::size_t GetCapacity() const { return _buffer.size(); }
+
+private:
+    CountingResource _upstream;
+    std::vector<std::byte> _buffer;
+    std::optional<std::pmr::monotonic_buffer_resource> _resource;
+    uint64 _lastAllocations{};
+    bool _isEnabled{ true };
+};
+
+#endif
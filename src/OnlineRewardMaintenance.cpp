@@ -0,0 +1,156 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineRewardMaintenance.h"
+#include "Common.h"
+#include "Config.h"
+#include "Log.h"
+#include "OnlineReward.h"
+
+namespace
+{
+    constexpr uint32 MAINTENANCE_GROUP_JOB = 1;
+}
+
+OnlineRewardMaintenance* OnlineRewardMaintenance::instance()
+{
+    static OnlineRewardMaintenance instance;
+    return &instance;
+}
+
+void OnlineRewardMaintenance::LoadConfig()
+{
+    _isEnable = sConfigMgr->GetOption<bool>("OR.Maintenance.Enable", false);
+    _interval = Hours(std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Maintenance.Interval", 24)));
+    _batchSize = std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Maintenance.BatchSize", 500));
+    _batchDelay = Milliseconds(sConfigMgr->GetOption<uint32>("OR.Maintenance.BatchDelay", 1000));
+    _archiveAfterDays = sConfigMgr->GetOption<uint32>("OR.Maintenance.ArchiveAfterDays", 180);
+
+    ScheduleJob();
+}
+
+void OnlineRewardMaintenance::Update(Milliseconds diff)
+{
+    _scheduler.Update(diff);
+}
+
+void OnlineRewardMaintenance::ScheduleJob()
+{
+    _scheduler.CancelGroup(MAINTENANCE_GROUP_JOB);
+
+    if (!_isEnable)
+        return;
+
+    _scheduler.Schedule(_interval, MAINTENANCE_GROUP_JOB, [this](TaskContext context)
+    {
+        Start();
+        context.Repeat(_interval);
+    });
+}
+
+bool OnlineRewardMaintenance::Start()
+{
+    if (IsRunning())
+        return false;
+
+    LOG_INFO("module.or", "> OR Maintenance: Start cleanup of `wh_online_rewards_history` and `wh_online_rewards_history_packed`");
+
+    _stage = Stage::Orphans;
+    _orphanRowsRemoved = 0;
+    _playersArchived = 0;
+
+    QueryTableStats([this](OnlineRewardStorageStats stats)
+    {
+        _before = stats;
+        ScheduleNextBatch(Stage::Orphans);
+    });
+
+    return true;
+}
+
+void OnlineRewardMaintenance::ScheduleNextBatch(Stage stage)
+{
+    _stage = stage;
+
+    _scheduler.Schedule(_batchDelay, [this](TaskContext /*context*/)
+    {
+        if (_stage == Stage::Orphans)
+            RemoveOrphans();
+        else
+            ArchiveInactive();
+    });
+}
+
+void OnlineRewardMaintenance::RemoveOrphans()
+{
+    auto storage{ sORMgr->GetStorage() };
+    if (!storage)
+    {
+        Finish();
+        return;
+    }
+
+    storage->RemoveOrphanHistory(_batchSize, [this](uint64 rowsCount, bool hasMore)
+    {
+        _orphanRowsRemoved += rowsCount;
+        ScheduleNextBatch(hasMore ? Stage::Orphans : Stage::Archive);
+    });
+}
+
+void OnlineRewardMaintenance::ArchiveInactive()
+{
+    auto storage{ sORMgr->GetStorage() };
+    if (!_archiveAfterDays || !storage)
+    {
+        Finish();
+        return;
+    }
+
+    storage->ArchiveInactiveHistory(_archiveAfterDays, _batchSize, [this](uint64 playersCount, bool hasMore)
+    {
+        _playersArchived += playersCount;
+
+        if (hasMore)
+            ScheduleNextBatch(Stage::Archive);
+        else
+            Finish();
+    });
+}
+
+void OnlineRewardMaintenance::Finish()
+{
+    QueryTableStats([this](OnlineRewardStorageStats after)
+    {
+        LOG_INFO("module.or", "> OR Maintenance: Removed {} rows and claims of deleted rewards, archived {} inactive players", _orphanRowsRemoved, _playersArchived);
+        LOG_INFO("module.or", "> OR Maintenance: Rows {} -> {} ({} removed), packed players {} -> {}. Size {} -> {} bytes",
+            _before.Rows, after.Rows, _before.Rows > after.Rows ? _before.Rows - after.Rows : 0, _before.PackedRows, after.PackedRows, _before.Bytes, after.Bytes);
+
+        _stage = Stage::None;
+    });
+}
+
+void OnlineRewardMaintenance::QueryTableStats(std::function<void(OnlineRewardStorageStats)>&& callback)
+{
+    auto storage{ sORMgr->GetStorage() };
+    if (!storage)
+    {
+        callback({});
+        return;
+    }
+
+    storage->GetHistoryStats(std::move(callback));
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WARHEAD_ONLINE_REWARD_MAINTENANCE_H_
+#define _WARHEAD_ONLINE_REWARD_MAINTENANCE_H_
+
+#include "Define.h"
+#include "Duration.h"
+#include "OnlineRewardStorage.h"
+#include "TaskScheduler.h"
+
+// Cleans stored history in small batches: rows of deleted rewards are removed,
+// history of characters not logged in for a long time is moved to the archive
+class OnlineRewardMaintenance
+{
+    OnlineRewardMaintenance() = default;
+    ~OnlineRewardMaintenance() = default;
+
+    OnlineRewardMaintenance(OnlineRewardMaintenance const&) = delete;
+    OnlineRewardMaintenance(OnlineRewardMaintenance&&) = delete;
+    OnlineRewardMaintenance& operator= (OnlineRewardMaintenance const&) = delete;
+    OnlineRewardMaintenance& operator= (OnlineRewardMaintenance&&) = delete;
+
+    enum class Stage : uint8
+    {
+        None,
+        Orphans,
+        Archive
+    };
+
+public:
+    static OnlineRewardMaintenance* instance();
+
+    void LoadConfig();
+    void Update(Milliseconds diff);
+
+    // Returns false if job is already running
+    bool Start();
+    [[nodiscard]] inline bool IsRunning() const { return _stage != Stage::None; }
+
+private:
+    void ScheduleJob();
+    void ScheduleNextBatch(Stage stage);
+
+    void RemoveOrphans();
+    void ArchiveInactive();
+    void Finish();
+
+    void QueryTableStats(std::function<void(OnlineRewardStorageStats)>&& callback);
+
+    // Config
+    bool _isEnable{};
+    Hours _interval{ 24h };
+    uint32 _batchSize{ 500 };
+    Milliseconds _batchDelay{ 1s };
+    uint32 _archiveAfterDays{ 180 };
+
+    // Current job
+    Stage _stage{ Stage::None };
+    OnlineRewardStorageStats _before;
+    uint64 _orphanRowsRemoved{};
+    uint64 _playersArchived{};
+
+    TaskScheduler _scheduler;
+};
+
+#define sORMaintenance OnlineRewardMaintenance::instance()
+
+#endif
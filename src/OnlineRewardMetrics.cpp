@@ -0,0 +1,319 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineRewardMetrics.h"
+#include "Chat.h"
+#include "Config.h"
+#include "Log.h"
+#include "StringFormat.h"
+#include "World.h"
+
+namespace
+{
+    constexpr std::string_view GetTableName(MetricTable table)
+    {
+        switch (table)
+        {
+            case MetricTable::History:
+                return "wh_online_rewards_history*";
+            case MetricTable::MailExternal:
+                return "mail_external";
+            case MetricTable::Stats:
+                return "wh_online_rewards_stats";
+            default:
+                return "";
+        }
+    }
+
+    constexpr std::string_view GetContainerName(MetricContainer container)
+    {
+        switch (container)
+        {
+            case MetricContainer::Rewards:
+                return "Rewards and indexes";
+            case MetricContainer::RewardHistory:
+                return "History of online players";
+            case MetricContainer::DormantHistory:
+                return "History cache";
+            case MetricContainer::PlayerSnapshots:
+                return "Player snapshots (tick)";
+            case MetricContainer::IpCache:
+                return "Ip cache (tick)";
+            case MetricContainer::RewardPending:
+                return "Pending rewards (tick)";
+            case MetricContainer::HistoryQueries:
+                return "History queries in flight";
+            case MetricContainer::MailStore:
+                return "External mail store (poll)";
+            case MetricContainer::MailQueries:
+                return "External mail queries in flight";
+            case MetricContainer::EconomyStats:
+                return "Economy stats not flushed";
+            default:
+                return "";
+        }
+    }
+
+    constexpr bool IsArenaContainer(MetricContainer container)
+    {
+        return container == MetricContainer::PlayerSnapshots || container == MetricContainer::IpCache ||
+            container == MetricContainer::RewardPending || container == MetricContainer::MailStore;
+    }
+
+    constexpr std::string_view GetArenaName(MetricArena arena)
+    {
+        switch (arena)
+        {
+            case MetricArena::RewardTick:
+                return "Reward tick";
+            case MetricArena::ExternalMail:
+                return "External mail";
+            default:
+                return "";
+        }
+    }
+}
+
+std::string_view GetMetricUpdateName(MetricUpdate update)
+{
+    switch (update)
+    {
+        case MetricUpdate::OnlineReward:
+            return "OnlineRewardMgr::Update";
+        case MetricUpdate::ExternalMail:
+            return "ExternalMail::Update";
+        default:
+            return "";
+    }
+}
+
+OnlineRewardMetrics* OnlineRewardMetrics::instance()
+{
+    static OnlineRewardMetrics instance;
+    return &instance;
+}
+
+void OnlineRewardMetrics::LoadConfig()
+{
+    _memoryThreshold = static_cast<std::size_t>(sConfigMgr->GetOption<uint32>("OR.Memory.LogThreshold", 0)) * 1024 * 1024;
+    _isOverMemoryThreshold = false;
+}
+
+void OnlineRewardMetrics::Update(Milliseconds diff)
+{
+    _minuteTimer += diff;
+    if (_minuteTimer < 1min)
+        return;
+
+    _minuteTimer = 0ms;
+
+    // Logged once when crossed, again only after memory goes below
+    if (_memoryThreshold)
+    {
+        auto const totalMemory{ GetTotalMemory() };
+        bool const isOverThreshold{ totalMemory > _memoryThreshold };
+
+        if (isOverThreshold && !_isOverMemoryThreshold)
+            LOG_WARN("module.or", "> OR: Module memory {} KB is over threshold {} KB. Players online {}, history without online player {}",
+                totalMemory / 1024, _memoryThreshold / 1024, sWorld->GetPlayerCount(), _historyWithoutPlayer);
+
+        _isOverMemoryThreshold = isOverThreshold;
+    }
+
+    for (auto& counter : _statements)
+    {
+        counter.LastMinute = counter.CurrentMinute;
+        counter.CurrentMinute = 0;
+    }
+}
+
+void OnlineRewardMetrics::AddUpdateTime(MetricUpdate update, Microseconds time)
+{
+    auto& timing{ _updateTimings[static_cast<std::size_t>(update)] };
+    ++timing.Count;
+    timing.Total += time;
+    timing.Max = std::max(timing.Max, time);
+}
+
+void OnlineRewardMetrics::AddStatements(MetricTable table, uint64 count /*= 1*/)
+{
+    auto& counter{ _statements[static_cast<std::size_t>(table)] };
+    counter.Total += count;
+    counter.CurrentMinute += count;
+}
+
+void OnlineRewardMetrics::SetArenaStats(MetricArena arena, uint64 allocations, std::size_t capacity)
+{
+    auto& stats{ _arenas[static_cast<std::size_t>(arena)] };
+    stats.LastAllocations = allocations;
+    stats.Capacity = capacity;
+}
+
+void OnlineRewardMetrics::AddHistoryCacheLookup(bool isHit)
+{
+    ++(isHit ? _historyCache.Hits : _historyCache.Misses);
+}
+
+void OnlineRewardMetrics::AddMailRows(uint64 rows)
+{
+    _mailRows += rows;
+}
+
+void OnlineRewardMetrics::SetContainerStats(MetricContainer container, std::size_t elements, std::size_t buckets, std::size_t bytes)
+{
+    auto& stats{ _containers[static_cast<std::size_t>(container)] };
+    stats.Elements = elements;
+    stats.Buckets = buckets;
+    stats.Bytes = bytes;
+}
+
+void OnlineRewardMetrics::SetHistoryWithoutPlayer(std::size_t count)
+{
+    _historyWithoutPlayer = count;
+}
+
+std::size_t OnlineRewardMetrics::GetTotalMemory() const
+{
+    std::size_t totalMemory{ 0 };
+
+    // Per-tick containers are allocated from the arenas, counted with the arena capacity
+    for (std::size_t i = 0; i < _containers.size(); ++i)
+        if (!IsArenaContainer(static_cast<MetricContainer>(i)))
+            totalMemory += _containers[i].Bytes;
+
+    for (auto const& stats : _arenas)
+        totalMemory += stats.Capacity;
+
+    return totalMemory;
+}
+
+void OnlineRewardMetrics::SetHistoryCacheStats(std::size_t players, std::size_t memory)
+{
+    _historyCache.Players = players;
+    _historyCache.Memory = memory;
+}
+
+void OnlineRewardMetrics::SetHistoryLoadWaiting(std::size_t players)
+{
+    _historyLoad.Waiting = players;
+}
+
+void OnlineRewardMetrics::AddHistoryLoadWait(Milliseconds wait)
+{
+    ++_historyLoad.Loaded;
+    _historyLoad.TotalWait += wait;
+    _historyLoad.MaxWait = std::max(_historyLoad.MaxWait, wait);
+}
+
+void OnlineRewardMetrics::AddHistoryLoadBacklog(Milliseconds backlog)
+{
+    _historyLoad.LastBacklog = backlog;
+    _historyLoad.MaxBacklog = std::max(_historyLoad.MaxBacklog, backlog);
+}
+
+Milliseconds OnlineRewardMetrics::GetHistoryLoadAverageWait() const
+{
+    return _historyLoad.Loaded ? Milliseconds(_historyLoad.TotalWait.count() / _historyLoad.Loaded) : 0ms;
+}
+
+uint64 OnlineRewardMetrics::GetStatementsTotal() const
+{
+    uint64 total{ 0 };
+
+    for (auto const& counter : _statements)
+        total += counter.Total;
+
+    return total;
+}
+
+void OnlineRewardMetrics::PrintStats(ChatHandler* handler) const
+{
+    handler->SendSysMessage("> World thread time:");
+
+    for (std::size_t i = 0; i < _updateTimings.size(); ++i)
+    {
+        auto const& timing{ _updateTimings[i] };
+        auto average = timing.Count ? timing.Total.count() / timing.Count : 0;
+
+        handler->SendSysMessage(Acore::StringFormatFmt("-- {}: calls {}, avg {} us, max {} us, total {} ms",
+            GetMetricUpdateName(static_cast<MetricUpdate>(i)), timing.Count, average, timing.Max.count(), timing.Total.count() / 1000));
+    }
+
+    // All world thread time of external mail, divided by rows read from `mail_external`
+    auto const& mailTiming{ _updateTimings[static_cast<std::size_t>(MetricUpdate::ExternalMail)] };
+    handler->SendSysMessage(Acore::StringFormatFmt("-- External mail per polled row: rows {}, avg {} us",
+        _mailRows, _mailRows ? mailTiming.Total.count() / _mailRows : 0));
+
+    handler->SendSysMessage("> DB statements:");
+
+    for (std::size_t i = 0; i < _statements.size(); ++i)
+    {
+        auto const& counter{ _statements[i] };
+
+        handler->SendSysMessage(Acore::StringFormatFmt("-- {}: last minute {}, total {}",
+            GetTableName(static_cast<MetricTable>(i)), counter.LastMinute, counter.Total));
+    }
+
+    handler->SendSysMessage("> Per-tick arenas:");
+
+    for (std::size_t i = 0; i < _arenas.size(); ++i)
+    {
+        auto const& stats{ _arenas[i] };
+
+        handler->SendSysMessage(Acore::StringFormatFmt("-- {}: heap allocations last tick {}, capacity {} KB",
+            GetArenaName(static_cast<MetricArena>(i)), stats.LastAllocations, stats.Capacity / 1024));
+    }
+
+    handler->SendSysMessage("> Memory (estimated):");
+
+    for (std::size_t i = 0; i < _containers.size(); ++i)
+    {
+        auto const& stats{ _containers[i] };
+
+        handler->SendSysMessage(Acore::StringFormatFmt("-- {}: elements {}, buckets {}, {} KB",
+            GetContainerName(static_cast<MetricContainer>(i)), stats.Elements, stats.Buckets, stats.Bytes / 1024));
+    }
+
+    auto const totalMemory{ GetTotalMemory() };
+    auto const playersCount{ sWorld->GetPlayerCount() };
+
+    handler->SendSysMessage(Acore::StringFormatFmt("-- Total with arenas: {} KB, per online player {} bytes, history without online player {}",
+        totalMemory / 1024, playersCount ? totalMemory / playersCount : 0, _historyWithoutPlayer));
+
+    auto const lookups{ _historyCache.Hits + _historyCache.Misses };
+
+    handler->SendSysMessage(Acore::StringFormatFmt("> History cache: players {}, memory {} KB, hits {}, misses {}, hit rate {}%",
+        _historyCache.Players, _historyCache.Memory / 1024, _historyCache.Hits, _historyCache.Misses, lookups ? _historyCache.Hits * 100 / lookups : 0));
+
+    // Players waiting for history are not rewarded, backlog is the time until nobody waits
+    handler->SendSysMessage(Acore::StringFormatFmt("> History loading: players waiting {}, loaded {}, avg wait {} ms, max wait {} ms, last backlog {} ms, max backlog {} ms",
+        _historyLoad.Waiting, _historyLoad.Loaded, GetHistoryLoadAverageWait().count(),
+        _historyLoad.MaxWait.count(), _historyLoad.LastBacklog.count(), _historyLoad.MaxBacklog.count()));
+}
+
+void OnlineRewardMetrics::Reset()
+{
+    _updateTimings = {};
+    _statements = {};
+    _historyCache.Hits = 0;
+    _historyCache.Misses = 0;
+    _mailRows = 0;
+    _historyLoad.Loaded = 0;
+    _historyLoad.TotalWait = 0ms;
+    _historyLoad.MaxWait = 0ms;
+    _historyLoad.MaxBacklog = 0ms;
+}
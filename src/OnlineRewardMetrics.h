@@ -0,0 +1,209 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WARHEAD_ONLINE_REWARD_METRICS_H_
+#define _WARHEAD_ONLINE_REWARD_METRICS_H_
+
+#include "Define.h"
+#include "Duration.h"
+#include <array>
+#include <string_view>
+
+class ChatHandler;
+
+enum class MetricUpdate : uint8
+{
+    OnlineReward,
+    ExternalMail,
+
+    Max
+};
+
+enum class MetricTable : uint8
+{
+    History,
+    MailExternal,
+    Stats,
+
+    Max
+};
+
+enum class MetricArena : uint8
+{
+    RewardTick,
+    ExternalMail,
+
+    Max
+};
+
+enum class MetricContainer : uint8
+{
+    Rewards,
+    RewardHistory,
+    DormantHistory,
+    PlayerSnapshots,
+    IpCache,
+    RewardPending,
+    HistoryQueries,
+    MailStore,
+    MailQueries,
+    EconomyStats,
+
+    Max
+};
+
+// Name of the update function, used in logs and stats
+std::string_view GetMetricUpdateName(MetricUpdate update);
+
+// Estimated heap bytes of containers, allocator overhead is not counted
+template<typename Vector>
+inline std::size_t GetVectorMemory(Vector const& vector)
+{
+    return vector.capacity() * sizeof(typename Vector::value_type);
+}
+
+// Buckets and nodes with next pointer and cached hash
+template<typename Map>
+inline std::size_t GetHashMapMemory(Map const& map)
+{
+    return map.bucket_count() * sizeof(void*) + map.size() * (sizeof(typename Map::value_type) + sizeof(void*) + sizeof(std::size_t));
+}
+
+// Counters of world thread cost and DB load of the module, shown by `.or stats`. World thread only
+class OnlineRewardMetrics
+{
+    OnlineRewardMetrics() = default;
+    ~OnlineRewardMetrics() = default;
+
+    OnlineRewardMetrics(OnlineRewardMetrics const&) = delete;
+    OnlineRewardMetrics(OnlineRewardMetrics&&) = delete;
+    OnlineRewardMetrics& operator= (OnlineRewardMetrics const&) = delete;
+    OnlineRewardMetrics& operator= (OnlineRewardMetrics&&) = delete;
+
+    struct UpdateTiming
+    {
+        uint64 Count{};
+        Microseconds Total{};
+        Microseconds Max{};
+    };
+
+    struct StatementCounter
+    {
+        uint64 Total{};
+        uint64 CurrentMinute{};
+        uint64 LastMinute{};
+    };
+
+    struct ArenaStats
+    {
+        uint64 LastAllocations{};
+        std::size_t Capacity{};
+    };
+
+    struct ContainerStats
+    {
+        std::size_t Elements{};
+        std::size_t Buckets{};
+        std::size_t Bytes{};
+    };
+
+    struct HistoryLoadStats
+    {
+        std::size_t Waiting{};
+        uint64 Loaded{};
+        Milliseconds TotalWait{};
+        Milliseconds MaxWait{};
+        Milliseconds LastBacklog{};
+        Milliseconds MaxBacklog{};
+    };
+
+    struct HistoryCacheStats
+    {
+        uint64 Hits{};
+        uint64 Misses{};
+        std::size_t Players{};
+        std::size_t Memory{};
+    };
+
+public:
+    static OnlineRewardMetrics* instance();
+
+    void LoadConfig();
+    void Update(Milliseconds diff);
+
+    void AddUpdateTime(MetricUpdate update, Microseconds time);
+    void AddStatements(MetricTable table, uint64 count = 1);
+    void SetArenaStats(MetricArena arena, uint64 allocations, std::size_t capacity);
+    void AddHistoryCacheLookup(bool isHit);
+    void AddMailRows(uint64 rows);
+    void SetContainerStats(MetricContainer container, std::size_t elements, std::size_t buckets, std::size_t bytes);
+    void SetHistoryWithoutPlayer(std::size_t count);
+    void SetHistoryCacheStats(std::size_t players, std::size_t memory);
+    void SetHistoryLoadWaiting(std::size_t players);
+    void AddHistoryLoadWait(Milliseconds wait);
+    void AddHistoryLoadBacklog(Milliseconds backlog);
+
+    // Totals since start or last reset
+    [[nodiscard]] uint64 GetStatementsTotal() const;
+    [[nodiscard]] inline uint64 GetStatementsTotal(MetricTable table) const { return _statements[static_cast<std::size_t>(table)].Total; }
+    [[nodiscard]] inline uint64 GetMailRows() const { return _mailRows; }
+    [[nodiscard]] inline Milliseconds GetHistoryLoadMaxWait() const { return _historyLoad.MaxWait; }
+    [[nodiscard]] Milliseconds GetHistoryLoadAverageWait() const;
+
+    // Estimated memory of containers and arenas
+    [[nodiscard]] std::size_t GetTotalMemory() const;
+
+    void PrintStats(ChatHandler* handler) const;
+    void Reset();
+
+private:
+    std::array<UpdateTiming, static_cast<std::size_t>(MetricUpdate::Max)> _updateTimings{};
+    std::array<StatementCounter, static_cast<std::size_t>(MetricTable::Max)> _statements{};
+    std::array<ArenaStats, static_cast<std::size_t>(MetricArena::Max)> _arenas{};
+    HistoryCacheStats _historyCache{};
+    HistoryLoadStats _historyLoad{};
+    uint64 _mailRows{};
+    std::array<ContainerStats, static_cast<std::size_t>(MetricContainer::Max)> _containers{};
+    std::size_t _historyWithoutPlayer{};
+    std::size_t _memoryThreshold{};
+    bool _isOverMemoryThreshold{};
+    Milliseconds _minuteTimer{};
+};
+
+#define sORMetrics OnlineRewardMetrics::instance()
+
+// Adds the lifetime of the scope to update time of `update`
+class OnlineRewardUpdateTimer
+{
+public:
+    explicit OnlineRewardUpdateTimer(MetricUpdate update) :
+        _update(update), _start(std::chrono::steady_clock::now()) { }
+
+    ~OnlineRewardUpdateTimer()
+    {
+        sORMetrics->AddUpdateTime(_update, std::chrono::duration_cast<Microseconds>(std::chrono::steady_clock::now() - _start));
+    }
+
+    OnlineRewardUpdateTimer(OnlineRewardUpdateTimer const&) = delete;
+    OnlineRewardUpdateTimer& operator= (OnlineRewardUpdateTimer const&) = delete;
+
+private:
+    MetricUpdate _update;
+    TimePoint _start;
+};
+
+#endif
@@ -0,0 +1,439 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineReward.h"
+#include "DBCStores.h"
+#include "Log.h"
+#include "ObjectMgr.h"
+#include <filesystem>
+#include <fstream>
+
+/*
+ * Warm restart snapshot: compiled catalog and history of loaded players in one file.
+ *
+ * Layout, all values are little endian and have fixed size, there are no pointers or offsets,
+ * so the file can be read with one read or mapped as is:
+ *   header  - magic, version, history generation, catalog checksum, catalog rows count, payload size, payload FNV-1a
+ *   payload - rewards with conditions, items and reputations (faction id), then histories
+ *
+ * Snapshot is used only if generation and catalog checksum are the same as in storage.
+ * Generation is incremented by every history save, so any save after the write makes the file outdated.
+ */
+
+namespace
+{
+    constexpr uint32 SNAPSHOT_MAGIC         = 0x4E53524F; // "ORSN"
+    constexpr uint32 SNAPSHOT_VERSION       = 1;
+    constexpr std::size_t SNAPSHOT_HEADER_SIZE = 40;
+
+    uint64 GetFNV1aHash(uint8 const* data, std::size_t size)
+    {
+        uint64 hash{ 14695981039346656037ull };
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            hash ^= data[i];
+            hash *= 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    class SnapshotWriter
+    {
+    public:
+        template<typename T>
+        void Append(T value)
+        {
+            static_assert(std::is_integral_v<T>);
+
+            for (std::size_t i = 0; i < sizeof(T); ++i)
+                Data.emplace_back(static_cast<uint8>(static_cast<uint64>(value) >> (i * 8)));
+        }
+
+        void AppendBytes(std::vector<uint8> const& bytes)
+        {
+            Append<uint32>(bytes.size());
+            Data.insert(Data.end(), bytes.begin(), bytes.end());
+        }
+
+        std::vector<uint8> Data;
+    };
+
+    // Every read is checked, a broken file is never read out of bounds
+    class SnapshotReader
+    {
+    public:
+        SnapshotReader(uint8 const* data, std::size_t size) : _data(data), _size(size) { }
+
+        template<typename T>
+        bool Read(T& value)
+        {
+            static_assert(std::is_integral_v<T>);
+
+            if (_size - _pos < sizeof(T))
+                return false;
+
+            uint64 result{ 0 };
+
+            for (std::size_t i = 0; i < sizeof(T); ++i)
+                result |= static_cast<uint64>(_data[_pos + i]) << (i * 8);
+
+            value = static_cast<T>(result);
+            _pos += sizeof(T);
+            return true;
+        }
+
+        bool ReadBytes(std::vector<uint8>& bytes)
+        {
+            uint32 size{};
+            if (!Read(size) || _size - _pos < size)
+                return false;
+
+            bytes.assign(_data + _pos, _data + _pos + size);
+            _pos += size;
+            return true;
+        }
+
+        [[nodiscard]] bool IsEnd() const { return _pos == _size; }
+
+    private:
+        uint8 const* _data;
+        std::size_t _size;
+        std::size_t _pos{};
+    };
+}
+
+bool OnlineRewardMgr::LoadSnapshot()
+{
+    // Generation is needed for history saves even if snapshot is disabled
+    auto const state{ _storage->GetState() };
+    if (!state)
+        return false;
+
+    _historyGeneration = state->Generation;
+    auto const catalogCount{ state->CatalogCount };
+    auto const catalogChecksum{ state->CatalogChecksum };
+
+    if (!_isSnapshotEnable)
+        return false;
+
+    std::ifstream file(_snapshotFile, std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        LOG_INFO("module.or", "> OR Snapshot: File '{}' not found, load from DB", _snapshotFile);
+        return false;
+    }
+
+    std::vector<uint8> data{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+    SnapshotReader header(data.data(), std::min(data.size(), SNAPSHOT_HEADER_SIZE));
+    uint32 magic{}, version{}, fileCatalogCount{}, payloadSize{};
+    uint64 generation{}, fileCatalogChecksum{}, payloadChecksum{};
+
+    if (!header.Read(magic) || !header.Read(version) || !header.Read(generation) || !header.Read(fileCatalogChecksum) ||
+        !header.Read(fileCatalogCount) || !header.Read(payloadSize) || !header.Read(payloadChecksum) ||
+        magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION || payloadSize != data.size() - SNAPSHOT_HEADER_SIZE)
+    {
+        LOG_ERROR("module.or", "> OR Snapshot: File '{}' has wrong header, load from DB", _snapshotFile);
+        return false;
+    }
+
+    if (GetFNV1aHash(data.data() + SNAPSHOT_HEADER_SIZE, payloadSize) != payloadChecksum)
+    {
+        LOG_ERROR("module.or", "> OR Snapshot: File '{}' is damaged, load from DB", _snapshotFile);
+        return false;
+    }
+
+    if (generation != _historyGeneration || fileCatalogCount != catalogCount || fileCatalogChecksum != catalogChecksum)
+    {
+        LOG_INFO("module.or", "> OR Snapshot: File '{}' is outdated, load from DB", _snapshotFile);
+        return false;
+    }
+
+    LOG_INFO("module.or", "Loading online rewards from snapshot...");
+
+    SnapshotReader reader(data.data() + SNAPSHOT_HEADER_SIZE, payloadSize);
+
+    auto ReadRewards = [this, &reader]()
+    {
+        uint32 rewardsCount{};
+        if (!reader.Read(rewardsCount))
+            return false;
+
+        for (uint32 i = 0; i < rewardsCount; ++i)
+        {
+            uint32 id{}, seconds{}, zonesCount{}, mapsCount{}, itemsCount{}, reputationsCount{};
+            uint8 isPerOnline{};
+            OnlineRewardConditions conditions;
+
+            if (!reader.Read(id) || !reader.Read(isPerOnline) || !reader.Read(seconds) || !reader.Read(conditions.MinLevel) || !reader.Read(conditions.MaxLevel) ||
+                !reader.Read(conditions.ClassMask) || !reader.Read(conditions.RaceMask) || !reader.Read(conditions.MinSecurity) || !reader.Read(conditions.DayOfWeekMask))
+                return false;
+
+            if (!reader.Read(zonesCount))
+                return false;
+
+            for (uint32 zone = 0; zone < zonesCount; ++zone)
+                if (!reader.Read(conditions.Zones.emplace_back()))
+                    return false;
+
+            if (!reader.Read(mapsCount))
+                return false;
+
+            for (uint32 map = 0; map < mapsCount; ++map)
+                if (!reader.Read(conditions.Maps.emplace_back()))
+                    return false;
+
+            OnlineReward onlineReward(id, isPerOnline, Seconds(seconds), std::move(conditions));
+
+            if (!reader.Read(itemsCount))
+                return false;
+
+            for (uint32 item = 0; item < itemsCount; ++item)
+            {
+                auto& [itemID, itemCount] = onlineReward.Items.emplace_back();
+                if (!reader.Read(itemID) || !reader.Read(itemCount))
+                    return false;
+
+                // World DB can be changed between restarts
+                if (!sObjectMgr->GetItemTemplate(itemID))
+                    return false;
+            }
+
+            if (!reader.Read(reputationsCount))
+                return false;
+
+            for (uint32 reputation = 0; reputation < reputationsCount; ++reputation)
+            {
+                uint32 factionID{}, reputationCount{};
+                if (!reader.Read(factionID) || !reader.Read(reputationCount))
+                    return false;
+
+                FactionEntry const* factionEntry = sFactionStore.LookupEntry(factionID);
+                if (!factionEntry)
+                    return false;
+
+                onlineReward.Reputations.emplace_back(factionEntry, reputationCount);
+            }
+
+            _rewards.emplace(id, std::move(onlineReward));
+            _lastId = std::max<std::size_t>(_lastId, id);
+        }
+
+        return true;
+    };
+
+    auto ReadHistories = [this, &reader]()
+    {
+        uint32 historiesCount{};
+        if (!reader.Read(historiesCount))
+            return false;
+
+        for (uint32 i = 0; i < historiesCount; ++i)
+        {
+            ObjectGuid::LowType lowGuid{};
+            uint8 storageFormat{};
+            uint32 perTimeCount{};
+            std::vector<uint8> claims;
+
+            if (!reader.Read(lowGuid) || !reader.Read(storageFormat) || !reader.Read(perTimeCount))
+                return false;
+
+            RewardHistory history;
+
+            for (uint32 entry = 0; entry < perTimeCount; ++entry)
+            {
+                uint32 rewardID{}, seconds{};
+                if (!reader.Read(rewardID) || !reader.Read(seconds))
+                    return false;
+
+                history.PerTime.emplace_back(rewardID, Seconds(seconds));
+            }
+
+            if (!reader.ReadBytes(claims))
+                return false;
+
+            UnpackClaims(claims, history.Claimed);
+            history.StorageFormat = storageFormat;
+            AddDormantHistory(lowGuid, std::move(history));
+        }
+
+        return true;
+    };
+
+    _rewards.clear();
+    ClearDormantHistory();
+
+    if (!ReadRewards())
+    {
+        LOG_ERROR("module.or", "> OR Snapshot: Error at read rewards from '{}', load from DB", _snapshotFile);
+        _rewards.clear();
+        return false;
+    }
+
+    // Histories store claims by reward id, claim indexes are needed to read them
+    RebuildRewardIndex();
+
+    if (!ReadHistories() || !reader.IsEnd())
+    {
+        LOG_ERROR("module.or", "> OR Snapshot: Error at read history from '{}', load from DB", _snapshotFile);
+        _rewards.clear();
+        ClearDormantHistory();
+        RebuildRewardIndex();
+        return false;
+    }
+
+    if (_rewards.empty())
+        return false;
+
+    LOG_INFO("module.or", ">> Loaded {} online rewards and history of {} players from snapshot", _rewards.size(), _dormantHistory.size());
+    LOG_INFO("module.or", "");
+    return true;
+}
+
+void OnlineRewardMgr::OnShutdown()
+{
+    _eligibilityPool.Stop();
+
+    if (!_isEnable)
+        return;
+
+    // Changes of due check since the last full pass
+    SaveRewardHistoryToDB();
+
+    if (!_isSnapshotEnable)
+        return;
+
+    if (auto const state = _storage->GetState())
+        WriteSnapshot(state->CatalogCount, state->CatalogChecksum);
+}
+
+void OnlineRewardMgr::SaveSnapshotAsync()
+{
+    // Catalog checksum is taken from storage, memory can't be older than storage so a race only makes the file outdated
+    _storage->GetStateAsync([this](std::optional<OnlineRewardStorageState> state)
+    {
+        if (state)
+            WriteSnapshot(state->CatalogCount, state->CatalogChecksum);
+    });
+}
+
+void OnlineRewardMgr::WriteSnapshot(uint32 catalogCount, uint64 catalogChecksum)
+{
+    SnapshotWriter payload;
+
+    payload.Append<uint32>(_rewards.size());
+
+    for (auto const& [id, onlineReward] : _rewards)
+    {
+        auto const& conditions{ onlineReward.Conditions };
+
+        payload.Append<uint32>(id);
+        payload.Append<uint8>(onlineReward.IsPerOnline);
+        payload.Append<uint32>(onlineReward.RewardTime.count());
+        payload.Append(conditions.MinLevel);
+        payload.Append(conditions.MaxLevel);
+        payload.Append(conditions.ClassMask);
+        payload.Append(conditions.RaceMask);
+        payload.Append(conditions.MinSecurity);
+        payload.Append(conditions.DayOfWeekMask);
+
+        payload.Append<uint32>(conditions.Zones.size());
+        for (auto zoneID : conditions.Zones)
+            payload.Append(zoneID);
+
+        payload.Append<uint32>(conditions.Maps.size());
+        for (auto mapID : conditions.Maps)
+            payload.Append(mapID);
+
+        payload.Append<uint32>(onlineReward.Items.size());
+        for (auto const& [itemID, itemCount] : onlineReward.Items)
+        {
+            payload.Append(itemID);
+            payload.Append(itemCount);
+        }
+
+        payload.Append<uint32>(onlineReward.Reputations.size());
+        for (auto const& [factionEntry, reputation] : onlineReward.Reputations)
+        {
+            payload.Append<uint32>(factionEntry->ID);
+            payload.Append(reputation);
+        }
+    }
+
+    payload.Append<uint32>(_rewardHistory.size() + _dormantHistory.size());
+
+    ForEachHistory([this, &payload](ObjectGuid::LowType lowGuid, RewardHistory const& history)
+    {
+        payload.Append<uint32>(lowGuid);
+        payload.Append(history.StorageFormat);
+        payload.Append<uint32>(history.PerTime.size());
+
+        for (auto const& [rewardID, seconds] : history.PerTime)
+        {
+            payload.Append(rewardID);
+            payload.Append<uint32>(seconds.count());
+        }
+
+        payload.AppendBytes(PackClaims(history.Claimed));
+    });
+
+    SnapshotWriter header;
+    header.Append(SNAPSHOT_MAGIC);
+    header.Append(SNAPSHOT_VERSION);
+    header.Append(_historyGeneration);
+    header.Append(catalogChecksum);
+    header.Append(catalogCount);
+    header.Append<uint32>(payload.Data.size());
+    header.Append(GetFNV1aHash(payload.Data.data(), payload.Data.size()));
+
+    ASSERT(header.Data.size() == SNAPSHOT_HEADER_SIZE);
+
+    // Written to temp file and renamed, the old snapshot stays valid if the server stops in the middle
+    std::string const tempFile{ _snapshotFile + ".tmp" };
+
+    {
+        std::ofstream file(tempFile, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            LOG_ERROR("module.or", "> OR Snapshot: Can't open file '{}' for write", tempFile);
+            return;
+        }
+
+        file.write(reinterpret_cast<char const*>(header.Data.data()), header.Data.size());
+        file.write(reinterpret_cast<char const*>(payload.Data.data()), payload.Data.size());
+
+        if (!file)
+        {
+            LOG_ERROR("module.or", "> OR Snapshot: Error at write file '{}'", tempFile);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempFile, _snapshotFile, error);
+
+    if (error)
+    {
+        LOG_ERROR("module.or", "> OR Snapshot: Can't rename '{}' to '{}': {}", tempFile, _snapshotFile, error.message());
+        return;
+    }
+
+    LOG_DEBUG("module.or", "> OR Snapshot: Written {} rewards and history of {} players to '{}'", _rewards.size(),
+        _rewardHistory.size() + _dormantHistory.size(), _snapshotFile);
+}
@@ -0,0 +1,496 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "OnlineReward.h"
+#include "Chat.h"
+#include "ContainerHelpers.h"
+#include "ExternalMail.h"
+#include "Log.h"
+#include "OnlineRewardMetrics.h"
+#include "StringConvert.h"
+#include "StringFormat.h"
+#include "World.h"
+#include <array>
+#include <fstream>
+
+/*
+ * Soak run: synthetic sessions log in, play, level up and log out while the full pass and due check run as usual.
+ *
+ * Sessions use reserved guids from `SOAK_FIRST_GUID`, 2 * players of them, on any storage backend. Their history is seeded
+ * in storage before the start and removed after the end. Played time runs `OR.Soak.TimeScale` times faster than real time,
+ * so a short run covers many rewards. Items go to synthetic bags and the rest to `mail_external` rows, which ExternalMail
+ * deletes without a mail. The count of online sessions stays the same, every logout is replaced by a login of an offline guid.
+ *
+ * At the end results are written to `OR.Soak.ResultFile` as `Key = Value` lines and compared with `OR.Soak.BaselineFile`.
+ * The run fails without a baseline, or if a compared value is over the baseline by `OR.Soak.MaxRegression` percent.
+ */
+
+namespace
+{
+    constexpr Seconds SOAK_UPDATE_INTERVAL = 1s;
+    constexpr Seconds SOAK_MAX_PLAYED_TIME = 500h;
+    constexpr uint32 SOAK_AFK_LOGIN_CHANCE = 10;
+    constexpr uint32 SOAK_MAX_FREE_SLOTS = 40;
+    constexpr uint8 SOAK_MAX_LEVEL = 80;
+
+    enum class SoakCompare : uint8
+    {
+        None,
+        Equal,  // Setting of the run, other value is not comparable
+        Limit   // Lower is better, up to `OR.Soak.MaxRegression` percent over the baseline
+    };
+
+    struct SoakResult
+    {
+        std::string_view Key;
+        uint64 Value{};
+        SoakCompare Compare{};
+    };
+
+    bool IsSoakGuid(ObjectGuid::LowType lowGuid)
+    {
+        return lowGuid >= SOAK_FIRST_GUID && lowGuid < SOAK_FIRST_GUID + SOAK_MAX_GUIDS;
+    }
+
+    std::unordered_map<std::string, uint64> ReadSoakFile(std::string const& fileName)
+    {
+        std::unordered_map<std::string, uint64> values;
+        std::ifstream file(fileName);
+        std::string line;
+
+        while (std::getline(file, line))
+        {
+            auto const separator{ line.find(" = ") };
+            if (separator == std::string::npos)
+                continue;
+
+            if (auto value = Acore::StringTo<uint64>(std::string_view(line).substr(separator + 3)))
+                values.emplace(line.substr(0, separator), *value);
+        }
+
+        return values;
+    }
+
+    bool WriteSoakFile(std::string const& fileName, std::span<SoakResult const> results)
+    {
+        std::ofstream file(fileName, std::ios::out | std::ios::trunc);
+
+        for (auto const& result : results)
+            file << result.Key << " = " << result.Value << '\n';
+
+        return file.good();
+    }
+}
+
+bool OnlineRewardMgr::StartSoak(uint32 players, Minutes duration, ChatHandler* handler /*= nullptr*/)
+{
+    auto Fail = [handler](std::string_view message)
+    {
+        LOG_ERROR("module.or", "> OR Soak: {}", message);
+
+        if (handler)
+            handler->SendSysMessage(Acore::StringFormatFmt("> {}", message));
+
+        return false;
+    };
+
+    if (!_isEnable)
+        return Fail("Module is disabled");
+
+    if (_soak)
+        return Fail("Soak run is in progress");
+
+    if (!players || players > SOAK_MAX_GUIDS / 2)
+        return Fail(Acore::StringFormatFmt("Count of players must be from 1 to {}", SOAK_MAX_GUIDS / 2));
+
+    // Polls of this server wait for the claim check, mail rows would not be sent
+    if (sExternalMail->IsClaimCheckRunning())
+        return Fail("Mail claim check is in progress");
+
+    // Results of real players would be mixed with synthetic ones
+    if (sWorld->GetPlayerCount())
+        return Fail("Soak run needs a server without players");
+
+    _soak = std::make_unique<SoakRun>();
+    _soak->Players = players;
+    _soak->Duration = duration;
+    _soak->Random.seed(players);
+
+    // Twice more characters than sessions, logged out ones come back later with history in cache or storage.
+    // Every save writes claims, like the first save after login
+    auto const rewards{ _storage->LoadRewards() };
+    std::uniform_int_distribution<uint32> playedTime(0, static_cast<uint32>(SOAK_MAX_PLAYED_TIME.count()));
+    std::vector<OnlineRewardStoredHistory> histories;
+    histories.reserve(players * 2);
+
+    for (ObjectGuid::LowType lowGuid = SOAK_FIRST_GUID; lowGuid < SOAK_FIRST_GUID + players * 2; ++lowGuid)
+    {
+        Seconds const played{ playedTime(_soak->Random) };
+
+        auto& history = histories.emplace_back(MakeSeedHistory(lowGuid, played, rewards));
+        history.Format = _storage->GetFormat();
+        history.IsClaimedChanged = true;
+
+        _soak->Offline.emplace_back(lowGuid);
+        _soak->PlayedTime.emplace(lowGuid, played);
+    }
+
+    // Rows can be left by a run stopped with the server
+    _storage->ResetTestHistory(SOAK_FIRST_GUID, SOAK_FIRST_GUID + SOAK_MAX_GUIDS - 1, histories, [this, soak = _soak.get()](bool success)
+    {
+        if (_soak.get() != soak)
+            return;
+
+        if (!success)
+        {
+            LOG_ERROR("module.or", "> OR Soak: Can't reset history of guids from {}, run is stopped", SOAK_FIRST_GUID);
+            _soak.reset();
+            return;
+        }
+
+        BeginSoak();
+    });
+
+    LOG_INFO("module.or", "> OR Soak: Seeding history of {} guids from {}", players * 2, SOAK_FIRST_GUID);
+
+    if (handler)
+        handler->SendSysMessage(Acore::StringFormatFmt("> Soak run with {} players for {} minutes starts after history is seeded, results are written to '{}'",
+            players, duration.count(), _soakResultFile));
+
+    return true;
+}
+
+void OnlineRewardMgr::BeginSoak()
+{
+    auto const now{ std::chrono::steady_clock::now() };
+
+    // Statements of the seeding are not counted
+    sORMetrics->Reset();
+
+    _soak->IsStarted = true;
+    _soak->Start = now;
+    _soak->NextUpdate = now + SOAK_UPDATE_INTERVAL;
+    _soak->StartGeneration = _historyGeneration;
+
+    sExternalMail->SetTestMailsCallback([this](std::span<uint32 const> ids)
+    {
+        if (_soak)
+            _soak->MailRowsSent += ids.size();
+    });
+
+    // Login wave like after restart
+    for (uint32 i = 0; i < _soak->Players; ++i)
+        LoginSoakPlayer(now);
+
+    LOG_INFO("module.or", "> OR Soak: Started with {} players for {} minutes, played time x{}", _soak->Players, _soak->Duration.count(), _soakTimeScale);
+}
+
+void OnlineRewardMgr::StopSoak()
+{
+    if (!_soak)
+        return;
+
+    ClearSoak();
+    LOG_INFO("module.or", "> OR Soak: Stopped, results are not written");
+}
+
+void OnlineRewardMgr::UpdateSoak()
+{
+    auto const now{ std::chrono::steady_clock::now() };
+    if (!_soak->IsStarted || now < _soak->NextUpdate)
+        return;
+
+    _soak->NextUpdate = now + SOAK_UPDATE_INTERVAL;
+
+    if (now >= _soak->Start + _soak->Duration)
+    {
+        FinishSoak();
+        return;
+    }
+
+    // Rates are per played hour, one update is `_soakTimeScale` played intervals
+    double const playedHours{ std::chrono::duration<double, std::ratio<3600>>(SOAK_UPDATE_INTERVAL * _soakTimeScale).count() };
+    std::bernoulli_distribution afkChange(std::min(1.0, _soakAfkChangesPerHour * playedHours));
+    std::bernoulli_distribution levelUp(std::min(1.0, _soakLevelUpsPerHour * playedHours));
+
+    std::vector<ObjectGuid::LowType> logouts;
+
+    for (auto& [lowGuid, soakPlayer] : _soak->Online)
+    {
+        if (soakPlayer.LogoutTime <= now)
+        {
+            logouts.emplace_back(lowGuid);
+            continue;
+        }
+
+        // Same event as `CheckAfkChange` of real player
+        if (_skipAfkPlayers && afkChange(_soak->Random))
+        {
+            AddRewardDueEvent(lowGuid, soakPlayer.IsAfk);
+            soakPlayer.IsAfk = !soakPlayer.IsAfk;
+        }
+
+        // Same event as level change of real player
+        if (soakPlayer.Level < SOAK_MAX_LEVEL && levelUp(_soak->Random))
+        {
+            ++soakPlayer.Level;
+            ++_soak->LevelUps;
+            AddRewardDueEvent(lowGuid);
+        }
+    }
+
+    for (auto lowGuid : logouts)
+        LogoutSoakPlayer(lowGuid, now);
+
+    for (std::size_t i = 0; i < logouts.size(); ++i)
+        LoginSoakPlayer(now);
+
+    _soak->MaxMemory = std::max(_soak->MaxMemory, sORMetrics->GetTotalMemory());
+}
+
+void OnlineRewardMgr::LoginSoakPlayer(TimePoint now)
+{
+    if (_soak->Offline.empty())
+        return;
+
+    // Random offline guid, so some of them are in history cache and some are loaded from storage
+    auto& offline{ _soak->Offline };
+    std::swap(offline[std::uniform_int_distribution<std::size_t>(0, offline.size() - 1)(_soak->Random)], offline.back());
+
+    ObjectGuid::LowType const lowGuid{ offline.back() };
+    offline.pop_back();
+
+    // Session length is played time
+    auto const sessionTime{ std::chrono::duration_cast<Seconds>(_soakSessionTime).count() };
+    Seconds const sessionPlayed{ std::uniform_int_distribution<int64>(60, std::max<int64>(60, sessionTime * 2))(_soak->Random) };
+
+    auto& soakPlayer = _soak->Online[lowGuid];
+    soakPlayer.RemoteAddress = Acore::StringFormatFmt("10.{}.{}.{}", (lowGuid >> 16) & 0xFF, (lowGuid >> 8) & 0xFF, lowGuid & 0xFF);
+    soakPlayer.LoginTime = now;
+    soakPlayer.LogoutTime = now + GetSoakRealTime(sessionPlayed);
+    soakPlayer.Level = static_cast<uint8>(std::uniform_int_distribution<uint32>(1, SOAK_MAX_LEVEL)(_soak->Random));
+    soakPlayer.ClassMask = 1 << std::uniform_int_distribution<uint32>(0, 10)(_soak->Random);
+    soakPlayer.RaceMask = 1 << std::uniform_int_distribution<uint32>(0, 10)(_soak->Random);
+    soakPlayer.FreeSlots = std::uniform_int_distribution<uint32>(0, SOAK_MAX_FREE_SLOTS)(_soak->Random);
+    soakPlayer.IsAfk = std::uniform_int_distribution<uint32>(1, SOAK_AFK_LOGIN_CHANCE)(_soak->Random) == 1;
+
+    ++_soak->Logins;
+    AddRewardHistory(lowGuid, _soak->PlayedTime[lowGuid]);
+}
+
+void OnlineRewardMgr::LogoutSoakPlayer(ObjectGuid::LowType lowGuid, TimePoint now)
+{
+    auto itr = _soak->Online.find(lowGuid);
+    if (itr == _soak->Online.end())
+        return;
+
+    _soak->PlayedTime[lowGuid] = GetSoakPlayedTime(lowGuid, itr->second, now);
+    _soak->Online.erase(itr);
+    _soak->Offline.emplace_back(lowGuid);
+
+    DeleteRewardHistory(lowGuid);
+}
+
+Seconds OnlineRewardMgr::GetSoakPlayedTime(ObjectGuid::LowType lowGuid, SoakPlayer const& soakPlayer, TimePoint now) const
+{
+    auto const played{ Acore::Containers::MapGetValuePtr(_soak->PlayedTime, lowGuid) };
+    return (played ? *played : 0s) + std::chrono::duration_cast<Seconds>((now - soakPlayer.LoginTime) * _soakTimeScale);
+}
+
+Milliseconds OnlineRewardMgr::GetSoakRealTime(Seconds playedTime) const
+{
+    return std::chrono::duration_cast<Milliseconds>(playedTime) / _soakTimeScale;
+}
+
+bool OnlineRewardMgr::IsSoakPlayer(ObjectGuid::LowType lowGuid) const
+{
+    return _soak && _soak->Online.contains(lowGuid);
+}
+
+bool OnlineRewardMgr::AddSoakSnapshot(ObjectGuid::LowType lowGuid, bool isDue)
+{
+    auto soakPlayer = Acore::Containers::MapGetValuePtr(_soak->Online, lowGuid);
+    if (!soakPlayer)
+        return false;
+
+    auto history = _rewardHistory.find(lowGuid);
+    if (history == _rewardHistory.end())
+        return false;
+
+    auto& snapshot = _playerSnapshots.emplace_back();
+    snapshot.LowGuid = lowGuid;
+    snapshot.Level = soakPlayer->Level;
+    snapshot.ClassMask = soakPlayer->ClassMask;
+    snapshot.RaceMask = soakPlayer->RaceMask;
+    snapshot.PlayedTime = GetSoakPlayedTime(lowGuid, *soakPlayer, std::chrono::steady_clock::now());
+    snapshot.IsAfk = soakPlayer->IsAfk;
+    snapshot.IsDue = isDue;
+    snapshot.RemoteAddress = soakPlayer->RemoteAddress;
+    snapshot.History = &history->second;
+    return true;
+}
+
+void OnlineRewardMgr::AddSoakPass(bool isFullPass, TimePoint start)
+{
+    if (!_soak->IsStarted)
+        return;
+
+    auto const time{ std::chrono::duration_cast<Microseconds>(std::chrono::steady_clock::now() - start) };
+    auto& timing{ isFullPass ? _soak->FullPass : _soak->DuePass };
+
+    ++timing.Count;
+    timing.Total += time;
+    timing.Max = std::max(timing.Max, time);
+
+    uint64 allocations{ _tickArena.GetLastAllocations() };
+    for (auto const& arena : _partitionArenas)
+        allocations += arena->GetLastAllocations();
+
+    _soak->MaxTickAllocations = std::max(_soak->MaxTickAllocations, allocations);
+
+    if (isFullPass)
+        _soak->PlayersChecked += _soak->Online.size();
+}
+
+void OnlineRewardMgr::FinishSoak()
+{
+    auto const now{ std::chrono::steady_clock::now() };
+    auto const minutes{ std::max<uint64>(1, std::chrono::duration_cast<Minutes>(now - _soak->Start).count()) };
+
+    auto Average = [](SoakTiming const& timing) -> uint64 { return timing.Count ? timing.Total.count() / timing.Count : 0; };
+    auto PerMinute = [minutes](MetricTable table) -> uint64 { return sORMetrics->GetStatementsTotal(table) / minutes; };
+
+    // Delivery to full bags is checked separately, soak players rarely have them
+    uint64 const deliveryCheckFailures{ RunItemDeliveryChecks() };
+    bool const isMySQLStorage{ dynamic_cast<OnlineRewardMySQLStorage*>(_storage.get()) != nullptr };
+
+    std::array<SoakResult, 25> const results
+    {{
+        { "Players",                        _soak->Players,                                                         SoakCompare::Equal },
+        { "Minutes",                        static_cast<uint64>(_soak->Duration.count()),                           SoakCompare::Equal },
+        { "TimeScale",                      _soakTimeScale,                                                         SoakCompare::Equal },
+        { "AfkChangesPerHour",              _soakAfkChangesPerHour,                                                 SoakCompare::Equal },
+        { "LevelUpsPerHour",                _soakLevelUpsPerHour,                                                   SoakCompare::Equal },
+        { "MySQLStorage",                   isMySQLStorage,                                                         SoakCompare::Equal },
+        { "Logins",                         _soak->Logins,                                                          SoakCompare::None },
+        { "LevelUps",                       _soak->LevelUps,                                                        SoakCompare::None },
+        { "RewardsGranted",                 _soak->RewardsGranted,                                                  SoakCompare::None },
+        { "MailRowsAdded",                  _soak->MailRowsAdded,                                                   SoakCompare::None },
+        { "MailRowsSent",                   _soak->MailRowsSent,                                                    SoakCompare::None },
+        { "FullPassAvgUs",                  Average(_soak->FullPass),                                               SoakCompare::Limit },
+        { "FullPassMaxUs",                  static_cast<uint64>(_soak->FullPass.Max.count()),                       SoakCompare::Limit },
+        { "FullPassPerPlayerNs",            _soak->PlayersChecked ? _soak->FullPass.Total.count() * 1000 / _soak->PlayersChecked : 0, SoakCompare::Limit },
+        { "DuePassAvgUs",                   Average(_soak->DuePass),                                                SoakCompare::Limit },
+        { "DuePassMaxUs",                   static_cast<uint64>(_soak->DuePass.Max.count()),                        SoakCompare::Limit },
+        { "TickAllocationsMax",             _soak->MaxTickAllocations,                                              SoakCompare::Limit },
+        { "MemoryPerPlayerBytes",           _soak->MaxMemory / _soak->Players,                                      SoakCompare::Limit },
+        { "HistoryLoadAvgWaitMs",           static_cast<uint64>(sORMetrics->GetHistoryLoadAverageWait().count()),   SoakCompare::Limit },
+        { "HistoryLoadMaxWaitMs",           static_cast<uint64>(sORMetrics->GetHistoryLoadMaxWait().count()),       SoakCompare::Limit },
+        { "HistorySavesPerHour",            (_historyGeneration - _soak->StartGeneration) * 60 / minutes,           SoakCompare::Limit },
+        { "StatementsPerMinuteHistory",     PerMinute(MetricTable::History),                                        SoakCompare::Limit },
+        { "StatementsPerMinuteMailExternal", PerMinute(MetricTable::MailExternal),                                  SoakCompare::Limit },
+        { "StatementsPerMinuteStats",       PerMinute(MetricTable::Stats),                                          SoakCompare::Limit },
+        { "DeliveryCheckFailures",          deliveryCheckFailures,                                                  SoakCompare::None },
+    }};
+
+    ClearSoak();
+
+    for (auto const& result : results)
+        LOG_INFO("module.or", "> OR Soak: {} = {}", result.Key, result.Value);
+
+    if (!WriteSoakFile(_soakResultFile, results))
+        LOG_ERROR("module.or", "> OR Soak: Can't write results to '{}'", _soakResultFile);
+
+    auto const baseline{ ReadSoakFile(_soakBaselineFile) };
+    bool isFailed{ deliveryCheckFailures > 0 };
+
+    // Baseline is a copy of results of a known good build, a run without it proves nothing
+    if (baseline.empty())
+    {
+        LOG_ERROR("module.or", "> OR Soak: Baseline '{}' is missing, copy '{}' of a known good build to it", _soakBaselineFile, _soakResultFile);
+        isFailed = true;
+    }
+
+    for (auto const& result : results)
+    {
+        if (baseline.empty() || result.Compare == SoakCompare::None)
+            continue;
+
+        auto const baselineValue{ Acore::Containers::MapGetValuePtr(baseline, std::string(result.Key)) };
+
+        if (result.Compare == SoakCompare::Equal)
+        {
+            if (!baselineValue || *baselineValue != result.Value)
+            {
+                LOG_ERROR("module.or", "> OR Soak: {} is {}, baseline has {}", result.Key, result.Value, baselineValue ? Acore::ToString(*baselineValue) : "none");
+                isFailed = true;
+            }
+
+            continue;
+        }
+
+        if (!baselineValue)
+            continue;
+
+        uint64 const limit{ *baselineValue + *baselineValue * _soakMaxRegression / 100 };
+        if (result.Value <= limit)
+            continue;
+
+        LOG_ERROR("module.or", "> OR Soak: {} regressed to {}, baseline {}, limit {}", result.Key, result.Value, *baselineValue, limit);
+        isFailed = true;
+    }
+
+    LOG_INFO("module.or", "> OR Soak: {} against '{}'", isFailed ? "FAILED" : "PASSED", _soakBaselineFile);
+
+    // Exit code tells the result to the script which started the server
+    if (_isSoakShutdown)
+        sWorld->ShutdownServ(1, 0, isFailed ? ERROR_EXIT_CODE : SHUTDOWN_EXIT_CODE, "Soak run is finished");
+}
+
+void OnlineRewardMgr::ClearSoak()
+{
+    auto const now{ std::chrono::steady_clock::now() };
+
+    while (!_soak->Online.empty())
+        LogoutSoakPlayer(_soak->Online.begin()->first, now);
+
+    // History of synthetic players is not saved after the run, their rows are removed below
+    std::erase_if(_unsavedDormant, IsSoakGuid);
+
+    for (auto itr = _dormantHistory.begin(); itr != _dormantHistory.end();)
+    {
+        if (!IsSoakGuid(itr->first))
+        {
+            ++itr;
+            continue;
+        }
+
+        _dormantMemory -= itr->second.Memory;
+        itr = _dormantHistory.erase(itr);
+    }
+
+    sORMetrics->SetHistoryCacheStats(_dormantHistory.size(), _dormantMemory);
+    sExternalMail->SetTestMailsCallback({});
+
+    // Saves of the last full pass are queued before it. Mail rows left in `mail_external` are deleted by ExternalMail later
+    _storage->ResetTestHistory(SOAK_FIRST_GUID, SOAK_FIRST_GUID + SOAK_MAX_GUIDS - 1, {}, [](bool success)
+    {
+        if (!success)
+            LOG_ERROR("module.or", "> OR Soak: Can't remove history of guids from {}, it's removed at the next run", SOAK_FIRST_GUID);
+    });
+
+    _soak.reset();
+}
@@ -0,0 +1,993 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineRewardStorage.h"
+#include "Common.h"
+#include "Config.h"
+#include "DatabaseEnv.h"
+#include "Log.h"
+#include "OnlineRewardMetrics.h"
+#include "OnlineRewardTrace.h"
+#include "StringConvert.h"
+#include "StringFormat.h"
+#include "Util.h"
+#include <array>
+#include <random>
+#include <unordered_set>
+
+namespace
+{
+    // Formats of history, `OnlineRewardStoredHistory::Format`. Archived history is moved back to the live tables at next save
+    constexpr uint8 HISTORY_FORMAT_ROWS             = 0;
+    constexpr uint8 HISTORY_FORMAT_PACKED           = 1;
+    constexpr uint8 HISTORY_FORMAT_ROWS_ARCHIVE     = 2;
+    constexpr uint8 HISTORY_FORMAT_PACKED_ARCHIVE   = 3;
+
+    // Packed history: `Data` is a list of (reward id, rewarded seconds) as little endian uint32
+    constexpr uint8 HISTORY_PACKED_VERSION          = 1;
+    constexpr std::size_t HISTORY_PACKED_ENTRY_SIZE = 8;
+    constexpr std::size_t HISTORY_PACKED_CHUNK_SIZE = 500;
+
+    // Generation of history and checksum of catalog, compared with snapshot header
+    constexpr std::string_view STORAGE_STATE_QUERY = "SELECT (SELECT `Generation` FROM `wh_online_rewards_snapshot` WHERE `ID` = 1), COUNT(*), "
+        "CAST(COALESCE(SUM(CRC32(CONCAT_WS(':', `ID`, `IsPerOnline`, `Seconds`, `MinLevel`, `MaxLevel`, `ClassMask`, `RaceMask`, `Zones`, `Maps`, "
+        "`MinSecurity`, `DayOfWeekMask`, `Items`, `Reputations`))), 0) AS UNSIGNED) FROM `wh_online_rewards`";
+
+    void AppendUInt32(std::vector<uint8>& data, uint32 value)
+    {
+        for (uint8 i = 0; i < 4; ++i)
+            data.emplace_back(static_cast<uint8>(value >> (i * 8)));
+    }
+
+    std::vector<uint8> PackPerTime(std::vector<std::pair<uint32, Seconds>> const& perTime)
+    {
+        std::vector<uint8> data;
+        data.reserve(perTime.size() * HISTORY_PACKED_ENTRY_SIZE);
+
+        for (auto const& [rewardID, seconds] : perTime)
+        {
+            AppendUInt32(data, rewardID);
+            AppendUInt32(data, static_cast<uint32>(seconds.count()));
+        }
+
+        return data;
+    }
+
+    uint32 ReadUInt32(std::vector<uint8> const& data, std::size_t pos)
+    {
+        uint32 value{ 0 };
+
+        for (uint8 i = 0; i < 4; ++i)
+            value |= static_cast<uint32>(data[pos + i]) << (i * 8);
+
+        return value;
+    }
+
+    std::string EscapeText(std::string_view text)
+    {
+        std::string escaped{ text };
+        CharacterDatabase.EscapeString(escaped);
+        return escaped;
+    }
+
+    // Claimed one-shot rewards come as an extra row with RewardID 0
+    void ParseHistoryRow(Field* fields, OnlineRewardStoredHistory& history)
+    {
+        auto rewardID = fields[0].Get<uint32>();
+        if (!rewardID)
+        {
+            history.Claimed = fields[2].Get<Binary>();
+            return;
+        }
+
+        history.PerTime.emplace_back(rewardID, fields[1].Get<Seconds>());
+    }
+
+    bool ParseHistoryPacked(Field* fields, OnlineRewardStoredHistory& history)
+    {
+        if (fields[0].Get<uint8>() != HISTORY_PACKED_VERSION)
+            return false;
+
+        auto const& data{ fields[1].Get<Binary>() };
+
+        for (std::size_t pos = 0; pos + HISTORY_PACKED_ENTRY_SIZE <= data.size(); pos += HISTORY_PACKED_ENTRY_SIZE)
+            history.PerTime.emplace_back(ReadUInt32(data, pos), Seconds(ReadUInt32(data, pos + 4)));
+
+        history.Claimed = fields[2].Get<Binary>();
+        return true;
+    }
+
+    bool IsPackedFormat(uint8 format)
+    {
+        return format == HISTORY_FORMAT_PACKED || format == HISTORY_FORMAT_PACKED_ARCHIVE;
+    }
+
+    std::string GetHistoryQuery(uint8 format, ObjectGuid::LowType lowGuid)
+    {
+        switch (format)
+        {
+            case HISTORY_FORMAT_PACKED:
+                return Acore::StringFormatFmt("SELECT `Version`, `Data`, `Claimed` FROM `wh_online_rewards_history_packed` WHERE `PlayerGuid` = {}", lowGuid);
+            case HISTORY_FORMAT_PACKED_ARCHIVE:
+                return Acore::StringFormatFmt("SELECT `Version`, `Data`, `Claimed` FROM `wh_online_rewards_history_packed_archive` WHERE `PlayerGuid` = {}", lowGuid);
+            case HISTORY_FORMAT_ROWS_ARCHIVE:
+                return Acore::StringFormatFmt("SELECT `RewardID`, `RewardedSeconds`, NULL FROM `wh_online_rewards_history_archive` WHERE `PlayerGuid` = {0} "
+                    "UNION ALL SELECT 0, 0, `Claimed` FROM `wh_online_rewards_claimed_archive` WHERE `PlayerGuid` = {0}", lowGuid);
+            default:
+                return Acore::StringFormatFmt("SELECT `RewardID`, `RewardedSeconds`, NULL FROM `wh_online_rewards_history` WHERE `PlayerGuid` = {0} "
+                    "UNION ALL SELECT 0, 0, `Claimed` FROM `wh_online_rewards_claimed` WHERE `PlayerGuid` = {0}", lowGuid);
+        }
+    }
+
+    // Removes history of players from all places except `format`, the player is saved in `format` in the same transaction
+    void DeleteHistoryExcept(CharacterDatabaseTransaction trans, uint8 format, std::string_view guids)
+    {
+        if (format != HISTORY_FORMAT_ROWS)
+        {
+            trans->Append("DELETE FROM `wh_online_rewards_history` WHERE `PlayerGuid` IN ({})", guids);
+            trans->Append("DELETE FROM `wh_online_rewards_claimed` WHERE `PlayerGuid` IN ({})", guids);
+        }
+
+        if (format != HISTORY_FORMAT_PACKED)
+            trans->Append("DELETE FROM `wh_online_rewards_history_packed` WHERE `PlayerGuid` IN ({})", guids);
+
+        trans->Append("DELETE FROM `wh_online_rewards_history_archive` WHERE `PlayerGuid` IN ({})", guids);
+        trans->Append("DELETE FROM `wh_online_rewards_claimed_archive` WHERE `PlayerGuid` IN ({})", guids);
+        trans->Append("DELETE FROM `wh_online_rewards_history_packed_archive` WHERE `PlayerGuid` IN ({})", guids);
+    }
+
+    bool IsOnceReward(std::unordered_map<uint32, bool> const& rewardIds, uint32 id)
+    {
+        auto itr = rewardIds.find(id);
+        return itr != rewardIds.end() && itr->second;
+    }
+
+    std::string GetGuidRange(ObjectGuid::LowType firstGuid, ObjectGuid::LowType lastGuid)
+    {
+        return Acore::StringFormatFmt("`PlayerGuid` BETWEEN {} AND {}", firstGuid, lastGuid);
+    }
+
+    std::string GetBenchmarkRange()
+    {
+        return GetGuidRange(HISTORY_BENCH_FIRST_GUID, HISTORY_BENCH_FIRST_GUID + HISTORY_BENCH_MAX_PLAYERS - 1);
+    }
+
+    std::optional<OnlineRewardStorageState> MakeState(QueryResult const& result)
+    {
+        if (!result)
+            return std::nullopt;
+
+        auto fields = result->Fetch();
+        return OnlineRewardStorageState{ fields[0].Get<uint64>(), fields[1].Get<uint32>(), fields[2].Get<uint64>() };
+    }
+}
+
+OnlineRewardStoredHistory MakeSeedHistory(ObjectGuid::LowType lowGuid, Seconds played, std::span<OnlineRewardStoredReward const> rewards)
+{
+    OnlineRewardStoredHistory history;
+    history.PlayerGuid = lowGuid;
+
+    for (auto const& reward : rewards)
+    {
+        Seconds const rewardTime{ reward.RewardTime };
+        if (rewardTime <= 0s || played < rewardTime)
+            continue;
+
+        if (!reward.IsPerOnline)
+        {
+            history.PerTime.emplace_back(reward.ID, played - played % rewardTime);
+            continue;
+        }
+
+        if (reward.ID / 8 >= history.Claimed.size())
+            history.Claimed.resize(reward.ID / 8 + 1);
+
+        history.Claimed[reward.ID / 8] |= uint8(1) << (reward.ID % 8);
+    }
+
+    return history;
+}
+
+uint64 RemoveOrphanClaims(std::vector<uint8>& claimed, std::function<bool(uint32)> const& isOnceReward)
+{
+    uint64 cleared{ 0 };
+
+    for (std::size_t byte = 0; byte < claimed.size(); ++byte)
+    {
+        for (uint8 bit = 0; bit < 8; ++bit)
+        {
+            uint8 const mask = uint8(1) << bit;
+            if (!(claimed[byte] & mask) || isOnceReward(static_cast<uint32>(byte * 8 + bit)))
+                continue;
+
+            claimed[byte] &= ~mask;
+            ++cleared;
+        }
+    }
+
+    return cleared;
+}
+
+std::unique_ptr<OnlineRewardStorage> OnlineRewardStorage::Create(std::string_view backend)
+{
+    if (StringEqualI(backend, "memory"))
+        return std::make_unique<OnlineRewardMemoryStorage>();
+
+    if (!StringEqualI(backend, "mysql"))
+        LOG_ERROR("module.or", "> OR: Unknown storage backend '{}', use mysql", backend);
+
+    return std::make_unique<OnlineRewardMySQLStorage>();
+}
+
+void OnlineRewardMySQLStorage::LoadConfig()
+{
+    _isPackedHistory = sConfigMgr->GetOption<bool>("OR.History.PackedFormat.Enable", false);
+}
+
+void OnlineRewardMySQLStorage::Update()
+{
+    _queryProcessor.ProcessReadyCallbacks();
+    _transactionProcessor.ProcessReadyCallbacks();
+}
+
+std::vector<OnlineRewardStoredReward> OnlineRewardMySQLStorage::LoadRewards()
+{
+    std::vector<OnlineRewardStoredReward> rewards;
+
+    QueryResult result = CharacterDatabase.Query("SELECT `ID`, `IsPerOnline`, `Seconds`, `MinLevel`, `MaxLevel`, `ClassMask`, `RaceMask`, `Zones`, `Maps`, `MinSecurity`, `DayOfWeekMask`, "
+        "`Items`, `Reputations` FROM `wh_online_rewards`");
+    if (!result)
+        return rewards;
+
+    rewards.reserve(result->GetRowCount());
+
+    for (auto const& row : *result)
+    {
+        auto& reward = rewards.emplace_back();
+        reward.ID               = row[0].Get<uint32>();
+        reward.IsPerOnline      = row[1].Get<bool>();
+        reward.RewardTime       = row[2].Get<uint32>();
+        reward.MinLevel         = row[3].Get<uint8>();
+        reward.MaxLevel         = row[4].Get<uint8>();
+        reward.ClassMask        = row[5].Get<uint32>();
+        reward.RaceMask         = row[6].Get<uint32>();
+        reward.Zones            = row[7].Get<std::string>();
+        reward.Maps             = row[8].Get<std::string>();
+        reward.MinSecurity      = row[9].Get<uint8>();
+        reward.DayOfWeekMask    = row[10].Get<uint8>();
+        reward.Items            = row[11].Get<std::string>();
+        reward.Reputations      = row[12].Get<std::string>();
+    }
+
+    return rewards;
+}
+
+void OnlineRewardMySQLStorage::AddReward(OnlineRewardStoredReward const& reward)
+{
+    CharacterDatabase.Execute("INSERT INTO `wh_online_rewards` (`ID`, `IsPerOnline`, `Seconds`, `MinLevel`, `MaxLevel`, `ClassMask`, `RaceMask`, `Zones`, `Maps`, "
+        "`MinSecurity`, `DayOfWeekMask`, `Items`, `Reputations`) VALUES ({}, {:d}, {}, {}, {}, {}, {}, '{}', '{}', {}, {}, '{}', '{}')",
+        reward.ID, reward.IsPerOnline, reward.RewardTime, reward.MinLevel, reward.MaxLevel, reward.ClassMask, reward.RaceMask, EscapeText(reward.Zones), EscapeText(reward.Maps),
+        reward.MinSecurity, reward.DayOfWeekMask, EscapeText(reward.Items), EscapeText(reward.Reputations));
+}
+
+void OnlineRewardMySQLStorage::DeleteReward(uint32 id)
+{
+    CharacterDatabase.Execute("DELETE FROM `wh_online_rewards` WHERE `ID` = {}", id);
+}
+
+void OnlineRewardMySQLStorage::LoadHistory(ObjectGuid::LowType lowGuid, HistoryCallback&& callback)
+{
+    LoadHistory(lowGuid, 0, std::move(callback));
+}
+
+void OnlineRewardMySQLStorage::LoadHistory(ObjectGuid::LowType lowGuid, std::size_t sourceIndex, HistoryCallback&& callback)
+{
+    // Selected format first, then the other one and the archive. Archived player must not be seen as new,
+    // all rewards for the played time would be given again
+    std::array<uint8, 4> const sources{ GetFormat(), _isPackedHistory ? HISTORY_FORMAT_ROWS : HISTORY_FORMAT_PACKED,
+        HISTORY_FORMAT_ROWS_ARCHIVE, HISTORY_FORMAT_PACKED_ARCHIVE };
+    uint8 const format{ sources[sourceIndex] };
+
+    sORMetrics->AddStatements(MetricTable::History);
+
+    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(GetHistoryQuery(format, lowGuid)).
+    WithCallback([this, lowGuid, sourceIndex, format, isLast = sourceIndex + 1 >= sources.size(), callback = std::move(callback), queryStart = GetTraceQueryStart()](QueryResult result) mutable
+    {
+        AddTraceQueryWait(IsPackedFormat(format) ? "LoadHistoryPacked wait" : "LoadHistoryRows wait", queryStart);
+
+        OnlineRewardStoredHistory history;
+        history.PlayerGuid = lowGuid;
+
+        // Not found anywhere - new player
+        if (!result)
+        {
+            if (!isLast)
+            {
+                LoadHistory(lowGuid, sourceIndex + 1, std::move(callback));
+                return;
+            }
+
+            history.Format = GetFormat();
+            callback(OnlineRewardHistoryStatus::NotFound, std::move(history));
+            return;
+        }
+
+        history.Format = format;
+
+        if (format == HISTORY_FORMAT_ROWS_ARCHIVE || format == HISTORY_FORMAT_PACKED_ARCHIVE)
+            LOG_INFO("module.or", "> OR: Restore archived history of player with guid {}", lowGuid);
+
+        if (!IsPackedFormat(format))
+        {
+            for (auto const& row : *result)
+                ParseHistoryRow(row, history);
+        }
+        else if (!ParseHistoryPacked(result->Fetch(), history))
+        {
+            LOG_ERROR("module.or", "> OR: Unknown version of packed history for player with guid {}. Skip", lowGuid);
+            callback(OnlineRewardHistoryStatus::Error, std::move(history));
+            return;
+        }
+
+        callback(OnlineRewardHistoryStatus::Found, std::move(history));
+    }));
+}
+
+void OnlineRewardMySQLStorage::PreloadHistory(uint32 days, PreloadCallback const& callback)
+{
+    auto const activeSeconds{ static_cast<uint64>(days) * DAY };
+    bool isStopped{};
+
+    // Rows are ordered by player, history of one player is collected until next guid.
+    // Recent players go first, so they are kept if the caller stops
+    auto Preload = [&callback, &isStopped](QueryResult const& result, bool isPacked)
+    {
+        if (!result || isStopped)
+            return;
+
+        std::optional<OnlineRewardStoredHistory> current;
+
+        auto AddCurrent = [&callback, &current, &isStopped]()
+        {
+            if (current && !callback(std::move(*current)))
+                isStopped = true;
+        };
+
+        for (auto const& row : *result)
+        {
+            auto lowGuid = row[0].Get<ObjectGuid::LowType>();
+
+            if (!current || current->PlayerGuid != lowGuid)
+            {
+                AddCurrent();
+                if (isStopped)
+                    return;
+
+                current.emplace();
+                current->PlayerGuid = lowGuid;
+                current->Format = isPacked ? HISTORY_FORMAT_PACKED : HISTORY_FORMAT_ROWS;
+            }
+
+            if (!isPacked)
+                ParseHistoryRow(row + 1, *current);
+            else if (!ParseHistoryPacked(row + 1, *current))
+            {
+                LOG_ERROR("module.or", "> OR: Unknown version of packed history for player with guid {}. Skip", lowGuid);
+                current.reset();
+            }
+        }
+
+        AddCurrent();
+    };
+
+    auto PreloadRows = [activeSeconds]()
+    {
+        sORMetrics->AddStatements(MetricTable::History);
+
+        return CharacterDatabase.Query(Acore::StringFormatFmt("SELECT h.`PlayerGuid`, h.`RewardID`, h.`RewardedSeconds`, NULL, c.`logout_time` FROM `wh_online_rewards_history` h "
+            "JOIN `characters` c ON c.`guid` = h.`PlayerGuid` WHERE c.`logout_time` >= UNIX_TIMESTAMP() - {0} "
+            "UNION ALL SELECT cl.`PlayerGuid`, 0, 0, cl.`Claimed`, c.`logout_time` FROM `wh_online_rewards_claimed` cl "
+            "JOIN `characters` c ON c.`guid` = cl.`PlayerGuid` WHERE c.`logout_time` >= UNIX_TIMESTAMP() - {0} ORDER BY 5 DESC, 1", activeSeconds));
+    };
+
+    auto PreloadPacked = [activeSeconds]()
+    {
+        sORMetrics->AddStatements(MetricTable::History);
+
+        return CharacterDatabase.Query(Acore::StringFormatFmt("SELECT p.`PlayerGuid`, p.`Version`, p.`Data`, p.`Claimed` FROM `wh_online_rewards_history_packed` p "
+            "JOIN `characters` c ON c.`guid` = p.`PlayerGuid` WHERE c.`logout_time` >= UNIX_TIMESTAMP() - {} ORDER BY c.`logout_time` DESC, 1", activeSeconds));
+    };
+
+    // Selected format first, the other one only adds players missing in it. Nothing is added after the caller stops,
+    // otherwise a player skipped in selected format could get outdated history from the other one
+    Preload(_isPackedHistory ? PreloadPacked() : PreloadRows(), _isPackedHistory);
+    Preload(_isPackedHistory ? PreloadRows() : PreloadPacked(), !_isPackedHistory);
+}
+
+void OnlineRewardMySQLStorage::SaveHistory(std::span<OnlineRewardStoredHistory const> histories, uint64 generation)
+{
+    if (histories.empty())
+        return;
+
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+
+    if (_isPackedHistory)
+        SaveHistoryPacked(trans, histories);
+    else
+        SaveHistoryRows(trans, histories);
+
+    // Snapshot written before this save is outdated after it.
+    // DB value is incremented too, so it's never lower than a generation written by a previous run
+    trans->Append("INSERT INTO `wh_online_rewards_snapshot` (`ID`, `Generation`) VALUES (1, {}) ON DUPLICATE KEY UPDATE `Generation` = `Generation` + 1", generation);
+
+    sORMetrics->AddStatements(MetricTable::History, trans->GetSize());
+    CharacterDatabase.CommitTransaction(trans);
+}
+
+void OnlineRewardMySQLStorage::SaveHistoryRows(CharacterDatabaseTransaction trans, std::span<OnlineRewardStoredHistory const> histories)
+{
+    for (auto const& history : histories)
+    {
+        auto const lowGuid{ history.PlayerGuid };
+        bool const isMigrated{ history.Format != HISTORY_FORMAT_ROWS };
+
+        if (isMigrated)
+            DeleteHistoryExcept(trans, HISTORY_FORMAT_ROWS, Acore::ToString(lowGuid));
+
+        // Delete old data
+        trans->Append("DELETE FROM `wh_online_rewards_history` WHERE `PlayerGuid` = {}", lowGuid);
+
+        for (auto const& [rewardID, seconds] : history.PerTime)
+        {
+             // Insert new data
+            trans->Append("INSERT INTO `wh_online_rewards_history` (`PlayerGuid`, `RewardID`, `RewardedSeconds`) VALUES ({}, '{}', {})", lowGuid, rewardID, seconds.count());
+        }
+
+        // One-shot rewards are written only after a new claim
+        if (history.IsClaimedChanged || isMigrated)
+            trans->Append("REPLACE INTO `wh_online_rewards_claimed` (`PlayerGuid`, `Claimed`) VALUES ({}, X'{}')", lowGuid, ByteArrayToHexStr(history.Claimed));
+    }
+}
+
+void OnlineRewardMySQLStorage::SaveHistoryPacked(CharacterDatabaseTransaction trans, std::span<OnlineRewardStoredHistory const> histories)
+{
+    // One row per player, players are written by one statement per chunk
+    std::string values;
+    std::string migratedGuids;
+    std::size_t count{ 0 };
+
+    auto FlushValues = [&trans, &values, &count]()
+    {
+        if (values.empty())
+            return;
+
+        trans->Append("REPLACE INTO `wh_online_rewards_history_packed` (`PlayerGuid`, `Version`, `Data`, `Claimed`) VALUES {}", values);
+        values.clear();
+        count = 0;
+    };
+
+    for (auto const& history : histories)
+    {
+        auto const data{ PackPerTime(history.PerTime) };
+
+        if (!values.empty())
+            values.append(",");
+
+        values.append(Acore::StringFormatFmt("({}, {}, X'{}', X'{}')", history.PlayerGuid, HISTORY_PACKED_VERSION, ByteArrayToHexStr(data), ByteArrayToHexStr(history.Claimed)));
+
+        if (history.Format != HISTORY_FORMAT_PACKED)
+        {
+            if (!migratedGuids.empty())
+                migratedGuids.append(",");
+
+            migratedGuids.append(Acore::ToString(history.PlayerGuid));
+        }
+
+        if (++count >= HISTORY_PACKED_CHUNK_SIZE)
+            FlushValues();
+    }
+
+    FlushValues();
+
+    // Players loaded from rows format or archive are moved to packed one
+    if (!migratedGuids.empty())
+        DeleteHistoryExcept(trans, HISTORY_FORMAT_PACKED, migratedGuids);
+}
+
+std::optional<OnlineRewardStorageState> OnlineRewardMySQLStorage::GetState()
+{
+    return MakeState(CharacterDatabase.Query(STORAGE_STATE_QUERY));
+}
+
+void OnlineRewardMySQLStorage::GetStateAsync(StateCallback&& callback)
+{
+    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(STORAGE_STATE_QUERY).WithCallback([callback = std::move(callback)](QueryResult result)
+    {
+        callback(MakeState(result));
+    }));
+}
+
+void OnlineRewardMySQLStorage::RemoveOrphanHistory(uint32 batchSize, BatchCallback&& callback)
+{
+    // Rows format first, then claims of rows format and packed players are scanned by guid
+    if (_isOrphanRowsDone && !_isOrphanClaimedDone)
+    {
+        RemoveOrphanClaimed(batchSize, std::move(callback));
+        return;
+    }
+
+    if (_isOrphanRowsDone)
+    {
+        RemoveOrphanPacked(batchSize, std::move(callback));
+        return;
+    }
+
+    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormatFmt("SELECT h.`PlayerGuid`, h.`RewardID` FROM `wh_online_rewards_history` h "
+        "LEFT JOIN `wh_online_rewards` r ON r.`ID` = h.`RewardID` WHERE r.`ID` IS NULL LIMIT {}", batchSize)).
+    WithCallback([this, batchSize, callback = std::move(callback)](QueryResult result)
+    {
+        if (!result)
+        {
+            _isOrphanRowsDone = true;
+            callback(0, true);
+            return;
+        }
+
+        std::string keys;
+
+        for (auto const& row : *result)
+        {
+            if (!keys.empty())
+                keys.append(",");
+
+            keys.append(Acore::StringFormatFmt("({},{})", row[0].Get<uint32>(), row[1].Get<uint32>()));
+        }
+
+        auto rowsCount{ result->GetRowCount() };
+        _isOrphanRowsDone = rowsCount < batchSize;
+
+        CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+        trans->Append("DELETE FROM `wh_online_rewards_history` WHERE (`PlayerGuid`, `RewardID`) IN ({})", keys);
+        sORMetrics->AddStatements(MetricTable::History, 2);
+
+        _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([callback, rowsCount](bool /*success*/)
+        {
+            callback(rowsCount, true);
+        }));
+    }));
+}
+
+void OnlineRewardMySQLStorage::QueryCatalogIds(std::function<void(std::unordered_map<uint32, bool>)>&& callback)
+{
+    // Reward ids are inside blobs, they can't be joined. Catalog is small, it's read for every batch
+    sORMetrics->AddStatements(MetricTable::History);
+
+    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery("SELECT `ID`, `IsPerOnline` FROM `wh_online_rewards`").
+    WithCallback([callback = std::move(callback)](QueryResult result)
+    {
+        std::unordered_map<uint32, bool> rewardIds;
+
+        if (result)
+            for (auto const& row : *result)
+                rewardIds.emplace(row[0].Get<uint32>(), row[1].Get<bool>());
+
+        callback(std::move(rewardIds));
+    }));
+}
+
+void OnlineRewardMySQLStorage::RemoveOrphanClaimed(uint32 batchSize, BatchCallback&& callback)
+{
+    QueryCatalogIds([this, batchSize, callback = std::move(callback)](std::unordered_map<uint32, bool> rewardIds) mutable
+    {
+        sORMetrics->AddStatements(MetricTable::History);
+
+        _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormatFmt("SELECT `PlayerGuid`, `Claimed` FROM `wh_online_rewards_claimed` "
+            "WHERE `PlayerGuid` > {} ORDER BY `PlayerGuid` LIMIT {}", _orphanClaimedCursor, batchSize)).
+        WithCallback([this, batchSize, rewardIds = std::move(rewardIds), callback = std::move(callback)](QueryResult result)
+        {
+            uint64 removed{ 0 };
+            uint64 const playersCount{ result ? result->GetRowCount() : 0 };
+            CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+
+            if (result)
+            {
+                for (auto const& row : *result)
+                {
+                    auto const lowGuid{ row[0].Get<ObjectGuid::LowType>() };
+                    _orphanClaimedCursor = lowGuid;
+
+                    auto const& oldClaimed{ row[1].Get<Binary>() };
+                    auto claimed{ oldClaimed };
+
+                    auto const cleared{ RemoveOrphanClaims(claimed, [&rewardIds](uint32 id) { return IsOnceReward(rewardIds, id); }) };
+                    if (!cleared)
+                        continue;
+
+                    // Not written if a save of the player was committed after the read
+                    removed += cleared;
+                    trans->Append("UPDATE `wh_online_rewards_claimed` SET `Claimed` = X'{}' WHERE `PlayerGuid` = {} AND `Claimed` = X'{}'",
+                        ByteArrayToHexStr(claimed), lowGuid, ByteArrayToHexStr(oldClaimed));
+                }
+            }
+
+            _isOrphanClaimedDone = playersCount < batchSize;
+            if (_isOrphanClaimedDone)
+                _orphanClaimedCursor = 0;
+
+            CommitOrphanBatch(trans, removed, true, callback);
+        }));
+    });
+}
+
+void OnlineRewardMySQLStorage::RemoveOrphanPacked(uint32 batchSize, BatchCallback&& callback)
+{
+    QueryCatalogIds([this, batchSize, callback = std::move(callback)](std::unordered_map<uint32, bool> rewardIds) mutable
+    {
+        sORMetrics->AddStatements(MetricTable::History);
+
+        _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormatFmt("SELECT `PlayerGuid`, `Version`, `Data`, `Claimed` FROM `wh_online_rewards_history_packed` "
+            "WHERE `PlayerGuid` > {} ORDER BY `PlayerGuid` LIMIT {}", _orphanPackedCursor, batchSize)).
+        WithCallback([this, batchSize, rewardIds = std::move(rewardIds), callback = std::move(callback)](QueryResult result)
+        {
+            uint64 removed{ 0 };
+            uint64 const playersCount{ result ? result->GetRowCount() : 0 };
+            CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+
+            if (result)
+            {
+                for (auto const& row : *result)
+                {
+                    OnlineRewardStoredHistory history;
+                    history.PlayerGuid = row[0].Get<ObjectGuid::LowType>();
+                    _orphanPackedCursor = history.PlayerGuid;
+
+                    if (!ParseHistoryPacked(row + 1, history))
+                        continue;
+
+                    auto const erased{ std::erase_if(history.PerTime, [&rewardIds](auto const& entry) { return !rewardIds.contains(entry.first); }) };
+                    auto const cleared{ RemoveOrphanClaims(history.Claimed, [&rewardIds](uint32 id) { return IsOnceReward(rewardIds, id); }) };
+                    if (!erased && !cleared)
+                        continue;
+
+                    // Not written if a save of the player was committed after the read, it would be undone
+                    removed += erased + cleared;
+                    trans->Append("UPDATE `wh_online_rewards_history_packed` SET `Data` = X'{}', `Claimed` = X'{}' WHERE `PlayerGuid` = {} AND `Data` = X'{}' AND `Claimed` = X'{}'",
+                        ByteArrayToHexStr(PackPerTime(history.PerTime)), ByteArrayToHexStr(history.Claimed), history.PlayerGuid,
+                        ByteArrayToHexStr(row[2].Get<Binary>()), ByteArrayToHexStr(row[3].Get<Binary>()));
+                }
+            }
+
+            // Scan of the table is done, next job starts from the first player again
+            bool const hasMore{ playersCount >= batchSize };
+            if (!hasMore)
+            {
+                _isOrphanRowsDone = false;
+                _isOrphanClaimedDone = false;
+                _orphanPackedCursor = 0;
+            }
+
+            CommitOrphanBatch(trans, removed, hasMore, callback);
+        }));
+    });
+}
+
+void OnlineRewardMySQLStorage::CommitOrphanBatch(CharacterDatabaseTransaction trans, uint64 removed, bool hasMore, BatchCallback const& callback)
+{
+    if (!trans->GetSize())
+    {
+        callback(removed, hasMore);
+        return;
+    }
+
+    sORMetrics->AddStatements(MetricTable::History, trans->GetSize());
+
+    _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([callback, removed, hasMore](bool /*success*/)
+    {
+        callback(removed, hasMore);
+    }));
+}
+
+void OnlineRewardMySQLStorage::ArchiveInactiveHistory(uint32 days, uint32 batchSize, BatchCallback&& callback)
+{
+    // Players of both formats, also with claims only. Deleted characters are archived too
+    std::string const inactive{ Acore::StringFormatFmt("LEFT JOIN `characters` c ON c.`guid` = t.`PlayerGuid` "
+        "WHERE c.`guid` IS NULL OR (c.`online` = 0 AND c.`logout_time` < UNIX_TIMESTAMP() - {}) LIMIT {}", static_cast<uint64>(days) * DAY, batchSize) };
+
+    sORMetrics->AddStatements(MetricTable::History);
+
+    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormatFmt("(SELECT DISTINCT t.`PlayerGuid` FROM `wh_online_rewards_history` t {0}) "
+        "UNION (SELECT t.`PlayerGuid` FROM `wh_online_rewards_claimed` t {0}) UNION (SELECT t.`PlayerGuid` FROM `wh_online_rewards_history_packed` t {0}) LIMIT {1}",
+        inactive, batchSize)).
+    WithCallback([this, batchSize, callback = std::move(callback)](QueryResult result)
+    {
+        if (!result)
+        {
+            callback(0, false);
+            return;
+        }
+
+        std::string guids;
+
+        for (auto const& row : *result)
+        {
+            if (!guids.empty())
+                guids.append(",");
+
+            guids.append(Acore::ToString(row[0].Get<uint32>()));
+        }
+
+        auto playersCount{ result->GetRowCount() };
+
+        // Archive of a player restored and archived again is replaced, rows of rewards not in the new history must not stay
+        CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+        trans->Append("DELETE FROM `wh_online_rewards_history_archive` WHERE `PlayerGuid` IN ({})", guids);
+        trans->Append("DELETE FROM `wh_online_rewards_claimed_archive` WHERE `PlayerGuid` IN ({})", guids);
+        trans->Append("DELETE FROM `wh_online_rewards_history_packed_archive` WHERE `PlayerGuid` IN ({})", guids);
+        trans->Append("INSERT INTO `wh_online_rewards_history_archive` SELECT * FROM `wh_online_rewards_history` WHERE `PlayerGuid` IN ({})", guids);
+        trans->Append("INSERT INTO `wh_online_rewards_claimed_archive` SELECT * FROM `wh_online_rewards_claimed` WHERE `PlayerGuid` IN ({})", guids);
+        trans->Append("INSERT INTO `wh_online_rewards_history_packed_archive` SELECT * FROM `wh_online_rewards_history_packed` WHERE `PlayerGuid` IN ({})", guids);
+        trans->Append("DELETE FROM `wh_online_rewards_history` WHERE `PlayerGuid` IN ({})", guids);
+        trans->Append("DELETE FROM `wh_online_rewards_claimed` WHERE `PlayerGuid` IN ({})", guids);
+        trans->Append("DELETE FROM `wh_online_rewards_history_packed` WHERE `PlayerGuid` IN ({})", guids);
+        sORMetrics->AddStatements(MetricTable::History, trans->GetSize());
+
+        _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([callback, playersCount, batchSize](bool /*success*/)
+        {
+            callback(playersCount, playersCount >= batchSize);
+        }));
+    }));
+}
+
+void OnlineRewardMySQLStorage::GetHistoryStats(StatsCallback&& callback)
+{
+    // Size from information_schema is an estimate of InnoDB, good enough to see the trend
+    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery("SELECT (SELECT COUNT(*) FROM `wh_online_rewards_history`), (SELECT COUNT(*) FROM `wh_online_rewards_history_packed`), "
+        "CAST(COALESCE((SELECT SUM(`DATA_LENGTH` + `INDEX_LENGTH`) FROM `information_schema`.`TABLES` WHERE `TABLE_SCHEMA` = DATABASE() "
+        "AND `TABLE_NAME` IN ('wh_online_rewards_history', 'wh_online_rewards_history_packed')), 0) AS UNSIGNED)").
+    WithCallback([callback = std::move(callback)](QueryResult result)
+    {
+        OnlineRewardStorageStats stats;
+
+        if (result)
+        {
+            auto fields = result->Fetch();
+            stats.Rows = fields[0].Get<uint64>();
+            stats.PackedRows = fields[1].Get<uint64>();
+            stats.Bytes = fields[2].Get<uint64>();
+        }
+
+        callback(stats);
+    }));
+}
+
+void OnlineRewardMySQLStorage::SaveRewardStats(uint32 realmId, uint32 periodStart, std::span<OnlineRewardStoredStats const> stats)
+{
+    if (stats.empty())
+        return;
+
+    std::string values;
+
+    for (auto const& rewardStats : stats)
+    {
+        if (!values.empty())
+            values.append(",");
+
+        values.append(Acore::StringFormatFmt("({},{},{},{},{},{},{},{},{},{},{},{},{})", realmId, periodStart, rewardStats.RewardID, rewardStats.Grants,
+            rewardStats.ItemUnits, rewardStats.ItemUnitsBagged, rewardStats.ItemUnitsMailed, rewardStats.MailedGrants, rewardStats.Reputation,
+            rewardStats.SkippedIp, rewardStats.SkippedAfk, rewardStats.SkippedLevel, rewardStats.SkippedOther));
+    }
+
+    // One row per realm, hour and reward. Flushes of the same hour are summed
+    CharacterDatabase.Execute("INSERT INTO `wh_online_rewards_stats` (`RealmID`, `PeriodStart`, `RewardID`, `Grants`, `ItemUnits`, `ItemUnitsBagged`, `ItemUnitsMailed`, "
+        "`MailedGrants`, `Reputation`, `SkippedIp`, `SkippedAfk`, `SkippedLevel`, `SkippedOther`) VALUES " + values + " ON DUPLICATE KEY UPDATE "
+        "`Grants` = `Grants` + VALUES(`Grants`), `ItemUnits` = `ItemUnits` + VALUES(`ItemUnits`), `ItemUnitsBagged` = `ItemUnitsBagged` + VALUES(`ItemUnitsBagged`), "
+        "`ItemUnitsMailed` = `ItemUnitsMailed` + VALUES(`ItemUnitsMailed`), `MailedGrants` = `MailedGrants` + VALUES(`MailedGrants`), "
+        "`Reputation` = `Reputation` + VALUES(`Reputation`), `SkippedIp` = `SkippedIp` + VALUES(`SkippedIp`), `SkippedAfk` = `SkippedAfk` + VALUES(`SkippedAfk`), "
+        "`SkippedLevel` = `SkippedLevel` + VALUES(`SkippedLevel`), `SkippedOther` = `SkippedOther` + VALUES(`SkippedOther`)");
+
+    sORMetrics->AddStatements(MetricTable::Stats);
+}
+
+void OnlineRewardMySQLStorage::ResetTestHistory(ObjectGuid::LowType firstGuid, ObjectGuid::LowType lastGuid, std::span<OnlineRewardStoredHistory const> histories,
+    std::function<void(bool)>&& callback)
+{
+    ASSERT(IsTestGuid(firstGuid) && IsTestGuid(lastGuid));
+
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    AppendDeleteHistoryRange(trans, firstGuid, lastGuid);
+
+    if (_isPackedHistory)
+        SaveHistoryPacked(trans, histories);
+    else
+        SaveHistoryRows(trans, histories);
+
+    sORMetrics->AddStatements(MetricTable::History, trans->GetSize());
+    _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete(std::move(callback)));
+}
+
+void OnlineRewardMySQLStorage::AppendDeleteHistoryRange(CharacterDatabaseTransaction trans, ObjectGuid::LowType firstGuid, ObjectGuid::LowType lastGuid)
+{
+    std::string const range{ GetGuidRange(firstGuid, lastGuid) };
+
+    for (std::string_view table : { "wh_online_rewards_history", "wh_online_rewards_claimed", "wh_online_rewards_history_packed",
+        "wh_online_rewards_history_archive", "wh_online_rewards_claimed_archive", "wh_online_rewards_history_packed_archive" })
+        trans->Append("DELETE FROM `{}` WHERE {}", table, range);
+}
+
+bool OnlineRewardMySQLStorage::BenchmarkFormats(uint32 players, Seconds maxPlayed, uint32 maxQueries, BenchCallback&& callback)
+{
+    if (_bench || !players || players > HISTORY_BENCH_MAX_PLAYERS)
+        return false;
+
+    auto const rewards{ LoadRewards() };
+    std::mt19937 random(players);
+    std::uniform_int_distribution<uint32> playedTime(0, static_cast<uint32>(maxPlayed.count()));
+
+    _bench = std::make_unique<BenchRun>();
+    _bench->Callback = std::move(callback);
+    _bench->MaxQueries = std::max<uint32>(1, maxQueries);
+    _bench->Histories.reserve(players);
+
+    // Every save writes claims, like the first save after login
+    for (uint32 i = 0; i < players; ++i)
+        _bench->Histories.emplace_back(MakeSeedHistory(HISTORY_BENCH_FIRST_GUID + i, Seconds(playedTime(random)), rewards)).IsClaimedChanged = true;
+
+    LOG_INFO("module.or", "> OR: Started history benchmark with {} players from guid {}", players, HISTORY_BENCH_FIRST_GUID);
+
+    // Rows can be left by a benchmark stopped with the server
+    ClearBenchmark([this](bool success)
+    {
+        if (success)
+            BenchmarkSave(HISTORY_FORMAT_ROWS);
+        else
+            FinishBenchmark(false);
+    });
+
+    return true;
+}
+
+void OnlineRewardMySQLStorage::ClearBenchmark(std::function<void(bool)>&& next)
+{
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    AppendDeleteHistoryRange(trans, HISTORY_BENCH_FIRST_GUID, HISTORY_BENCH_FIRST_GUID + HISTORY_BENCH_MAX_PLAYERS - 1);
+
+    _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete(std::move(next)));
+}
+
+void OnlineRewardMySQLStorage::BenchmarkSave(uint8 format)
+{
+    auto& result = _bench->Results.emplace_back();
+    result.Format = format;
+
+    // Players are already in this format, nothing is migrated
+    for (auto& history : _bench->Histories)
+        history.Format = format;
+
+    _bench->Start = std::chrono::steady_clock::now();
+
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+
+    if (IsPackedFormat(format))
+        SaveHistoryPacked(trans, _bench->Histories);
+    else
+        SaveHistoryRows(trans, _bench->Histories);
+
+    result.BuildTime = std::chrono::duration_cast<Microseconds>(std::chrono::steady_clock::now() - _bench->Start);
+    result.Statements = trans->GetSize();
+
+    _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([this, format](bool success)
+    {
+        if (!success)
+        {
+            FinishBenchmark(false);
+            return;
+        }
+
+        _bench->Results.back().SaveTime = std::chrono::duration_cast<Milliseconds>(std::chrono::steady_clock::now() - _bench->Start);
+        BenchmarkLoad(format);
+    }));
+}
+
+void OnlineRewardMySQLStorage::BenchmarkLoad(uint8 format)
+{
+    _bench->PendingLoads = static_cast<uint32>(_bench->Histories.size());
+    _bench->NextLoad = 0;
+    _bench->Queries = 0;
+    _bench->Start = std::chrono::steady_clock::now();
+
+    QueueBenchmarkLoads(format);
+}
+
+void OnlineRewardMySQLStorage::QueueBenchmarkLoads(uint8 format)
+{
+    // Same limit as history loads at login, the DB can be used by the realm
+    while (_bench->NextLoad < _bench->Histories.size() && _bench->Queries < _bench->MaxQueries)
+    {
+        auto const lowGuid{ _bench->Histories[_bench->NextLoad++].PlayerGuid };
+        ++_bench->Queries;
+
+        _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(GetHistoryQuery(format, lowGuid)).WithCallback([this, format](QueryResult result)
+        {
+            // Parsed like at login, it's a part of the load
+            OnlineRewardStoredHistory loaded;
+
+            if (result && !IsPackedFormat(format))
+            {
+                for (auto const& row : *result)
+                    ParseHistoryRow(row, loaded);
+            }
+            else if (result)
+                ParseHistoryPacked(result->Fetch(), loaded);
+
+            --_bench->Queries;
+
+            if (--_bench->PendingLoads)
+            {
+                QueueBenchmarkLoads(format);
+                return;
+            }
+
+            _bench->Results.back().LoadTime = std::chrono::duration_cast<Milliseconds>(std::chrono::steady_clock::now() - _bench->Start);
+            BenchmarkSize(format);
+        }));
+    }
+}
+
+void OnlineRewardMySQLStorage::BenchmarkSize(uint8 format)
+{
+    // Column sizes: int is 4 bytes, blob has 2 bytes of length and `Version` 1 byte
+    std::string const range{ GetBenchmarkRange() };
+    std::string const query{ IsPackedFormat(format) ?
+        Acore::StringFormatFmt("SELECT COUNT(*), CAST(COALESCE(SUM(9 + LENGTH(`Data`) + LENGTH(`Claimed`)), 0) AS UNSIGNED) "
+            "FROM `wh_online_rewards_history_packed` WHERE {}", range) :
+        Acore::StringFormatFmt("SELECT (SELECT COUNT(*) FROM `wh_online_rewards_history` WHERE {0}) + (SELECT COUNT(*) FROM `wh_online_rewards_claimed` WHERE {0}), "
+            "CAST((SELECT COUNT(*) * 12 FROM `wh_online_rewards_history` WHERE {0}) + "
+            "(SELECT COALESCE(SUM(6 + LENGTH(`Claimed`)), 0) FROM `wh_online_rewards_claimed` WHERE {0}) AS UNSIGNED)", range) };
+
+    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(query).WithCallback([this, format](QueryResult result)
+    {
+        if (result)
+        {
+            auto fields = result->Fetch();
+            _bench->Results.back().Rows = fields[0].Get<uint64>();
+            _bench->Results.back().Bytes = fields[1].Get<uint64>();
+        }
+
+        // Packed format is measured on empty tables too
+        ClearBenchmark([this, format](bool success)
+        {
+            if (success && format == HISTORY_FORMAT_ROWS)
+                BenchmarkSave(HISTORY_FORMAT_PACKED);
+            else
+                FinishBenchmark(success);
+        });
+    }));
+}
+
+void OnlineRewardMySQLStorage::FinishBenchmark(bool isDone)
+{
+    // Callback can start the next one
+    auto bench{ std::move(_bench) };
+
+    if (!isDone)
+    {
+        LOG_ERROR("module.or", "> OR: History benchmark failed, history of guids from {} can be left", HISTORY_BENCH_FIRST_GUID);
+        bench->Results.clear();
+    }
+
+    bench->Callback(std::move(bench->Results));
+}
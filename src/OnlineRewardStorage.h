@@ -0,0 +1,333 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WARHEAD_ONLINE_REWARD_STORAGE_H_
+#define _WARHEAD_ONLINE_REWARD_STORAGE_H_
+
+#include "AsyncCallbackProcessor.h"
+#include "DatabaseEnvFwd.h"
+#include "Define.h"
+#include "Duration.h"
+#include "ObjectGuid.h"
+#include "Transaction.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// Reserved guids of test runs on a real DB, `PlayerGuid` is signed int and character guids don't reach them.
+// Every run has own range, so one can't remove rows of another. Mails to these guids are not sent, see `ExternalMail`
+constexpr ObjectGuid::LowType TEST_FIRST_GUID           = 2000000000;
+constexpr ObjectGuid::LowType HISTORY_BENCH_FIRST_GUID  = TEST_FIRST_GUID;
+constexpr uint32 HISTORY_BENCH_MAX_PLAYERS              = 1000000;
+constexpr ObjectGuid::LowType SOAK_FIRST_GUID           = HISTORY_BENCH_FIRST_GUID + HISTORY_BENCH_MAX_PLAYERS;
+constexpr uint32 SOAK_MAX_GUIDS                         = 1000000;
+constexpr ObjectGuid::LowType MAIL_CHECK_FIRST_GUID     = SOAK_FIRST_GUID + SOAK_MAX_GUIDS;
+constexpr uint32 MAIL_CHECK_MAX_GUIDS                   = 1000;
+constexpr ObjectGuid::LowType TEST_LAST_GUID            = MAIL_CHECK_FIRST_GUID + MAIL_CHECK_MAX_GUIDS - 1;
+
+inline bool IsTestGuid(ObjectGuid::LowType lowGuid)
+{
+    return lowGuid >= TEST_FIRST_GUID && lowGuid <= TEST_LAST_GUID;
+}
+
+// Row of reward catalog as it is stored, lists are not parsed
+struct OnlineRewardStoredReward
+{
+    uint32 ID{};
+    bool IsPerOnline{ true };
+    uint32 RewardTime{};
+    uint8 MinLevel{ 1 };
+    uint8 MaxLevel{};
+    uint32 ClassMask{};
+    uint32 RaceMask{};
+    std::string Zones;
+    std::string Maps;
+    uint8 MinSecurity{};
+    uint8 DayOfWeekMask{};
+    std::string Items;
+    std::string Reputations;
+};
+
+// History of one player as it is stored. Claims are bits by reward id, see `OnlineRewardMgr::PackClaims`
+struct OnlineRewardStoredHistory
+{
+    ObjectGuid::LowType PlayerGuid{};
+    std::vector<std::pair<uint32/*reward id*/, Seconds/*rewarded seconds*/>> PerTime;
+    std::vector<uint8> Claimed;
+    uint8 Format{};             // Where the history is stored now, moved to `GetFormat()` at next save
+    bool IsClaimedChanged{};    // Claims can be skipped by save if not changed
+};
+
+// Compared with warm restart snapshot header
+struct OnlineRewardStorageState
+{
+    uint64 Generation{};
+    uint32 CatalogCount{};
+    uint64 CatalogChecksum{};
+};
+
+// Economy counters of one reward for one period, added to the stored ones of the same period
+struct OnlineRewardStoredStats
+{
+    uint32 RewardID{};
+    uint64 Grants{};
+    uint64 ItemUnits{};
+    uint64 ItemUnitsBagged{};
+    uint64 ItemUnitsMailed{};
+    uint64 MailedGrants{};
+    uint64 Reputation{};
+    uint64 SkippedIp{};
+    uint64 SkippedAfk{};
+    uint64 SkippedLevel{};
+    uint64 SkippedOther{};
+};
+
+// Result of one history format in `OnlineRewardMySQLStorage::BenchmarkFormats`
+struct OnlineRewardFormatBench
+{
+    uint8 Format{};
+    uint64 Statements{};
+    uint64 Rows{};
+    uint64 Bytes{};             // Stored values, without InnoDB overhead
+    Microseconds BuildTime{};   // World thread, statements of the save
+    Milliseconds SaveTime{};    // Until the commit is done
+    Milliseconds LoadTime{};    // Every player by own query, like at login
+};
+
+struct OnlineRewardStorageStats
+{
+    uint64 Rows{};          // Rows format
+    uint64 PackedRows{};    // Packed format, one per player
+    uint64 Bytes{};         // Both formats
+};
+
+enum class OnlineRewardHistoryStatus : uint8
+{
+    Found,
+    NotFound,
+    Error
+};
+
+// History given by reward ticks for `played` time, to seed benchmarks
+OnlineRewardStoredHistory MakeSeedHistory(ObjectGuid::LowType lowGuid, Seconds played, std::span<OnlineRewardStoredReward const> rewards);
+
+// Clears claim bits of rewards which are not one-shot ones, `isOnceReward` gets the reward id. Returns count of cleared bits
+uint64 RemoveOrphanClaims(std::vector<uint8>& claimed, std::function<bool(uint32)> const& isOnceReward);
+
+// Persistence of catalog and history. Async callbacks are called from `Update` in world thread
+class OnlineRewardStorage
+{
+public:
+    using HistoryCallback = std::function<void(OnlineRewardHistoryStatus, OnlineRewardStoredHistory&&)>;
+    using PreloadCallback = std::function<bool(OnlineRewardStoredHistory&&)>; // Returns false to stop
+    using StateCallback = std::function<void(std::optional<OnlineRewardStorageState>)>;
+    using BatchCallback = std::function<void(uint64/*handled*/, bool/*hasMore*/)>;
+    using StatsCallback = std::function<void(OnlineRewardStorageStats)>;
+
+    virtual ~OnlineRewardStorage() = default;
+
+    // Backend by `OR.Storage.Backend`: "mysql" or "memory"
+    static std::unique_ptr<OnlineRewardStorage> Create(std::string_view backend);
+
+    virtual void LoadConfig() { }
+    virtual void Update() = 0;
+
+    // Called once at startup before other calls, DB is ready
+    virtual void LoadSystem() { }
+
+    // Format of saved history, opaque for caller
+    [[nodiscard]] virtual uint8 GetFormat() const = 0;
+
+    // Catalog
+    virtual std::vector<OnlineRewardStoredReward> LoadRewards() = 0;
+    virtual void AddReward(OnlineRewardStoredReward const& reward) = 0;
+    virtual void DeleteReward(uint32 id) = 0;
+
+    // History. Preload is sync and gives players who logged out in last `days`, most recent first
+    virtual void LoadHistory(ObjectGuid::LowType lowGuid, HistoryCallback&& callback) = 0;
+    virtual void PreloadHistory(uint32 days, PreloadCallback const& callback) = 0;
+    virtual void SaveHistory(std::span<OnlineRewardStoredHistory const> histories, uint64 generation) = 0;
+
+    // Snapshot
+    virtual std::optional<OnlineRewardStorageState> GetState() = 0;
+    virtual void GetStateAsync(StateCallback&& callback) = 0;
+
+    // Maintenance, every call handles up to `batchSize` rows or players of both formats.
+    // Gives the handled count and if the caller must call again
+    virtual void RemoveOrphanHistory(uint32 batchSize, BatchCallback&& callback) = 0;
+    virtual void ArchiveInactiveHistory(uint32 days, uint32 batchSize, BatchCallback&& callback) = 0;
+    virtual void GetHistoryStats(StatsCallback&& callback) = 0;
+
+    // Economy telemetry, `periodStart` is unix time of the hour
+    virtual void SaveRewardStats(uint32 realmId, uint32 periodStart, std::span<OnlineRewardStoredStats const> stats) = 0;
+
+    // Test runs, guids of `firstGuid`..`lastGuid` must be reserved ones. Their history is removed in all formats and archive,
+    // then `histories` are saved in current format. Callback gets false if it failed
+    virtual void ResetTestHistory(ObjectGuid::LowType firstGuid, ObjectGuid::LowType lastGuid, std::span<OnlineRewardStoredHistory const> histories,
+        std::function<void(bool)>&& callback) = 0;
+};
+
+// Character DB, history in rows or packed format by `OR.History.PackedFormat.Enable`
+class OnlineRewardMySQLStorage final : public OnlineRewardStorage
+{
+public:
+    void LoadConfig() override;
+    void Update() override;
+
+    [[nodiscard]] uint8 GetFormat() const override { return _isPackedHistory; }
+
+    std::vector<OnlineRewardStoredReward> LoadRewards() override;
+    void AddReward(OnlineRewardStoredReward const& reward) override;
+    void DeleteReward(uint32 id) override;
+
+    void LoadHistory(ObjectGuid::LowType lowGuid, HistoryCallback&& callback) override;
+    void PreloadHistory(uint32 days, PreloadCallback const& callback) override;
+    void SaveHistory(std::span<OnlineRewardStoredHistory const> histories, uint64 generation) override;
+
+    std::optional<OnlineRewardStorageState> GetState() override;
+    void GetStateAsync(StateCallback&& callback) override;
+
+    void RemoveOrphanHistory(uint32 batchSize, BatchCallback&& callback) override;
+    void ArchiveInactiveHistory(uint32 days, uint32 batchSize, BatchCallback&& callback) override;
+    void GetHistoryStats(StatsCallback&& callback) override;
+
+    void SaveRewardStats(uint32 realmId, uint32 periodStart, std::span<OnlineRewardStoredStats const> stats) override;
+
+    void ResetTestHistory(ObjectGuid::LowType firstGuid, ObjectGuid::LowType lastGuid, std::span<OnlineRewardStoredHistory const> histories,
+        std::function<void(bool)>&& callback) override;
+
+    // Saves and loads generated history of `players` in rows format, then in packed one. Players have reserved guids,
+    // they are removed before and after every format. Up to `maxQueries` loads are sent at once.
+    // Returns false if one is running, callback gets no results if it failed
+    using BenchCallback = std::function<void(std::vector<OnlineRewardFormatBench>)>;
+    bool BenchmarkFormats(uint32 players, Seconds maxPlayed, uint32 maxQueries, BenchCallback&& callback);
+    [[nodiscard]] inline bool IsBenchmarkRunning() const { return _bench != nullptr; }
+
+private:
+    struct BenchRun
+    {
+        std::vector<OnlineRewardStoredHistory> Histories;
+        std::vector<OnlineRewardFormatBench> Results;
+        BenchCallback Callback;
+        uint32 PendingLoads{};
+        std::size_t NextLoad{};
+        uint32 Queries{};       // Loads sent and not done
+        uint32 MaxQueries{ 1 };
+        TimePoint Start;
+    };
+
+    // History not found in source `sourceIndex` is looked up in the next one: selected format, the other format, archive
+    void LoadHistory(ObjectGuid::LowType lowGuid, std::size_t sourceIndex, HistoryCallback&& callback);
+    void SaveHistoryRows(CharacterDatabaseTransaction trans, std::span<OnlineRewardStoredHistory const> histories);
+    void SaveHistoryPacked(CharacterDatabaseTransaction trans, std::span<OnlineRewardStoredHistory const> histories);
+    void QueryCatalogIds(std::function<void(std::unordered_map<uint32/*id*/, bool/*is per online*/>)>&& callback);
+    void RemoveOrphanClaimed(uint32 batchSize, BatchCallback&& callback);
+    void RemoveOrphanPacked(uint32 batchSize, BatchCallback&& callback);
+    void CommitOrphanBatch(CharacterDatabaseTransaction trans, uint64 removed, bool hasMore, BatchCallback const& callback);
+
+    void AppendDeleteHistoryRange(CharacterDatabaseTransaction trans, ObjectGuid::LowType firstGuid, ObjectGuid::LowType lastGuid);
+
+    // Benchmark steps of one format: save, load, size, clear, next format
+    void ClearBenchmark(std::function<void(bool)>&& next);
+    void BenchmarkSave(uint8 format);
+    void BenchmarkLoad(uint8 format);
+    void QueueBenchmarkLoads(uint8 format);
+    void BenchmarkSize(uint8 format);
+    void FinishBenchmark(bool isDone);
+
+    bool _isPackedHistory{};
+    std::unique_ptr<BenchRun> _bench;
+
+    // Orphan cleanup of current maintenance job
+    bool _isOrphanRowsDone{};
+    bool _isOrphanClaimedDone{};
+    ObjectGuid::LowType _orphanClaimedCursor{};
+    ObjectGuid::LowType _orphanPackedCursor{};
+
+    QueryCallbackProcessor _queryProcessor;
+    AsyncCallbackProcessor<TransactionCallback> _transactionProcessor;
+};
+
+// In process storage for benchmarks, filled at start by `OR.Storage.Memory.Seed.*`.
+// Callbacks of async calls are delayed by `OR.Storage.Memory.Latency`, sync calls are not
+class OnlineRewardMemoryStorage final : public OnlineRewardStorage
+{
+public:
+    void LoadConfig() override;
+    void Update() override;
+    void LoadSystem() override;
+
+    // Replaces history of players with guid 1..`count` by generated one, played time is random up to `OR.Storage.Memory.Seed.MaxPlayedHours`.
+    // Same count gives the same history
+    void SeedHistory(uint32 count);
+    [[nodiscard]] Seconds GetSeedPlayedTime(ObjectGuid::LowType lowGuid) const;
+
+    [[nodiscard]] uint8 GetFormat() const override { return 0; }
+
+    std::vector<OnlineRewardStoredReward> LoadRewards() override;
+    void AddReward(OnlineRewardStoredReward const& reward) override;
+    void DeleteReward(uint32 id) override;
+
+    void LoadHistory(ObjectGuid::LowType lowGuid, HistoryCallback&& callback) override;
+    void PreloadHistory(uint32 days, PreloadCallback const& callback) override;
+    void SaveHistory(std::span<OnlineRewardStoredHistory const> histories, uint64 generation) override;
+
+    std::optional<OnlineRewardStorageState> GetState() override;
+    void GetStateAsync(StateCallback&& callback) override;
+
+    void RemoveOrphanHistory(uint32 batchSize, BatchCallback&& callback) override;
+    void ArchiveInactiveHistory(uint32 days, uint32 batchSize, BatchCallback&& callback) override;
+    void GetHistoryStats(StatsCallback&& callback) override;
+
+    void SaveRewardStats(uint32 realmId, uint32 periodStart, std::span<OnlineRewardStoredStats const> stats) override;
+
+    void ResetTestHistory(ObjectGuid::LowType firstGuid, ObjectGuid::LowType lastGuid, std::span<OnlineRewardStoredHistory const> histories,
+        std::function<void(bool)>&& callback) override;
+
+private:
+    struct StoredPlayer
+    {
+        OnlineRewardStoredHistory History;
+        TimePoint SaveTime;
+    };
+
+    // Called from `Update` after the latency
+    void AddCallback(std::function<void()>&& callback);
+    [[nodiscard]] OnlineRewardStorageState MakeState() const;
+
+    // Config
+    Milliseconds _latency{};
+    bool _isSeedCatalog{};
+    uint32 _seedPlayers{};
+    uint32 _seedMaxPlayedHours{};
+
+    std::unordered_map<uint32, OnlineRewardStoredReward> _rewards;
+    std::unordered_map<ObjectGuid::LowType, StoredPlayer> _players;
+    std::unordered_map<ObjectGuid::LowType, StoredPlayer> _archive;
+    std::map<std::tuple<uint32/*realm*/, uint32/*period*/, uint32/*reward*/>, OnlineRewardStoredStats> _rewardStats;
+    uint64 _generation{};
+
+    std::vector<std::pair<TimePoint, std::function<void()>>> _callbacks;
+};
+
+#endif
@@ -0,0 +1,314 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineRewardStorage.h"
+#include "Common.h"
+#include "Config.h"
+#include "ContainerHelpers.h"
+#include "Log.h"
+#include "StringFormat.h"
+#include <algorithm>
+#include <random>
+
+void OnlineRewardMemoryStorage::LoadConfig()
+{
+    _latency = Milliseconds(sConfigMgr->GetOption<uint32>("OR.Storage.Memory.Latency", 0));
+    _isSeedCatalog = sConfigMgr->GetOption<bool>("OR.Storage.Memory.Seed.Catalog", true);
+    _seedPlayers = sConfigMgr->GetOption<uint32>("OR.Storage.Memory.Seed.Players", 0);
+    _seedMaxPlayedHours = std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Storage.Memory.Seed.MaxPlayedHours", 500));
+}
+
+void OnlineRewardMemoryStorage::LoadSystem()
+{
+    if (_isSeedCatalog)
+        for (auto const& reward : OnlineRewardMySQLStorage{}.LoadRewards())
+            _rewards.emplace(reward.ID, reward);
+
+    SeedHistory(_seedPlayers);
+
+    LOG_INFO("module.or", ">> Seeded memory storage with {} rewards and history of {} players", _rewards.size(), _players.size());
+}
+
+Seconds OnlineRewardMemoryStorage::GetSeedPlayedTime(ObjectGuid::LowType lowGuid) const
+{
+    std::mt19937 random(lowGuid);
+    return Seconds(std::uniform_int_distribution<uint32>(0, _seedMaxPlayedHours * HOUR)(random));
+}
+
+void OnlineRewardMemoryStorage::SeedHistory(uint32 count)
+{
+    auto const now{ std::chrono::steady_clock::now() };
+    auto const rewards{ LoadRewards() };
+
+    for (ObjectGuid::LowType lowGuid = 1; lowGuid <= count; ++lowGuid)
+    {
+        StoredPlayer player;
+        player.History = MakeSeedHistory(lowGuid, GetSeedPlayedTime(lowGuid), rewards);
+        player.SaveTime = now;
+
+        _archive.erase(lowGuid);
+        _players.insert_or_assign(lowGuid, std::move(player));
+    }
+}
+
+void OnlineRewardMemoryStorage::Update()
+{
+    if (_callbacks.empty())
+        return;
+
+    // Callbacks can add new ones, ready ones are taken out first
+    auto const now{ std::chrono::steady_clock::now() };
+    auto ready = std::stable_partition(_callbacks.begin(), _callbacks.end(), [now](auto const& callback) { return callback.first > now; });
+
+    std::vector<std::function<void()>> readyCallbacks;
+    readyCallbacks.reserve(std::distance(ready, _callbacks.end()));
+
+    for (auto itr = ready; itr != _callbacks.end(); ++itr)
+        readyCallbacks.emplace_back(std::move(itr->second));
+
+    _callbacks.erase(ready, _callbacks.end());
+
+    for (auto& callback : readyCallbacks)
+        callback();
+}
+
+void OnlineRewardMemoryStorage::AddCallback(std::function<void()>&& callback)
+{
+    _callbacks.emplace_back(std::chrono::steady_clock::now() + _latency, std::move(callback));
+}
+
+std::vector<OnlineRewardStoredReward> OnlineRewardMemoryStorage::LoadRewards()
+{
+    std::vector<OnlineRewardStoredReward> rewards;
+    rewards.reserve(_rewards.size());
+
+    for (auto const& [id, reward] : _rewards)
+        rewards.emplace_back(reward);
+
+    return rewards;
+}
+
+void OnlineRewardMemoryStorage::AddReward(OnlineRewardStoredReward const& reward)
+{
+    _rewards.emplace(reward.ID, reward);
+}
+
+void OnlineRewardMemoryStorage::DeleteReward(uint32 id)
+{
+    _rewards.erase(id);
+}
+
+void OnlineRewardMemoryStorage::LoadHistory(ObjectGuid::LowType lowGuid, HistoryCallback&& callback)
+{
+    // Copied at call time like a DB snapshot, saves made during the latency are not seen
+    // Archived player is not new, stays in archive until next save like in MySQL storage
+    StoredPlayer const* player{ Acore::Containers::MapGetValuePtr(_players, lowGuid) };
+    if (!player)
+        player = Acore::Containers::MapGetValuePtr(_archive, lowGuid);
+
+    if (!player)
+    {
+        OnlineRewardStoredHistory history;
+        history.PlayerGuid = lowGuid;
+
+        AddCallback([callback = std::move(callback), history = std::move(history)]() mutable
+        {
+            callback(OnlineRewardHistoryStatus::NotFound, std::move(history));
+        });
+
+        return;
+    }
+
+    AddCallback([callback = std::move(callback), history = player->History]() mutable
+    {
+        callback(OnlineRewardHistoryStatus::Found, std::move(history));
+    });
+}
+
+void OnlineRewardMemoryStorage::PreloadHistory(uint32 days, PreloadCallback const& callback)
+{
+    // Save time is used instead of logout time, players are saved every tick while online
+    auto const activeTime{ std::chrono::steady_clock::now() - Seconds(static_cast<uint64>(days) * DAY) };
+    std::vector<StoredPlayer const*> players;
+
+    for (auto const& [lowGuid, player] : _players)
+        if (player.SaveTime >= activeTime)
+            players.emplace_back(&player);
+
+    std::sort(players.begin(), players.end(), [](StoredPlayer const* left, StoredPlayer const* right) { return left->SaveTime > right->SaveTime; });
+
+    for (auto const* player : players)
+        if (!callback(OnlineRewardStoredHistory{ player->History }))
+            return;
+}
+
+void OnlineRewardMemoryStorage::SaveHistory(std::span<OnlineRewardStoredHistory const> histories, uint64 generation)
+{
+    if (histories.empty())
+        return;
+
+    auto const now{ std::chrono::steady_clock::now() };
+
+    for (auto const& history : histories)
+    {
+        _archive.erase(history.PlayerGuid);
+
+        auto& player = _players[history.PlayerGuid];
+        player.History = history;
+        player.History.IsClaimedChanged = false;
+        player.SaveTime = now;
+    }
+
+    _generation = std::max(_generation + 1, generation);
+}
+
+OnlineRewardStorageState OnlineRewardMemoryStorage::MakeState() const
+{
+    // Order independent like SUM of CRC32 in MySQL storage
+    uint64 checksum{ 0 };
+
+    for (auto const& [id, reward] : _rewards)
+        checksum += std::hash<std::string>{}(Acore::StringFormatFmt("{}:{:d}:{}:{}:{}:{}:{}:{}:{}:{}:{}:{}:{}", reward.ID, reward.IsPerOnline, reward.RewardTime,
+            reward.MinLevel, reward.MaxLevel, reward.ClassMask, reward.RaceMask, reward.Zones, reward.Maps, reward.MinSecurity, reward.DayOfWeekMask, reward.Items, reward.Reputations));
+
+    return OnlineRewardStorageState{ _generation, static_cast<uint32>(_rewards.size()), checksum };
+}
+
+std::optional<OnlineRewardStorageState> OnlineRewardMemoryStorage::GetState()
+{
+    return MakeState();
+}
+
+void OnlineRewardMemoryStorage::GetStateAsync(StateCallback&& callback)
+{
+    AddCallback([callback = std::move(callback), state = MakeState()]()
+    {
+        callback(state);
+    });
+}
+
+void OnlineRewardMemoryStorage::RemoveOrphanHistory(uint32 batchSize, BatchCallback&& callback)
+{
+    uint64 removed{ 0 };
+
+    for (auto& [lowGuid, player] : _players)
+    {
+        std::erase_if(player.History.PerTime, [this, batchSize, &removed](auto const& entry)
+        {
+            if (removed >= batchSize || _rewards.contains(entry.first))
+                return false;
+
+            ++removed;
+            return true;
+        });
+
+        removed += RemoveOrphanClaims(player.History.Claimed, [this](uint32 id)
+        {
+            auto reward = Acore::Containers::MapGetValuePtr(_rewards, id);
+            return reward && reward->IsPerOnline;
+        });
+
+        if (removed >= batchSize)
+            break;
+    }
+
+    AddCallback([callback = std::move(callback), removed, batchSize]()
+    {
+        callback(removed, removed >= batchSize);
+    });
+}
+
+void OnlineRewardMemoryStorage::ArchiveInactiveHistory(uint32 days, uint32 batchSize, BatchCallback&& callback)
+{
+    auto const activeTime{ std::chrono::steady_clock::now() - Seconds(static_cast<uint64>(days) * DAY) };
+    uint64 archived{ 0 };
+
+    for (auto itr = _players.begin(); itr != _players.end() && archived < batchSize;)
+    {
+        if (itr->second.SaveTime >= activeTime)
+        {
+            ++itr;
+            continue;
+        }
+
+        _archive.insert_or_assign(itr->first, std::move(itr->second));
+        itr = _players.erase(itr);
+        ++archived;
+    }
+
+    AddCallback([callback = std::move(callback), archived, batchSize]()
+    {
+        callback(archived, archived >= batchSize);
+    });
+}
+
+void OnlineRewardMemoryStorage::GetHistoryStats(StatsCallback&& callback)
+{
+    OnlineRewardStorageStats stats;
+
+    for (auto const& [lowGuid, player] : _players)
+    {
+        stats.Rows += player.History.PerTime.size();
+        stats.Bytes += sizeof(StoredPlayer) + player.History.PerTime.capacity() * sizeof(decltype(player.History.PerTime)::value_type) + player.History.Claimed.capacity();
+    }
+
+    AddCallback([callback = std::move(callback), stats]()
+    {
+        callback(stats);
+    });
+}
+
+void OnlineRewardMemoryStorage::SaveRewardStats(uint32 realmId, uint32 periodStart, std::span<OnlineRewardStoredStats const> stats)
+{
+    for (auto const& rewardStats : stats)
+    {
+        auto& stored = _rewardStats[{ realmId, periodStart, rewardStats.RewardID }];
+        stored.RewardID = rewardStats.RewardID;
+        stored.Grants += rewardStats.Grants;
+        stored.ItemUnits += rewardStats.ItemUnits;
+        stored.ItemUnitsBagged += rewardStats.ItemUnitsBagged;
+        stored.ItemUnitsMailed += rewardStats.ItemUnitsMailed;
+        stored.MailedGrants += rewardStats.MailedGrants;
+        stored.Reputation += rewardStats.Reputation;
+        stored.SkippedIp += rewardStats.SkippedIp;
+        stored.SkippedAfk += rewardStats.SkippedAfk;
+        stored.SkippedLevel += rewardStats.SkippedLevel;
+        stored.SkippedOther += rewardStats.SkippedOther;
+    }
+}
+
+void OnlineRewardMemoryStorage::ResetTestHistory(ObjectGuid::LowType firstGuid, ObjectGuid::LowType lastGuid, std::span<OnlineRewardStoredHistory const> histories,
+    std::function<void(bool)>&& callback)
+{
+    ASSERT(IsTestGuid(firstGuid) && IsTestGuid(lastGuid));
+
+    auto IsInRange = [firstGuid, lastGuid](auto const& pair) { return pair.first >= firstGuid && pair.first <= lastGuid; };
+    std::erase_if(_players, IsInRange);
+    std::erase_if(_archive, IsInRange);
+
+    auto const now{ std::chrono::steady_clock::now() };
+
+    for (auto const& history : histories)
+    {
+        auto& player = _players[history.PlayerGuid];
+        player.History = history;
+        player.History.IsClaimedChanged = false;
+        player.SaveTime = now;
+    }
+
+    AddCallback([callback = std::move(callback)]() { callback(true); });
+}
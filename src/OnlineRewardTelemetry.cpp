@@ -0,0 +1,139 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineRewardTelemetry.h"
+#include "Common.h"
+#include "Config.h"
+#include "GameTime.h"
+#include "OnlineReward.h"
+#include "OnlineRewardMetrics.h"
+
+namespace
+{
+    uint32 GetCurrentHour()
+    {
+        auto const now{ static_cast<uint32>(GameTime::GetGameTime().count()) };
+        return now - now % HOUR;
+    }
+}
+
+OnlineRewardTelemetry* OnlineRewardTelemetry::instance()
+{
+    static OnlineRewardTelemetry instance;
+    return &instance;
+}
+
+void OnlineRewardTelemetry::LoadConfig()
+{
+    // Counters of old config are written before it's changed
+    Flush();
+
+    _isEnable = sConfigMgr->GetOption<bool>("OR.Stats.Enable", false);
+    _flushInterval = Minutes(std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Stats.FlushInterval", 10)));
+    _realmId = sConfigMgr->GetOption<uint32>("RealmID", 1);
+}
+
+void OnlineRewardTelemetry::Update(Milliseconds diff)
+{
+    sORMetrics->SetContainerStats(MetricContainer::EconomyStats, _counters.size(), _counters.bucket_count(), GetHashMapMemory(_counters));
+
+    if (_counters.empty())
+        return;
+
+    _flushTimer += diff;
+
+    if (_flushTimer >= _flushInterval || GetCurrentHour() != _periodStart)
+        Flush();
+}
+
+OnlineRewardTelemetry::RewardCounters& OnlineRewardTelemetry::GetCounters(uint32 rewardId)
+{
+    if (_counters.empty())
+        _periodStart = GetCurrentHour();
+
+    return _counters[rewardId];
+}
+
+void OnlineRewardTelemetry::AddGrant(uint32 rewardId, uint64 reputation)
+{
+    if (!_isEnable)
+        return;
+
+    auto& counters{ GetCounters(rewardId) };
+    ++counters.Grants;
+    counters.Reputation += reputation;
+}
+
+void OnlineRewardTelemetry::AddItems(uint32 rewardId, uint64 bagged, uint64 mailed)
+{
+    if (!_isEnable || (!bagged && !mailed))
+        return;
+
+    auto& counters{ GetCounters(rewardId) };
+    counters.ItemUnitsBagged += bagged;
+    counters.ItemUnitsMailed += mailed;
+
+    if (mailed)
+        ++counters.MailedGrants;
+}
+
+void OnlineRewardTelemetry::AddSkip(uint32 rewardId, OnlineRewardSkipReason reason)
+{
+    if (!_isEnable || reason == OnlineRewardSkipReason::None || reason >= OnlineRewardSkipReason::Max)
+        return;
+
+    ++GetCounters(rewardId).Skipped[static_cast<std::size_t>(reason)];
+}
+
+void OnlineRewardTelemetry::Flush()
+{
+    _flushTimer = 0ms;
+
+    if (_counters.empty())
+        return;
+
+    auto storage{ sORMgr->GetStorage() };
+    if (!storage)
+    {
+        _counters.clear();
+        return;
+    }
+
+    std::vector<OnlineRewardStoredStats> stats;
+    stats.reserve(_counters.size());
+
+    for (auto const& [rewardId, counters] : _counters)
+    {
+        auto& rewardStats = stats.emplace_back();
+        rewardStats.RewardID = rewardId;
+        rewardStats.Grants = counters.Grants;
+        rewardStats.ItemUnits = counters.ItemUnitsBagged + counters.ItemUnitsMailed;
+        rewardStats.ItemUnitsBagged = counters.ItemUnitsBagged;
+        rewardStats.ItemUnitsMailed = counters.ItemUnitsMailed;
+        rewardStats.MailedGrants = counters.MailedGrants;
+        rewardStats.Reputation = counters.Reputation;
+        rewardStats.SkippedIp = counters.Skipped[static_cast<std::size_t>(OnlineRewardSkipReason::Ip)];
+        rewardStats.SkippedAfk = counters.Skipped[static_cast<std::size_t>(OnlineRewardSkipReason::Afk)];
+        rewardStats.SkippedLevel = counters.Skipped[static_cast<std::size_t>(OnlineRewardSkipReason::Level)];
+        rewardStats.SkippedOther = counters.Skipped[static_cast<std::size_t>(OnlineRewardSkipReason::Other)];
+    }
+
+    storage->SaveRewardStats(_realmId, _periodStart, stats);
+
+    // Buckets are kept, the same rewards are counted next period
+    _counters.clear();
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WARHEAD_ONLINE_REWARD_TELEMETRY_H_
+#define _WARHEAD_ONLINE_REWARD_TELEMETRY_H_
+
+#include "Define.h"
+#include "Duration.h"
+#include <array>
+#include <unordered_map>
+
+// Why a due reward was not given, first failed condition
+enum class OnlineRewardSkipReason : uint8
+{
+    None,
+    Ip,
+    Afk,
+    Level,
+    Other, // Class, race, security, day of week, zone or map
+
+    Max
+};
+
+// Economy counters per reward, flushed to `wh_online_rewards_stats` with one insert per interval. World thread only
+class OnlineRewardTelemetry
+{
+    OnlineRewardTelemetry() = default;
+    ~OnlineRewardTelemetry() = default;
+
+    OnlineRewardTelemetry(OnlineRewardTelemetry const&) = delete;
+    OnlineRewardTelemetry(OnlineRewardTelemetry&&) = delete;
+    OnlineRewardTelemetry& operator= (OnlineRewardTelemetry const&) = delete;
+    OnlineRewardTelemetry& operator= (OnlineRewardTelemetry&&) = delete;
+
+    struct RewardCounters
+    {
+        uint64 Grants{};
+        uint64 ItemUnitsBagged{};
+        uint64 ItemUnitsMailed{};
+        uint64 MailedGrants{};
+        uint64 Reputation{};
+        std::array<uint64, static_cast<std::size_t>(OnlineRewardSkipReason::Max)> Skipped{};
+    };
+
+public:
+    static OnlineRewardTelemetry* instance();
+
+    void LoadConfig();
+    void Update(Milliseconds diff);
+
+    [[nodiscard]] inline bool IsEnabled() const { return _isEnable; }
+
+    void AddGrant(uint32 rewardId, uint64 reputation);
+    void AddItems(uint32 rewardId, uint64 bagged, uint64 mailed);
+    void AddSkip(uint32 rewardId, OnlineRewardSkipReason reason);
+
+    void Flush();
+
+private:
+    RewardCounters& GetCounters(uint32 rewardId);
+
+    // Config
+    bool _isEnable{};
+    Minutes _flushInterval{ 10min };
+    uint32 _realmId{ 1 };
+
+    std::unordered_map<uint32/*reward id*/, RewardCounters> _counters;
+    uint32 _periodStart{}; // Hour of `_counters`, they are flushed when it changes
+    Milliseconds _flushTimer{};
+};
+
+#define sORTelemetry OnlineRewardTelemetry::instance()
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineRewardTrace.h"
+#include "Config.h"
+#include "Log.h"
+#include "StringFormat.h"
+#include <fstream>
+
+namespace
+{
+    std::atomic<uint32> NextThreadId{ 1 };
+
+    uint32 GetTraceThreadId()
+    {
+        thread_local uint32 const threadId{ NextThreadId++ };
+        return threadId;
+    }
+}
+
+OnlineRewardTrace* OnlineRewardTrace::instance()
+{
+    static OnlineRewardTrace instance;
+    return &instance;
+}
+
+void OnlineRewardTrace::LoadConfig()
+{
+    _fileName = sConfigMgr->GetOption<std::string>("OR.Trace.File", "or_trace.json");
+    _defaultTicks = std::max<uint32>(1, sConfigMgr->GetOption<uint32>("OR.Trace.Ticks", 5));
+}
+
+bool OnlineRewardTrace::Start(uint32 ticks)
+{
+    if (IsEnabled())
+        return false;
+
+    {
+        std::lock_guard<std::mutex> guard(_eventsLock);
+        _events.clear();
+    }
+
+    _ticksLeft = std::max<uint32>(1, ticks);
+    _startTime = std::chrono::steady_clock::now();
+    _isEnabled = true;
+
+    LOG_INFO("module.or", "> OR Trace: Started for {} reward ticks", _ticksLeft);
+    return true;
+}
+
+void OnlineRewardTrace::OnTickEnd()
+{
+    if (!IsEnabled())
+        return;
+
+    if (--_ticksLeft)
+        return;
+
+    _isEnabled = false;
+    WriteFile();
+}
+
+void OnlineRewardTrace::AddSpan(char const* name, char const* category, TimePoint start, TimePoint end)
+{
+    std::lock_guard<std::mutex> guard(_eventsLock);
+    _events.emplace_back(TraceEvent{ name, category, start, end, GetTraceThreadId() });
+}
+
+void OnlineRewardTrace::WriteFile()
+{
+    std::vector<TraceEvent> events;
+
+    {
+        std::lock_guard<std::mutex> guard(_eventsLock);
+        events.swap(_events);
+    }
+
+    std::ofstream file(_fileName, std::ios::out | std::ios::trunc);
+    if (!file)
+    {
+        LOG_ERROR("module.or", "> OR Trace: Can't open file '{}' for write", _fileName);
+        return;
+    }
+
+    auto ToMicroseconds = [this](TimePoint timePoint)
+    {
+        return std::chrono::duration_cast<Microseconds>(timePoint - _startTime).count();
+    };
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    for (std::size_t i = 0; i < events.size(); ++i)
+    {
+        auto const& event{ events[i] };
+
+        if (i)
+            file << ",\n";
+
+        file << Acore::StringFormatFmt("{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":1,\"tid\":{}}}",
+            event.Name, event.Category, ToMicroseconds(event.Start), std::chrono::duration_cast<Microseconds>(event.End - event.Start).count(), event.ThreadId);
+    }
+
+    file << "]}\n";
+
+    LOG_INFO("module.or", "> OR Trace: Written {} spans to '{}'", events.size(), _fileName);
+}
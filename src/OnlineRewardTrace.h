@@ -0,0 +1,118 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WARHEAD_ONLINE_REWARD_TRACE_H_
+#define _WARHEAD_ONLINE_REWARD_TRACE_H_
+
+#include "Define.h"
+#include "Duration.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Records spans of reward ticks and writes them as Chrome trace-event JSON (chrome://tracing, Perfetto)
+class OnlineRewardTrace
+{
+    OnlineRewardTrace() = default;
+    ~OnlineRewardTrace() = default;
+
+    OnlineRewardTrace(OnlineRewardTrace const&) = delete;
+    OnlineRewardTrace(OnlineRewardTrace&&) = delete;
+    OnlineRewardTrace& operator= (OnlineRewardTrace const&) = delete;
+    OnlineRewardTrace& operator= (OnlineRewardTrace&&) = delete;
+
+    struct TraceEvent
+    {
+        char const* Name{};
+        char const* Category{};
+        TimePoint Start;
+        TimePoint End;
+        uint32 ThreadId{};
+    };
+
+public:
+    static OnlineRewardTrace* instance();
+
+    void LoadConfig();
+
+    // Start recording of next `ticks` reward ticks. Returns false if already recording
+    bool Start(uint32 ticks);
+    void OnTickEnd();
+
+    [[nodiscard]] inline bool IsEnabled() const { return _isEnabled.load(std::memory_order_relaxed); }
+    [[nodiscard]] inline uint32 GetDefaultTicks() const { return _defaultTicks; }
+    [[nodiscard]] inline std::string_view GetFileName() const { return _fileName; }
+
+    // Thread safe, used from eligibility workers
+    void AddSpan(char const* name, char const* category, TimePoint start, TimePoint end);
+
+private:
+    void WriteFile();
+
+    std::string _fileName{ "or_trace.json" };
+    uint32 _defaultTicks{ 5 };
+
+    std::atomic<bool> _isEnabled{};
+    uint32 _ticksLeft{};
+    TimePoint _startTime;
+
+    std::vector<TraceEvent> _events;
+    std::mutex _eventsLock;
+};
+
+#define sORTrace OnlineRewardTrace::instance()
+
+// Records the lifetime of the scope as a span, does nothing if tracing is not started
+class OnlineRewardTraceSpan
+{
+public:
+    explicit OnlineRewardTraceSpan(char const* name, char const* category = "tick") :
+        _name(name), _category(category), _isActive(sORTrace->IsEnabled())
+    {
+        if (_isActive)
+            _start = std::chrono::steady_clock::now();
+    }
+
+    ~OnlineRewardTraceSpan()
+    {
+        if (_isActive)
+            sORTrace->AddSpan(_name, _category, _start, std::chrono::steady_clock::now());
+    }
+
+    OnlineRewardTraceSpan(OnlineRewardTraceSpan const&) = delete;
+    OnlineRewardTraceSpan& operator= (OnlineRewardTraceSpan const&) = delete;
+
+private:
+    char const* _name;
+    char const* _category;
+    bool _isActive;
+    TimePoint _start;
+};
+
+// Start time of async query, empty if tracing is not started
+inline TimePoint GetTraceQueryStart()
+{
+    return sORTrace->IsEnabled() ? std::chrono::steady_clock::now() : TimePoint{};
+}
+
+inline void AddTraceQueryWait(char const* name, TimePoint queryStart)
+{
+    if (queryStart != TimePoint{} && sORTrace->IsEnabled())
+        sORTrace->AddSpan(name, "db", queryStart, std::chrono::steady_clock::now());
+}
+
+#endif
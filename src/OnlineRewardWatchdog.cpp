@@ -0,0 +1,234 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineRewardWatchdog.h"
+#include "Chat.h"
+#include "Config.h"
+#include "Log.h"
+#include "StringFormat.h"
+#include <algorithm>
+
+namespace
+{
+    double ToMilliseconds(Microseconds time)
+    {
+        return time.count() / 1000.0;
+    }
+
+    // Counters of metrics can be reset by `.or stats reset` in the middle of a tick
+    uint64 GetCounterDiff(uint64 end, uint64 begin)
+    {
+        return end >= begin ? end - begin : end;
+    }
+}
+
+OnlineRewardWatchdog* OnlineRewardWatchdog::instance()
+{
+    static OnlineRewardWatchdog instance;
+    return &instance;
+}
+
+void OnlineRewardWatchdog::LoadConfig()
+{
+    _isEnable = sConfigMgr->GetOption<bool>("OR.Watchdog.Enable", true);
+    _threshold = Milliseconds(sConfigMgr->GetOption<uint32>("OR.Watchdog.Threshold", 100));
+    _historySize = sConfigMgr->GetOption<uint32>("OR.Watchdog.History", 30);
+    _topCount = sConfigMgr->GetOption<uint32>("OR.Watchdog.TopCount", 5);
+
+    _history.clear();
+    _historyNext = 0;
+}
+
+void OnlineRewardWatchdog::BeginTick(MetricUpdate update)
+{
+    if (!_isEnable)
+        return;
+
+    // Vectors keep capacity, nothing is allocated by ticks without work
+    _current.Update = update;
+    _current.Phases.clear();
+    _current.PlayersScanned = 0;
+    _current.RewardsGranted = 0;
+    _current.SlowPlayers.clear();
+    _current.IpGroups.clear();
+
+    _statementsAtBegin = sORMetrics->GetStatementsTotal();
+    _mailRowsAtBegin = sORMetrics->GetMailRows();
+    _isTickActive = true;
+}
+
+void OnlineRewardWatchdog::EndTick(Microseconds total)
+{
+    if (!_isTickActive)
+        return;
+
+    _isTickActive = false;
+
+    _current.End = std::chrono::steady_clock::now();
+    _current.Total = total;
+    _current.Statements = GetCounterDiff(sORMetrics->GetStatementsTotal(), _statementsAtBegin);
+    _current.MailRows = GetCounterDiff(sORMetrics->GetMailRows(), _mailRowsAtBegin);
+    _current.IsSlow = _threshold > 0ms && total >= _threshold;
+
+    if (_current.IsSlow)
+        LogTick(_current);
+
+    // Idle updates are not kept, they would push reward ticks out of the buffer in a few seconds
+    if (!_historySize || (!_current.IsSlow && !_current.PlayersScanned && !_current.Statements && !_current.MailRows))
+        return;
+
+    if (_history.size() < _historySize)
+        _history.emplace_back(_current);
+    else
+        _history[_historyNext] = _current;
+
+    _historyNext = (_historyNext + 1) % _historySize;
+}
+
+void OnlineRewardWatchdog::AddPhase(char const* name, Microseconds time)
+{
+    if (!IsEnabled())
+        return;
+
+    // Same phase can run several times in one tick, e.g. callbacks of several queries
+    auto itr = std::find_if(_current.Phases.begin(), _current.Phases.end(), [name](auto const& phase) { return phase.first == name; });
+    if (itr != _current.Phases.end())
+        itr->second += time;
+    else
+        _current.Phases.emplace_back(name, time);
+}
+
+void OnlineRewardWatchdog::AddPlayersScanned(uint64 count)
+{
+    if (IsEnabled())
+        _current.PlayersScanned += count;
+}
+
+void OnlineRewardWatchdog::AddRewardsGranted(uint64 count)
+{
+    if (IsEnabled())
+        _current.RewardsGranted += count;
+}
+
+void OnlineRewardWatchdog::AddSlowPlayers(std::span<OnlineRewardSlowPlayer const> players)
+{
+    if (!IsEnabled())
+        return;
+
+    for (auto const& player : players)
+        AddSlowPlayer(_current.SlowPlayers, player, _topCount);
+}
+
+void OnlineRewardWatchdog::AddIpGroup(std::string_view address, std::size_t players)
+{
+    if (!IsEnabled() || !_topCount)
+        return;
+
+    auto& groups{ _current.IpGroups };
+
+    if (groups.size() == _topCount && groups.back().Players >= players)
+        return;
+
+    auto itr = std::find_if(groups.begin(), groups.end(), [players](IpGroup const& group) { return group.Players < players; });
+    groups.insert(itr, IpGroup{ std::string(address), players });
+
+    if (groups.size() > _topCount)
+        groups.pop_back();
+}
+
+/*static*/ void OnlineRewardWatchdog::AddSlowPlayer(std::vector<OnlineRewardSlowPlayer>& slowPlayers, OnlineRewardSlowPlayer player, std::size_t count)
+{
+    if (!count || (slowPlayers.size() == count && slowPlayers.back().Time >= player.Time))
+        return;
+
+    auto itr = std::find_if(slowPlayers.begin(), slowPlayers.end(), [&player](OnlineRewardSlowPlayer const& slowPlayer) { return slowPlayer.Time < player.Time; });
+    slowPlayers.insert(itr, player);
+
+    if (slowPlayers.size() > count)
+        slowPlayers.pop_back();
+}
+
+void OnlineRewardWatchdog::LogTick(TickSummary const& tick) const
+{
+    Microseconds phasesTime{ 0us };
+    std::string phases;
+
+    for (auto const& [name, time] : tick.Phases)
+    {
+        phasesTime += time;
+        phases.append(Acore::StringFormatFmt("{}={:.2f} ", name, ToMilliseconds(time)));
+    }
+
+    phases.append(Acore::StringFormatFmt("other={:.2f}", ToMilliseconds(tick.Total > phasesTime ? tick.Total - phasesTime : 0us)));
+
+    LOG_WARN("module.or", "> OR Watchdog: {} took {:.2f} ms, threshold {} ms", GetMetricUpdateName(tick.Update), ToMilliseconds(tick.Total), _threshold.count());
+    LOG_WARN("module.or", "-- phases ms: {}", phases);
+    LOG_WARN("module.or", "-- players_scanned={} rewards_granted={} db_statements={} mail_rows={}",
+        tick.PlayersScanned, tick.RewardsGranted, tick.Statements, tick.MailRows);
+
+    if (!tick.SlowPlayers.empty())
+    {
+        std::string players;
+
+        for (auto const& player : tick.SlowPlayers)
+            players.append(Acore::StringFormatFmt("{}={}us ", player.LowGuid, player.Time.count()));
+
+        LOG_WARN("module.or", "-- slowest players (guid): {}", players);
+    }
+
+    if (!tick.IpGroups.empty())
+    {
+        std::string groups;
+
+        for (auto const& group : tick.IpGroups)
+            groups.append(Acore::StringFormatFmt("{}={} ", group.Address, group.Players));
+
+        LOG_WARN("module.or", "-- largest ip groups (players): {}", groups);
+    }
+}
+
+void OnlineRewardWatchdog::PrintHistory(ChatHandler* handler) const
+{
+    if (_history.empty())
+    {
+        handler->SendSysMessage("> Watchdog: no ticks with work yet");
+        return;
+    }
+
+    handler->SendSysMessage(Acore::StringFormatFmt("> Watchdog: last {} ticks with work, newest first. Threshold {} ms", _history.size(), _threshold.count()));
+
+    auto const now{ std::chrono::steady_clock::now() };
+
+    for (std::size_t i = 0; i < _history.size(); ++i)
+    {
+        auto const& tick{ _history[(_historyNext + _history.size() - 1 - i) % _history.size()] };
+
+        handler->SendSysMessage(Acore::StringFormatFmt("-- {} s ago{}: {} {:.2f} ms, players {}, rewards {}, db statements {}, mail rows {}",
+            std::chrono::duration_cast<Seconds>(now - tick.End).count(), tick.IsSlow ? " [slow]" : "", GetMetricUpdateName(tick.Update),
+            ToMilliseconds(tick.Total), tick.PlayersScanned, tick.RewardsGranted, tick.Statements, tick.MailRows));
+
+        if (tick.Phases.empty())
+            continue;
+
+        std::string phases;
+
+        for (auto const& [name, time] : tick.Phases)
+            phases.append(Acore::StringFormatFmt(" {} {:.2f}", name, ToMilliseconds(time)));
+
+        handler->SendSysMessage(Acore::StringFormatFmt("---- phases ms:{}", phases));
+    }
+}
@@ -0,0 +1,163 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WARHEAD_ONLINE_REWARD_WATCHDOG_H_
+#define _WARHEAD_ONLINE_REWARD_WATCHDOG_H_
+
+#include "Define.h"
+#include "Duration.h"
+#include "ObjectGuid.h"
+#include "OnlineRewardMetrics.h"
+#include <span>
+#include <string>
+#include <vector>
+
+class ChatHandler;
+
+struct OnlineRewardSlowPlayer
+{
+    ObjectGuid::LowType LowGuid{};
+    Microseconds Time{};
+};
+
+// Breakdown of update calls of the module. Slow ones are logged to `module.or`,
+// recent ones with work are kept for `.or watchdog`. World thread only
+class OnlineRewardWatchdog
+{
+    OnlineRewardWatchdog() = default;
+    ~OnlineRewardWatchdog() = default;
+
+    OnlineRewardWatchdog(OnlineRewardWatchdog const&) = delete;
+    OnlineRewardWatchdog(OnlineRewardWatchdog&&) = delete;
+    OnlineRewardWatchdog& operator= (OnlineRewardWatchdog const&) = delete;
+    OnlineRewardWatchdog& operator= (OnlineRewardWatchdog&&) = delete;
+
+    struct IpGroup
+    {
+        std::string Address;
+        std::size_t Players{};
+    };
+
+    struct TickSummary
+    {
+        MetricUpdate Update{};
+        TimePoint End;
+        Microseconds Total{};
+        std::vector<std::pair<char const*, Microseconds>> Phases;
+        uint64 PlayersScanned{};
+        uint64 RewardsGranted{};
+        uint64 Statements{};
+        uint64 MailRows{};
+        std::vector<OnlineRewardSlowPlayer> SlowPlayers;
+        std::vector<IpGroup> IpGroups;
+        bool IsSlow{};
+    };
+
+public:
+    static OnlineRewardWatchdog* instance();
+
+    void LoadConfig();
+
+    [[nodiscard]] inline bool IsEnabled() const { return _isEnable && _isTickActive; }
+    [[nodiscard]] inline std::size_t GetTopCount() const { return _topCount; }
+
+    void BeginTick(MetricUpdate update);
+    void EndTick(Microseconds total);
+
+    // Ignored outside of a tick
+    void AddPhase(char const* name, Microseconds time);
+    void AddPlayersScanned(uint64 count);
+    void AddRewardsGranted(uint64 count);
+    void AddSlowPlayers(std::span<OnlineRewardSlowPlayer const> players);
+    void AddIpGroup(std::string_view address, std::size_t players);
+
+    // Keeps `count` slowest players in `slowPlayers`, slowest first. Used by eligibility workers for own partition
+    static void AddSlowPlayer(std::vector<OnlineRewardSlowPlayer>& slowPlayers, OnlineRewardSlowPlayer player, std::size_t count);
+
+    void PrintHistory(ChatHandler* handler) const;
+
+private:
+    void LogTick(TickSummary const& tick) const;
+
+    // Config
+    bool _isEnable{ true };
+    Milliseconds _threshold{ 100ms };
+    std::size_t _historySize{ 30 };
+    std::size_t _topCount{ 5 };
+
+    // Current tick, counters of metrics are taken at begin
+    bool _isTickActive{};
+    TickSummary _current;
+    uint64 _statementsAtBegin{};
+    uint64 _mailRowsAtBegin{};
+
+    // Ring buffer, `_historyNext` is the oldest entry once it's full
+    std::vector<TickSummary> _history;
+    std::size_t _historyNext{};
+};
+
+#define sORWatchdog OnlineRewardWatchdog::instance()
+
+// Update call of `update` is one tick
+class OnlineRewardWatchdogTick
+{
+public:
+    explicit OnlineRewardWatchdogTick(MetricUpdate update) :
+        _start(std::chrono::steady_clock::now())
+    {
+        sORWatchdog->BeginTick(update);
+    }
+
+    ~OnlineRewardWatchdogTick()
+    {
+        sORWatchdog->EndTick(std::chrono::duration_cast<Microseconds>(std::chrono::steady_clock::now() - _start));
+    }
+
+    OnlineRewardWatchdogTick(OnlineRewardWatchdogTick const&) = delete;
+    OnlineRewardWatchdogTick& operator= (OnlineRewardWatchdogTick const&) = delete;
+
+private:
+    TimePoint _start;
+};
+
+// Adds the lifetime of the scope as a phase of current tick. World thread only
+class OnlineRewardWatchdogPhase
+{
+public:
+    explicit OnlineRewardWatchdogPhase(char const* name) :
+        _name(name), _isActive(sORWatchdog->IsEnabled())
+    {
+        if (_isActive)
+            _start = std::chrono::steady_clock::now();
+    }
+
+    ~OnlineRewardWatchdogPhase()
+    {
+        if (_isActive)
+            sORWatchdog->AddPhase(_name, std::chrono::duration_cast<Microseconds>(std::chrono::steady_clock::now() - _start));
+    }
+
+    OnlineRewardWatchdogPhase(OnlineRewardWatchdogPhase const&) = delete;
+    OnlineRewardWatchdogPhase& operator= (OnlineRewardWatchdogPhase const&) = delete;
+
+private:
+    char const* _name;
+    bool _isActive;
+    TimePoint _start;
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * This file is part of the WarheadCore Project. See AUTHORS file for Copyright information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _WARHEAD_ONLINE_REWARD_WORKER_POOL_H_
+#define _WARHEAD_ONLINE_REWARD_WORKER_POOL_H_
+
+#include "Define.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads which live between ticks, so a tick does not create threads.
+// Run(), RunAsync() and Start() are called by one thread, the one which owns the pool.
+class OnlineRewardWorkerPool
+{
+public:
+    using Task = std::function<void(std::size_t/*index*/)>;
+
+    OnlineRewardWorkerPool() = default;
+    ~OnlineRewardWorkerPool() { Stop(); }
+
+    OnlineRewardWorkerPool(OnlineRewardWorkerPool const&) = delete;
+    OnlineRewardWorkerPool& operator= (OnlineRewardWorkerPool const&) = delete;
+
+    // Threads are created again only if the count is changed
+    void Start(std::size_t threads)
+    {
+        if (threads == _threads.size())
+            return;
+
+        Stop();
+
+        _isStopping = false;
+
+        for (std::size_t i = 0; i < threads; ++i)
+            _threads.emplace_back(&OnlineRewardWorkerPool::WorkerThread, this);
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _isStopping = true;
+        }
+
+        _taskCondition.notify_all();
+
+        for (auto& thread : _threads)
+            thread.join();
+
+        _threads.clear();
+    }
+
+    [[nodiscard]] std::size_t GetSize() const { return _threads.size(); }
+
+    // Calls `task(0)` in the caller thread and `task(1)` .. `task(count - 1)` in workers, returns when all are done.
+    // `count` must not be bigger than `GetSize() + 1`
+    void Run(std::size_t count, Task const& task)
+    {
+        if (count > 1)
+        {
+            {
+                std::lock_guard<std::mutex> guard(_lock);
+                _task = &task;
+                _nextIndex = 1;
+                _count = count;
+                _running = count - 1;
+            }
+
+            _taskCondition.notify_all();
+        }
+
+        task(0);
+
+        if (count <= 1)
+            return;
+
+        std::unique_lock<std::mutex> lock(_lock);
+        _doneCondition.wait(lock, [this]() { return !_running; });
+        _task = nullptr;
+    }
+
+    // Calls `task(0)` in a worker and returns at once, it's finished when `IsDone()`.
+    // Pool must have a thread, next call only after the task is done
+    void RunAsync(Task task)
+    {
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _asyncTask = std::move(task);
+            _task = &_asyncTask;
+            _nextIndex = 0;
+            _count = 1;
+            _running = 1;
+        }
+
+        _taskCondition.notify_one();
+    }
+
+    [[nodiscard]] bool IsDone()
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        return !_running;
+    }
+
+private:
+    void WorkerThread()
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+
+        for (;;)
+        {
+            _taskCondition.wait(lock, [this]() { return _isStopping || (_task && _nextIndex < _count); });
+
+            if (_isStopping)
+                return;
+
+            auto const index{ _nextIndex++ };
+            auto const* task{ _task };
+
+            lock.unlock();
+            (*task)(index);
+            lock.lock();
+
+            if (!--_running)
+                _doneCondition.notify_one();
+        }
+    }
+
+    std::vector<std::thread> _threads;
+    std::mutex _lock;
+    std::condition_variable _taskCondition;
+    std::condition_variable _doneCondition;
+    Task const* _task{};
+    Task _asyncTask;
+    std::size_t _nextIndex{};
+    std::size_t _count{};
+    std::size_t _running{};
+    bool _isStopping{};
+};
+
+#endif
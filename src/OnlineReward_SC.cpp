@@ -18,8 +18,15 @@
 #include "Chat.h"
 #include "ExternalMail.h"
 #include "OnlineReward.h"
+#include "OnlineRewardMaintenance.h"
+#include "OnlineRewardMetrics.h"
+#include "OnlineRewardTelemetry.h"
+#include "OnlineRewardTrace.h"
+#include "OnlineRewardWatchdog.h"
 #include "Player.h"
 #include "ScriptMgr.h"
+#include "StringConvert.h"
+#include "Tokenize.h"
 
 using namespace Acore::ChatCommands;
 
@@ -38,6 +45,14 @@ public:
             { "next",       HandleOnlineRewardNextCommand,      SEC_PLAYER,         Console::No },
             { "reload",     HandleOnlineRewardReloadCommand,    SEC_ADMINISTRATOR,  Console::Yes },
             { "init",       HandleOnlineRewardInitCommand,      SEC_ADMINISTRATOR,  Console::Yes },
+            { "maintenance",HandleOnlineRewardMaintenanceCommand, SEC_ADMINISTRATOR, Console::Yes },
+            { "trace",      HandleOnlineRewardTraceCommand,     SEC_ADMINISTRATOR,  Console::Yes },
+            { "stats",      HandleOnlineRewardStatsCommand,     SEC_ADMINISTRATOR,  Console::Yes },
+            { "watchdog",   HandleOnlineRewardWatchdogCommand,  SEC_ADMINISTRATOR,  Console::Yes },
+            { "delivery",   HandleOnlineRewardDeliveryCommand,  SEC_ADMINISTRATOR,  Console::Yes },
+            { "soak",       HandleOnlineRewardSoakCommand,      SEC_ADMINISTRATOR,  Console::Yes },
+            { "bench",      HandleOnlineRewardBenchCommand,     SEC_ADMINISTRATOR,  Console::Yes },
+            { "mailcheck",  HandleOnlineRewardMailCheckCommand, SEC_ADMINISTRATOR,  Console::Yes },
         };
 
         static ChatCommandTable commandTable =
@@ -60,7 +75,10 @@ public:
         auto timeString = Acore::Time::ToTimeString(seconds);
         timeString.append(Acore::StringFormatFmt(" ({})", seconds.count()));
 
-        if (sORMgr->AddReward(sORMgr->GetLastId() + 1, isPerOnline, seconds, level, items, reputations.value_or(""), handler))
+        OnlineRewardConditions conditions;
+        conditions.MinLevel = level;
+
+        if (sORMgr->AddReward(sORMgr->GetLastId() + 1, isPerOnline, seconds, std::move(conditions), items, reputations.value_or(""), handler))
             handler->PSendSysMessage("> Награда добавлена");
 
         return true;
@@ -72,33 +90,79 @@ public:
         return true;
     }
 
-    static bool HandleOnlineRewardListCommand(ChatHandler* handler)
+    // .or list [page] [item:ID] [faction:ID] [type:once|time] [level:MIN[-MAX]]
+    static bool HandleOnlineRewardListCommand(ChatHandler* handler, Tail args)
     {
-        handler->PSendSysMessage("> Список наград за онлайн:");
+        constexpr std::size_t LIST_PAGE_SIZE = 20;
 
-        std::size_t count{ 0 };
+        OnlineRewardListFilter filter;
+        std::size_t page{ 1 };
 
-        for (auto const& [id, onlineReward] : sORMgr->GetOnlineRewards())
+        for (auto const& arg : Acore::Tokenize(args, ' ', false))
         {
-            handler->PSendSysMessage(Acore::StringFormatFmt("{}. {}. IsPerOnline? {}", ++count, Acore::Time::ToTimeString(onlineReward.RewardTime), onlineReward.IsPerOnline).c_str());
+            auto tokens = Acore::Tokenize(arg, ':', false);
+            std::optional<uint32> value;
+
+            if (tokens.size() == 1 && (value = Acore::StringTo<uint32>(tokens[0])) && *value)
+                page = *value;
+            else if (tokens.size() == 2 && tokens[0] == "item" && (value = Acore::StringTo<uint32>(tokens[1])))
+                filter.ItemID = *value;
+            else if (tokens.size() == 2 && tokens[0] == "faction" && (value = Acore::StringTo<uint32>(tokens[1])))
+                filter.FactionID = *value;
+            else if (tokens.size() == 2 && tokens[0] == "type" && (tokens[1] == "once" || tokens[1] == "time"))
+                filter.IsPerOnline = tokens[1] == "once";
+            else if (tokens.size() == 2 && tokens[0] == "level")
+            {
+                auto levels = Acore::Tokenize(tokens[1], '-', false);
+                std::optional<uint8> minLevel = levels.empty() ? std::nullopt : Acore::StringTo<uint8>(levels[0]);
+                std::optional<uint8> maxLevel = levels.size() == 2 ? Acore::StringTo<uint8>(levels[1]) : minLevel;
+
+                if (!minLevel || !maxLevel || levels.size() > 2)
+                {
+                    handler->PSendSysMessage(Acore::StringFormatFmt("> Неверный диапазон уровней '{}'", tokens[1]).c_str());
+                    return true;
+                }
+
+                filter.MinLevel = *minLevel;
+                filter.MaxLevel = *maxLevel;
+            }
+            else
+            {
+                handler->PSendSysMessage(Acore::StringFormatFmt("> Неверный аргумент '{}'. Использование: .or list [страница] [item:ID] [faction:ID] [type:once|time] [level:MIN[-MAX]]", arg).c_str());
+                return true;
+            }
+        }
+
+        std::vector<OnlineReward const*> rewards;
+        std::size_t total = sORMgr->GetRewardsPage(filter, page - 1, LIST_PAGE_SIZE, rewards);
+        std::size_t pages = std::max<std::size_t>(1, (total + LIST_PAGE_SIZE - 1) / LIST_PAGE_SIZE);
 
-            if (!onlineReward.Items.empty())
+        handler->PSendSysMessage(Acore::StringFormatFmt("> Список наград за онлайн. Найдено: {}, страница {}/{}", total, page, pages).c_str());
+
+        // One line per reward, only rewards of the page are formatted
+        for (auto onlineReward : rewards)
+        {
+            auto const& conditions{ onlineReward->Conditions };
+            std::string line{ Acore::StringFormatFmt("{}. {}. IsPerOnline? {}. Уровень {}-{}", onlineReward->ID, Acore::Time::ToTimeString(onlineReward->RewardTime),
+                onlineReward->IsPerOnline, conditions.MinLevel, conditions.MaxLevel) };
+
+            if (!onlineReward->Items.empty())
             {
-                handler->SendSysMessage("-- Предметы:");
+                line.append(". Предметы:");
 
-                for (auto const& [itemID, itemCount] : onlineReward.Items)
-                    handler->PSendSysMessage(Acore::StringFormatFmt("> {}/{}", itemID, itemCount).c_str());
+                for (auto const& [itemID, itemCount] : onlineReward->Items)
+                    line.append(Acore::StringFormatFmt(" {}/{}", itemID, itemCount));
             }
 
-            if (!onlineReward.Reputations.empty())
+            if (!onlineReward->Reputations.empty())
             {
-                handler->SendSysMessage("-- Репутация:");
+                line.append(". Репутация:");
 
-                for (auto const& [faction, reputation] : onlineReward.Reputations)
-                    handler->PSendSysMessage(Acore::StringFormatFmt("> {}/{}", faction, reputation).c_str());
+                for (auto const& [factionEntry, reputation] : onlineReward->Reputations)
+                    line.append(Acore::StringFormatFmt(" {}/{}", factionEntry->ID, reputation));
             }
 
-            handler->SendSysMessage("--");
+            handler->SendSysMessage(line);
         }
 
         return true;
@@ -131,6 +195,95 @@ public:
         handler->PSendSysMessage("> Инициализирована выдача наград за онлайн");
         return true;
     }
+
+    static bool HandleOnlineRewardMaintenanceCommand(ChatHandler* handler)
+    {
+        if (!sORMaintenance->Start())
+        {
+            handler->PSendSysMessage("> Очистка истории уже запущена");
+            return true;
+        }
+
+        handler->PSendSysMessage("> Запущена очистка истории наград. Результат будет в логе `module.or`");
+        return true;
+    }
+
+    static bool HandleOnlineRewardTraceCommand(ChatHandler* handler, std::optional<uint32> ticks)
+    {
+        if (!sORTrace->Start(ticks.value_or(sORTrace->GetDefaultTicks())))
+        {
+            handler->PSendSysMessage("> Трассировка уже запущена");
+            return true;
+        }
+
+        handler->PSendSysMessage(Acore::StringFormatFmt("> Трассировка запущена. Файл: {}", sORTrace->GetFileName()).c_str());
+        return true;
+    }
+
+    static bool HandleOnlineRewardStatsCommand(ChatHandler* handler, std::optional<std::string_view> action)
+    {
+        if (action == "reset")
+        {
+            sORMetrics->Reset();
+            handler->PSendSysMessage("> Статистика сброшена");
+            return true;
+        }
+
+        sORMetrics->PrintStats(handler);
+        return true;
+    }
+
+    static bool HandleOnlineRewardWatchdogCommand(ChatHandler* handler)
+    {
+        sORWatchdog->PrintHistory(handler);
+        return true;
+    }
+
+    // .or soak <players> [minutes], 0 players stops the run
+    static bool HandleOnlineRewardSoakCommand(ChatHandler* handler, uint32 players, std::optional<uint32> minutes)
+    {
+        if (!players)
+        {
+            sORMgr->StopSoak();
+            handler->SendSysMessage("> Soak run is stopped");
+            return true;
+        }
+
+        sORMgr->StartSoak(players, Minutes(std::max<uint32>(1, minutes.value_or(60))), handler);
+        return true;
+    }
+
+    // .or bench <players> [hours], history formats compared on character DB. Hours is max played time of generated players
+    static bool HandleOnlineRewardBenchCommand(ChatHandler* handler, uint32 players, std::optional<uint32> hours)
+    {
+        sORMgr->BenchmarkHistoryFormats(players, Hours(hours.value_or(500)), handler);
+        return true;
+    }
+
+    // .or mailcheck <rows> [claimers], every row of `mail_external` must be sent once by several claimers with short leases
+    static bool HandleOnlineRewardMailCheckCommand(ChatHandler* handler, uint32 rows, std::optional<uint32> claimers)
+    {
+        sExternalMail->StartClaimCheck(rows, claimers.value_or(3), handler);
+        return true;
+    }
+
+    // Check of full bags: selected player with full bags must get everything in mail rows which are not rejected.
+    // `.or delivery check` runs the scripted check with synthetic bags, no player is needed
+    static bool HandleOnlineRewardDeliveryCommand(ChatHandler* handler, std::optional<std::string_view> action)
+    {
+        if (action == "check")
+        {
+            sORMgr->RunItemDeliveryChecks(handler);
+            return true;
+        }
+
+        auto player = handler->getSelectedPlayerOrSelf();
+        if (!player)
+            return false;
+
+        sORMgr->CheckItemDelivery(player, handler);
+        return true;
+    }
 };
 
 class OnlineReward_Player : public PlayerScript
@@ -140,12 +293,24 @@ public:
 
     void OnLogin(Player* player) override
     {
-        sORMgr->AddRewardHistory(player->GetGUID().GetCounter());
+        sORMgr->AddRewardHistory(player->GetGUID().GetCounter(), Seconds(player->GetTotalPlayedTime()));
+        sORMgr->AddPlayerAddress(player->GetGUID().GetCounter(), player->GetSession()->GetRemoteAddress());
     }
 
     void OnLogout(Player* player) override
     {
         sORMgr->DeleteRewardHistory(player->GetGUID().GetCounter());
+        sORMgr->DeletePlayerAddress(player->GetGUID().GetCounter(), player->GetSession()->GetRemoteAddress());
+    }
+
+    void OnLevelChanged(Player* player, uint8 /*oldLevel*/) override
+    {
+        sORMgr->AddRewardDueEvent(player->GetGUID().GetCounter());
+    }
+
+    void OnBeforeUpdate(Player* player, uint32 /*diff*/) override
+    {
+        sORMgr->CheckAfkChange(player);
     }
 };
 
@@ -157,6 +322,12 @@ public:
     void OnAfterConfigLoad(bool reload) override
     {
         sORMgr->LoadConfig(reload);
+        sORMaintenance->LoadConfig();
+        sORTrace->LoadConfig();
+        sORMetrics->LoadConfig();
+        sORWatchdog->LoadConfig();
+        sORTelemetry->LoadConfig();
+        sExternalMail->LoadConfig();
     }
 
     void OnStartup() override
@@ -165,10 +336,20 @@ public:
         sExternalMail->LoadSystem();
     }
 
+    void OnShutdown() override
+    {
+        sORMgr->OnShutdown();
+        sExternalMail->OnShutdown();
+        sORTelemetry->Flush();
+    }
+
     void OnUpdate(uint32 diff) override
     {
         sORMgr->Update(Milliseconds(diff));
         sExternalMail->Update(diff);
+        sORMaintenance->Update(Milliseconds(diff));
+        sORMetrics->Update(Milliseconds(diff));
+        sORTelemetry->Update(Milliseconds(diff));
     }
 };
 